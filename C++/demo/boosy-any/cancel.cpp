@@ -0,0 +1,30 @@
+#include "cancel.h"
+
+namespace {
+    thread_local const YHL::detail::cancel_state *current_token = nullptr;
+    thread_local const YHL::detail::cancel_state *current_pool = nullptr;
+
+    bool cancelled(const YHL::detail::cancel_state *state) noexcept {
+        return state not_eq nullptr and state->cancelled.load(std::memory_order_acquire);
+    }
+}
+
+bool YHL::this_task::is_cancelled() noexcept {
+    return cancelled(current_token) or cancelled(current_pool);
+}
+
+void YHL::this_task::throw_if_cancelled() {
+    if(is_cancelled())
+        throw task_cancelled();
+}
+
+YHL::detail::cancel_scope::cancel_scope(const cancel_state *token, const cancel_state *pool) noexcept
+    : saved_token(current_token), saved_pool(current_pool) {
+    current_token = token;
+    current_pool = pool;
+}
+
+YHL::detail::cancel_scope::~cancel_scope() {
+    current_token = saved_token;
+    current_pool = saved_pool;
+}
@@ -0,0 +1,115 @@
+#ifndef CANCEL_H
+#define CANCEL_H
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+/* 使用说明
+    YHL::cancel_source source;
+    auto result = pool.enqueue(source.token(), []{
+        for(int i = 0;i < 1000; ++i) {
+            YHL::this_task::throw_if_cancelled();    // 执行中的任务自己检查
+            step(i);
+        }
+        return 42;
+    });
+    source.cancel();            // 还在排队的直接丢掉, 正在执行的在下一次检查时退出
+    try {
+        result.get();
+    }
+    catch(const YHL::task_cancelled&) { ... }
+ */
+
+/*
+ * 注意事项
+ * 1. cancel_source 发出取消, cancel_token 只能查询, 两者共享一个原子标志, 拷贝 token 只是拷贝 shared_ptr
+ * 2. 取消是协作式的 : 排队中的任务出队时发现已取消就不执行; 执行中的任务要自己调用 this_task::is_cancelled
+ * 3. this_task 查询的是当前线程正在执行的那个任务的 token, 以及线程池的 cancel_all, 没有 token 的任务总是 false
+ * 4. thread_pool::cancel_all 只影响带 token 提交的任务（默认构造的 token 也算）;
+ *    普通任务可能是 task_group、task_graph 内部的一步, 丢掉一步整组就失败了
+ */
+
+namespace YHL {
+
+    // 被取消的任务, future 里得到的就是这个异常
+    class task_cancelled : public std::runtime_error {
+    public:
+        task_cancelled() : std::runtime_error("task cancelled") {}
+    };
+
+    namespace detail {
+        struct cancel_state {
+            std::atomic<bool> cancelled{false};
+        };
+    }
+
+    class cancel_token final {
+    private:
+        std::shared_ptr<const detail::cancel_state> state;
+
+        friend class cancel_source;
+        friend struct cancel_access;
+
+    public:
+        cancel_token() = default;    // 永远不会被取消
+
+        bool is_cancelled() const noexcept {
+            return state not_eq nullptr and state->cancelled.load(std::memory_order_acquire);
+        }
+        bool can_be_cancelled() const noexcept {
+            return state not_eq nullptr;
+        }
+    };
+
+    class cancel_source final {
+    private:
+        std::shared_ptr<detail::cancel_state> state;
+
+    public:
+        cancel_source() : state(std::make_shared<detail::cancel_state>()) {}
+
+        cancel_token token() const {
+            cancel_token res;
+            res.state = state;
+            return res;
+        }
+        void cancel() noexcept {
+            state->cancelled.store(true, std::memory_order_release);
+        }
+        bool is_cancelled() const noexcept {
+            return state->cancelled.load(std::memory_order_acquire);
+        }
+    };
+
+    // 线程池要拿到 token 里的状态
+    struct cancel_access {
+        static const detail::cancel_state* state(const cancel_token& token) noexcept {
+            return token.state.get();
+        }
+    };
+
+    namespace this_task {
+        // 当前任务是否已经被取消（自己的 token 或者线程池的 cancel_all）
+        bool is_cancelled() noexcept;
+
+        // 已经取消就抛出 task_cancelled
+        void throw_if_cancelled();
+    }
+
+    namespace detail {
+        // 执行带 token 的任务期间, 让 this_task 能看到它的 token 和所属线程池的取消标志
+        class cancel_scope final {
+        private:
+            const cancel_state *saved_token;
+            const cancel_state *saved_pool;
+        public:
+            cancel_scope(const cancel_state *token, const cancel_state *pool) noexcept;
+            ~cancel_scope();
+            cancel_scope(const cancel_scope&) = delete;
+            cancel_scope& operator=(const cancel_scope&) = delete;
+        };
+    }
+
+}
+
+#endif // CANCEL_H
@@ -0,0 +1,419 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+#include "threadpool.h"
+
+/* 使用说明（需要 C++20, 用 C++14 编译时这个头文件是空的）
+    YHL::task<int> load(YHL::thread_pool& pool, int key) {
+        co_await pool.schedule();                                    // 换到工作线程上执行
+        co_await YHL::sleep_for(pool, std::chrono::milliseconds(5));  // 定时器到了再回来, 不占线程
+        const int base = co_await pool.submit([key]{ return key * 10; });   // task_future 也可以 co_await
+        co_return base + 1;
+    }
+
+    YHL::task<int> handler(YHL::thread_pool& pool) {
+        const int a = co_await load(pool, 1);    // task 是惰性的, co_await 的时候才开始执行
+        const int b = co_await load(pool, 2);
+        co_return a + b;
+    }
+
+    std::cout << YHL::sync_wait(handler(pool)) << "\n";   // 只在程序的边界上阻塞等待
+    YHL::spawn(pool, session(pool));                     // 不等结果, 异常交给线程池的 exception_handler
+ */
+
+/*
+ * 注意事项
+ * 1. task<T> 是惰性的 : 创建时不执行, 被 co_await 时才开始; 执行完通过对称转移直接恢复等待它的协程, 不会越嵌套栈越深
+ * 2. pool.schedule() 把协程的恢复交给线程池; sleep_for 交给线程池的定时器; co_await task_future 挂在它的后续任务槽上,
+ *    三种情况在等待期间都不占用任何线程
+ * 3. 协程帧从线程局部的空闲链表分配, 按 64 字节分级, 最大 1024 字节, 每级最多缓存 256 个;
+ *    在别的线程上释放的帧进入那个线程的链表
+ * 4. 协程里的异常保存在 promise 里, 在 co_await 它的地方（或者 sync_wait 里）重新抛出
+ * 5. task 对象必须活到协程结束; 只 co_await 一次; co_await 被移走的 task 抛出 std::logic_error
+ * 6. 恢复协程的任务没执行就被线程池丢掉（shutdown、drop_oldest）时, 协程在丢掉它的线程上恢复,
+ *    co_await pool.schedule() / sleep_for 抛出 task_cancelled, co_await task_future 照常拿到结果
+ */
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <new>
+#include <variant>
+#include <coroutine>
+#include <stdexcept>
+#include <exception>
+
+namespace YHL {
+
+    namespace detail {
+
+        // 线程局部的协程帧空闲链表
+        class frame_pool final : boost::noncopyable {
+        private:
+            static constexpr size_t granularity = 64;
+            static constexpr size_t classes = 16;
+            static constexpr size_t keep = 256;
+
+            struct node { node *next; };
+            node *heads[classes] = {};
+            size_t counts[classes] = {};
+
+            frame_pool() = default;
+
+        public:
+            ~frame_pool() {
+                for(auto head : heads) {
+                    while(head not_eq nullptr) {
+                        node *next = head->next;
+                        ::operator delete(head);
+                        head = next;
+                    }
+                }
+            }
+
+            static frame_pool& local() {
+                thread_local frame_pool one;
+                return one;
+            }
+
+            void* allocate(const size_t size) {
+                const size_t index = (size + granularity - 1) / granularity - 1;
+                if(index >= classes)
+                    return ::operator new(size);
+                if(node *one = heads[index]) {
+                    heads[index] = one->next;
+                    --counts[index];
+                    return one;
+                }
+                return ::operator new((index + 1) * granularity);
+            }
+
+            void deallocate(void *raw, const size_t size) noexcept {
+                const size_t index = (size + granularity - 1) / granularity - 1;
+                if(index >= classes or counts[index] >= keep) {
+                    ::operator delete(raw);
+                    return;
+                }
+                node *one = static_cast<node*>(raw);
+                one->next = heads[index];
+                heads[index] = one;
+                ++counts[index];
+            }
+        };
+
+        // promise 继承它, 协程帧就从 frame_pool 分配
+        struct pooled_frame {
+            static void* operator new(const size_t size) {
+                return frame_pool::local().allocate(size);
+            }
+            static void operator delete(void *raw, const size_t size) noexcept {
+                frame_pool::local().deallocate(raw, size);
+            }
+        };
+
+        struct coroutine_promise_base : pooled_frame {
+            std::coroutine_handle<> continuation = std::noop_coroutine();
+            std::exception_ptr error;
+
+            // 结束时直接转到等待者, 没有等待者就停在这里, 由 task 析构时销毁
+            struct final_awaiter {
+                bool await_ready() const noexcept { return false; }
+                template<typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+                    return self.promise().continuation;
+                }
+                void await_resume() const noexcept {}
+            };
+
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            final_awaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() noexcept { error = std::current_exception(); }
+        };
+    }
+
+    template<typename T = void>
+    class task final {
+    public:
+        struct promise_type : detail::coroutine_promise_base {
+            std::variant<std::monostate, T> value;
+
+            task get_return_object() noexcept {
+                return task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            template<typename U>
+            void return_value(U&& one) {
+                value.template emplace<1>(std::forward<U>(one));
+            }
+            T take() {
+                if(error)
+                    std::rethrow_exception(error);
+                return std::move(std::get<1>(value));
+            }
+        };
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+
+    public:
+        explicit task(std::coroutine_handle<promise_type> _handle) noexcept : handle(_handle) {}
+        task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+        task& operator=(task&& other) noexcept {
+            if(this not_eq &other) {
+                if(handle)
+                    handle.destroy();
+                handle = std::exchange(other.handle, nullptr);
+            }
+            return *this;
+        }
+        ~task() {
+            if(handle)
+                handle.destroy();
+        }
+
+        bool await_ready() const { return checked().done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+            handle.promise().continuation = caller;
+            return handle;      // 对称转移, 开始执行这个惰性的协程
+        }
+        T await_resume() { return checked().promise().take(); }
+
+    private:
+        // 被移走的 task 没有协程, co_await 它时抛出 logic_error
+        std::coroutine_handle<promise_type> checked() const {
+            if(not handle)
+                throw std::logic_error("co_await on an empty task\n");
+            return handle;
+        }
+
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+    };
+
+    template<>
+    struct task<void>::promise_type : detail::coroutine_promise_base {
+        task get_return_object() noexcept {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        void return_void() const noexcept {}
+        void take() {
+            if(error)
+                std::rethrow_exception(error);
+        }
+    };
+
+    namespace detail {
+        // 正在 await_suspend 里交出去的恢复任务 : 交不出去时包装就地析构, 异常由 co_await 抛出, 包装不能再恢复一次
+        inline thread_local const void *suspending = nullptr;
+
+        struct suspend_scope final : boost::noncopyable {
+            const void *saved;
+            explicit suspend_scope(const void *awaiter) noexcept : saved(suspending) { suspending = awaiter; }
+            ~suspend_scope() { suspending = saved; }
+        };
+
+        // 恢复协程的任务 : 没执行就被线程池丢掉（shutdown、drop_oldest、定时器随线程池停止）时,
+        // 在丢掉它的线程上恢复, *dropped 置为 true
+        inline auto resume_task(std::coroutine_handle<> self, bool *dropped) {
+            return make_abandonable(
+                [self]{ self.resume(); },
+                [self, dropped]{
+                    if(suspending == dropped)
+                        return;
+                    *dropped = true;
+                    self.resume();
+                });
+        }
+    }
+
+    // co_await pool.schedule() : 在线程池的某个工作线程上继续; 恢复任务被丢掉时抛出 task_cancelled
+    struct schedule_awaitable {
+        thread_pool& pool;
+        bool dropped = false;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> self) {
+            detail::suspend_scope scope(&dropped);
+            pool.post(detail::resume_task(self, &dropped));
+        }
+        void await_resume() const {
+            if(dropped)
+                throw task_cancelled();
+        }
+    };
+
+    inline schedule_awaitable thread_pool::schedule() noexcept {
+        return schedule_awaitable{ *this };
+    }
+
+    // co_await sleep_for(pool, d) : 定时器到期后在工作线程上继续; 还没到期线程池就停止了, 抛出 task_cancelled
+    template<typename Rep, typename Period>
+    auto sleep_for(thread_pool& pool, const std::chrono::duration<Rep, Period>& delay) {
+        struct awaiter {
+            thread_pool& pool;
+            std::chrono::duration<Rep, Period> delay;
+            bool dropped = false;
+
+            bool await_ready() const noexcept { return delay.count() <= 0; }
+            void await_suspend(std::coroutine_handle<> self) {
+                detail::suspend_scope scope(&dropped);
+                pool.schedule_after(delay, detail::resume_task(self, &dropped));
+            }
+            void await_resume() const {
+                if(dropped)
+                    throw task_cancelled();
+            }
+        };
+        return awaiter{ pool, delay };
+    }
+
+    // co_await 一个 task_future : 结果就绪后由它的 executor（通常是线程池）恢复协程
+    template<typename R>
+    auto operator co_await(task_future<R>&& future) {
+        struct awaiter {
+            task_future<R> future;
+            bool dropped = false;    // 结果已经就绪, 恢复任务被丢掉时就地恢复就行
+
+            bool await_ready() const { return future.is_ready(); }
+            void await_suspend(std::coroutine_handle<> self) {
+                detail::suspend_scope scope(&dropped);
+                detail::future_access::state(future)->attach(unique_task(detail::resume_task(self, &dropped)), true);
+            }
+            R await_resume() { return future.get(); }
+        };
+        return awaiter{ std::move(future) };
+    }
+
+    namespace detail {
+        struct sync_latch {
+            std::mutex mtx;
+            std::condition_variable cv;
+            bool done = false;
+
+            // 在锁里通知, 等待方拿到锁才会返回并销毁这个 latch
+            void set() {
+                std::lock_guard<std::mutex> lck(mtx);
+                done = true;
+                cv.notify_all();
+            }
+            void wait() {
+                std::unique_lock<std::mutex> lck(mtx);
+                cv.wait(lck, [this]{ return done; });
+            }
+        };
+
+        // sync_wait 用的外层协程, 结束时通知 latch
+        struct sync_runner {
+            struct promise_type : pooled_frame {
+                sync_latch *latch = nullptr;
+
+                sync_runner get_return_object() noexcept {
+                    return sync_runner{ std::coroutine_handle<promise_type>::from_promise(*this) };
+                }
+                std::suspend_always initial_suspend() const noexcept { return {}; }
+                auto final_suspend() const noexcept {
+                    struct notify {
+                        bool await_ready() const noexcept { return false; }
+                        void await_suspend(std::coroutine_handle<promise_type> self) const noexcept {
+                            self.promise().latch->set();
+                        }
+                        void await_resume() const noexcept {}
+                    };
+                    return notify{};
+                }
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept { std::terminate(); }
+            };
+
+            std::coroutine_handle<promise_type> handle;
+
+            ~sync_runner() {
+                if(handle)
+                    handle.destroy();
+            }
+        };
+
+        template<typename T>
+        sync_runner run_to_latch(task<T>& body, std::variant<std::monostate, T, std::exception_ptr>& out) {
+            try {
+                out.template emplace<1>(co_await body);
+            }
+            catch(...) {
+                out.template emplace<2>(std::current_exception());
+            }
+        }
+
+        inline sync_runner run_to_latch(task<void>& body, std::exception_ptr& out) {
+            try {
+                co_await body;
+            }
+            catch(...) {
+                out = std::current_exception();
+            }
+        }
+    }
+
+    namespace detail {
+        // spawn 用的外层协程, 开始就执行, 结束时自己销毁
+        struct detached {
+            struct promise_type : pooled_frame {
+                detached get_return_object() const noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept { std::terminate(); }
+            };
+        };
+
+        inline detached run_detached(thread_pool& pool, task<void> body) {
+            std::exception_ptr error;
+            try {
+                co_await pool.schedule();
+                co_await body;
+            }
+            catch(...) {
+                error = std::current_exception();
+            }
+            if(error) {
+                try {
+                    pool.post([error]{ std::rethrow_exception(error); });
+                }
+                catch(...) {
+                    // 线程池已经停止, 异常没有地方交了
+                }
+            }
+        }
+    }
+
+    // 在线程池上启动 body, 不等待它结束
+    inline void spawn(thread_pool& pool, task<void> body) {
+        detail::run_detached(pool, std::move(body));
+    }
+
+    // 阻塞当前线程直到 body 执行完, 只在 main 之类的边界上使用, 不要在工作线程里调用
+    template<typename T>
+    T sync_wait(task<T> body) {
+        detail::sync_latch latch;
+        std::variant<std::monostate, T, std::exception_ptr> out;
+        auto runner = detail::run_to_latch(body, out);
+        runner.handle.promise().latch = &latch;
+        runner.handle.resume();
+        latch.wait();
+        if(out.index() == 2)
+            std::rethrow_exception(std::get<2>(out));
+        return std::move(std::get<1>(out));
+    }
+
+    inline void sync_wait(task<void> body) {
+        detail::sync_latch latch;
+        std::exception_ptr error;
+        auto runner = detail::run_to_latch(body, error);
+        runner.handle.promise().latch = &latch;
+        runner.handle.resume();
+        latch.wait();
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif // COROUTINE_H
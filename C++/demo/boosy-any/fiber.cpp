@@ -0,0 +1,371 @@
+#include "fiber.h"
+#include "cancel.h"
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <boost/context/fiber.hpp>
+
+namespace YHL {
+    namespace detail {
+
+        // 固定大小的栈, 用 mmap 分配, 可选最低端一页不可访问
+        class stack_pool final : boost::noncopyable {
+        private:
+            const size_t page;
+            const size_t size;
+            const bool guard;
+            const size_t keep;
+            std::mutex mtx;
+            std::vector<void*> idle;
+
+        public:
+            explicit stack_pool(const fiber_options& options)
+                : page(static_cast<size_t>(::sysconf(_SC_PAGESIZE))),
+                  size(std::max((options.stack_size + page - 1) / page, size_t(2)) * page),
+                  guard(options.guard_page),
+                  keep(options.keep_stacks) {}
+
+            ~stack_pool() {
+                for(auto base : idle)
+                    ::munmap(base, size);
+            }
+
+            boost::context::stack_context allocate() {
+                void *base = nullptr;
+                {
+                    std::lock_guard<std::mutex> lck(this->mtx);
+                    if(not this->idle.empty()) {
+                        base = this->idle.back();
+                        this->idle.pop_back();
+                    }
+                }
+                if(base == nullptr) {
+                    base = ::mmap(nullptr, this->size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+                    if(base == MAP_FAILED)
+                        throw std::bad_alloc();
+                    if(this->guard and ::mprotect(base, this->page, PROT_NONE) not_eq 0) {
+                        ::munmap(base, this->size);
+                        throw std::bad_alloc();
+                    }
+                }
+                boost::context::stack_context one;
+                one.size = this->size;
+                one.sp = static_cast<char*>(base) + this->size;    // 栈向低地址增长
+                return one;
+            }
+
+            void deallocate(boost::context::stack_context& one) noexcept {
+                void *base = static_cast<char*>(one.sp) - one.size;
+                {
+                    std::lock_guard<std::mutex> lck(this->mtx);
+                    if(this->idle.size() < this->keep) {
+                        this->idle.push_back(base);
+                        return;
+                    }
+                }
+                ::munmap(base, one.size);
+            }
+        };
+
+        // 交给 boost.context 的分配器, 它保存在栈顶, 纤程结束时用它释放栈
+        struct stack_allocator {
+            std::shared_ptr<stack_pool> pool;
+            boost::context::stack_context allocate() { return pool->allocate(); }
+            void deallocate(boost::context::stack_context& one) noexcept { pool->deallocate(one); }
+        };
+
+        struct fiber_context {
+            fiber_scheduler *owner;
+            boost::context::fiber fiber;     // 挂起时是纤程自己, 运行时为空
+            boost::context::fiber caller;    // 运行时是切进来的那个工作线程
+            unique_task body;
+            std::exception_ptr error;
+
+            // 切回工作线程之后才能做的事 : 在这之前别的线程不能恢复它
+            enum class next { none, yield, sleep };
+            next after = next::none;
+            std::chrono::steady_clock::time_point deadline;
+            std::mutex *release = nullptr;
+
+            void suspend() {
+                this->caller = std::move(this->caller).resume();
+            }
+
+            void wake() {
+                this->owner->resume_later(this, false);
+            }
+        };
+
+        // 工作线程正在执行的纤程, 只在 resume 里写
+        thread_local fiber_context *current = nullptr;
+
+        // 纤程挂起之后可能换了线程, 编译器却会把线程局部变量的地址留在寄存器里接着用,
+        // 所以纤程这一侧一律通过这个不内联的函数读, 每次重新取
+        __attribute__((noinline)) fiber_context* current_fiber() noexcept {
+            return current;
+        }
+
+        // resume_later 提交失败, 正在销毁恢复任务 : 包装的收尾又回到 resume_later, 这时不再重试, 留给析构函数
+        thread_local bool requeueing = false;
+    }
+}
+
+YHL::detail::waiter::waiter() : fiber(current_fiber()) {}
+
+void YHL::detail::wait(waiter& one, std::unique_lock<std::mutex>& guard) {
+    if(one.fiber == nullptr) {
+        one.cv.wait(guard, [&one]{ return one.woken; });
+        return;
+    }
+    // 只把 mutex 交给工作线程 : 它解锁之后纤程随时可能在别的线程上恢复, 不能再碰纤程栈上的 unique_lock
+    fiber_context *self = one.fiber;
+    std::mutex *mtx = guard.release();
+    self->release = mtx;
+    self->suspend();
+    guard = std::unique_lock<std::mutex>(*mtx);
+}
+
+void YHL::detail::wakeups::add(fiber_context *one) {
+    if(this->first == nullptr)
+        this->first = one;
+    else
+        this->rest.emplace_back(one);
+}
+
+YHL::detail::wakeups::~wakeups() {
+    if(this->first not_eq nullptr)
+        this->first->wake();
+    for(auto one : this->rest)
+        one->wake();
+}
+
+// 线程在 cv 上等, 要在 guard 里通知 : 它醒来看到 woken 就会返回, waiter 随之销毁
+bool YHL::detail::wake_one(std::deque<waiter*>& waiters, wakeups& woken) {
+    if(waiters.empty())
+        return false;
+    waiter *one = waiters.front();
+    waiters.pop_front();
+    one->woken = true;
+    if(one->fiber not_eq nullptr)
+        woken.add(one->fiber);
+    else
+        one->cv.notify_one();
+    return true;
+}
+
+void YHL::detail::wake_all(std::deque<waiter*>& waiters, wakeups& woken) {
+    while(wake_one(waiters, woken)) {}
+}
+
+bool YHL::detail::in_fiber() noexcept {
+    return current_fiber() not_eq nullptr;
+}
+
+void YHL::detail::yield() {
+    fiber_context *self = current_fiber();
+    if(self == nullptr) {
+        std::this_thread::yield();
+        return;
+    }
+    self->after = fiber_context::next::yield;
+    self->suspend();
+}
+
+// 定时器不会提前触发, 没到时间就回来了说明定时器随线程池停止了
+void YHL::detail::sleep_until(std::chrono::steady_clock::time_point deadline) {
+    fiber_context *self = current_fiber();
+    self->after = fiber_context::next::sleep;
+    self->deadline = deadline;
+    self->suspend();
+    if(std::chrono::steady_clock::now() < deadline)
+        throw task_cancelled();
+}
+
+YHL::fiber_scheduler::fiber_scheduler(thread_pool& _pool, const fiber_options& options)
+    : pool(_pool), stacks(std::make_shared<detail::stack_pool>(options)), count(0) {}
+
+// 和 strand 一样边等边执行别的任务, 挂起的纤程要靠线程池恢复; 线程池不再接收的纤程在这里接着执行
+YHL::fiber_scheduler::~fiber_scheduler() {
+    while(this->count.load() > 0) {
+        if(this->pool.try_run_one())
+            continue;
+        detail::fiber_context *one = nullptr;
+        {
+            std::unique_lock<std::mutex> lck(this->mtx);
+            if(this->orphans.empty()) {
+                this->cv.wait_for(lck, std::chrono::microseconds(200), [this]{
+                    return this->count.load() == 0 or not this->orphans.empty();
+                });
+                continue;
+            }
+            one = this->orphans.front();
+            this->orphans.pop_front();
+        }
+        unique_task task([this, one]{ this->resume(one); });
+        this->pool.run_task(task);
+    }
+    std::lock_guard<std::mutex> lck(this->mtx);
+}
+
+void YHL::fiber_scheduler::launch(unique_task&& body) {
+    auto *one = new detail::fiber_context;
+    one->owner = this;
+    one->body = std::move(body);
+    try {
+        one->fiber = boost::context::fiber(std::allocator_arg, detail::stack_allocator{ this->stacks },
+            [one](boost::context::fiber&& caller) {
+                one->caller = std::move(caller);
+                try {
+                    one->body();
+                }
+                catch(const boost::context::detail::forced_unwind&) {
+                    throw;
+                }
+                catch(...) {
+                    one->error = std::current_exception();
+                }
+                one->body = unique_task();    // 捕获的对象在纤程栈上析构
+                return std::move(one->caller);
+            });
+    }
+    catch(...) {
+        delete one;
+        throw;
+    }
+    ++this->count;
+    if(this->pool.closed()) {
+        delete one;             // 还没开始执行的纤程可以直接销毁
+        this->finish_one();
+        throw std::runtime_error("enqueue task on stopped pool\n");
+    }
+    this->resume_later(one, false);
+}
+
+// 在工作线程上切进纤程, 纤程挂起或者结束时回到这里
+void YHL::fiber_scheduler::resume(detail::fiber_context *one) {
+    detail::fiber_context *saved = detail::current;
+    detail::current = one;
+    one->fiber = std::move(one->fiber).resume();
+    detail::current = saved;
+
+    if(not one->fiber) {
+        std::exception_ptr error = std::move(one->error);
+        delete one;
+        this->finish_one();
+        if(error)
+            std::rethrow_exception(error);    // 交给线程池的 exception_handler
+        return;
+    }
+
+    const auto after = one->after;
+    std::mutex *release = one->release;
+    one->after = detail::fiber_context::next::none;
+    one->release = nullptr;
+    if(after == detail::fiber_context::next::yield)
+        this->resume_later(one, true);
+    else if(after == detail::fiber_context::next::sleep) {
+        // 定时器到期时已经在工作线程上; 没到期就随线程池停止了, 交给 resume_later, sleep_for 抛出 task_cancelled
+        try {
+            this->pool.schedule_after(std::max(one->deadline - std::chrono::steady_clock::now(),
+                                               std::chrono::steady_clock::duration::zero()),
+                                      detail::make_abandonable(
+                                          [this, one]{ this->resume(one); },
+                                          [this, one]{ this->resume_later(one, false); }));
+        }
+        catch(...) {
+            // 线程池已经停止, 包装析构时已经交给 resume_later 了
+        }
+    }
+    else if(release not_eq nullptr)
+        release->unlock();      // 放开之后它随时可能在别的线程上恢复, 不能再碰 one
+}
+
+// 不抛出异常 : 线程池已经停止（包括恢复任务被 shutdown 丢掉）或者提交失败, 留给析构函数执行; 被 drop_oldest 丢掉的重新排队
+void YHL::fiber_scheduler::resume_later(detail::fiber_context *one, const bool yielded) {
+    if(this->pool.closed() or detail::requeueing) {
+        this->adopt(one);
+        return;
+    }
+    unique_task task(detail::make_abandonable(
+        [this, one]{ this->resume(one); },
+        [this, one]{ this->resume_later(one, false); }));
+    try {
+        if(yielded)
+            this->pool.push_task(task_priority::low, std::move(task));
+        else
+            this->pool.push_task(std::move(task));
+    }
+    catch(...) {
+        // 提交失败时任务原样留着, 在这里销毁, 收尾时不再重试
+        detail::requeueing = true;
+        task = unique_task();
+        detail::requeueing = false;
+    }
+}
+
+void YHL::fiber_scheduler::adopt(detail::fiber_context *one) {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    this->orphans.emplace_back(one);
+    this->cv.notify_all();
+}
+
+void YHL::fiber_scheduler::finish_one() {
+    if(this->count.load() > 1) {
+        --this->count;
+        return;
+    }
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(--this->count == 0)
+        this->cv.notify_all();
+}
+
+void YHL::fiber_mutex::lock() {
+    std::unique_lock<std::mutex> lck(this->guard);
+    if(not this->locked) {
+        this->locked = true;
+        return;
+    }
+    detail::waiter one;
+    this->waiters.push_back(&one);
+    detail::wait(one, lck);     // 被唤醒时锁已经交到手里
+}
+
+bool YHL::fiber_mutex::try_lock() {
+    std::lock_guard<std::mutex> lck(this->guard);
+    if(this->locked)
+        return false;
+    this->locked = true;
+    return true;
+}
+
+void YHL::fiber_mutex::unlock() {
+    detail::wakeups woken;      // 在 guard 放开之后才交给线程池
+    std::lock_guard<std::mutex> lck(this->guard);
+    if(not detail::wake_one(this->waiters, woken))
+        this->locked = false;
+}
+
+void YHL::fiber_condition_variable::wait(std::unique_lock<fiber_mutex>& lck) {
+    std::unique_lock<std::mutex> guard_lck(this->guard);
+    detail::waiter one;
+    this->waiters.push_back(&one);
+    lck.unlock();               // 已经排进等待队列, 之后的 notify 不会丢
+    detail::wait(one, guard_lck);
+    guard_lck.unlock();
+    lck.lock();
+}
+
+void YHL::fiber_condition_variable::notify_one() {
+    detail::wakeups woken;
+    std::lock_guard<std::mutex> lck(this->guard);
+    detail::wake_one(this->waiters, woken);
+}
+
+void YHL::fiber_condition_variable::notify_all() {
+    detail::wakeups woken;
+    std::lock_guard<std::mutex> lck(this->guard);
+    detail::wake_all(this->waiters, woken);
+}
@@ -0,0 +1,271 @@
+#ifndef FIBER_H
+#define FIBER_H
+#include <mutex>
+#include <deque>
+#include <tuple>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+#include "threadpool.h"
+
+/* 使用说明（需要链接 boost_context）
+    YHL::thread_pool pool(4);
+    YHL::fiber_scheduler fibers(pool);         // 纤程在 pool 的线程上轮流执行
+
+    // 老的阻塞式写法原样搬进纤程, 阻塞的只是纤程, 线程去执行别的纤程
+    YHL::channel<request> inbox(1024);
+    YHL::fiber_mutex mtx;
+    for(int i = 0;i < 100000; ++i)
+        fibers.spawn([&]{
+            request one;
+            while(inbox.pop(one)) {                                        // 没有请求就挂起
+                YHL::this_fiber::sleep_for(std::chrono::milliseconds(10));  // 模拟阻塞的 IO, 不占线程
+                std::lock_guard<YHL::fiber_mutex> lck(mtx);                // 锁被占用就挂起
+                reply(one);
+            }
+        });
+    inbox.push(request{});     // 纤程外面也可以用, 阻塞的是线程
+    inbox.close();
+
+    auto answer = fibers.submit([]{ YHL::this_fiber::yield(); return 42; });
+ */
+
+/*
+ * 注意事项
+ * 1. 每个纤程有自己的栈, 挂起时保存寄存器切回工作线程, 恢复时由线程池的某个线程切进去, 所以 M 个纤程跑在 N 个线程上,
+ *    同一个纤程前后可能换线程 : 纤程里不要用 thread_local, 也不要拿着 std::mutex 挂起
+ * 2. 栈从栈池里取, 默认 64KB, 最低端一页设为不可访问, 栈溢出直接段错误而不是改写别的内存; 用完还给栈池, 最多缓存 1024 个
+ * 3. 每个带保护页的栈占两个内存映射, 受 vm.max_map_count（默认 65530）限制; 要同时存在十万个纤程, 关掉 guard_page
+ *    或者调大 vm.max_map_count
+ * 4. fiber_mutex / fiber_condition_variable / channel 在纤程里挂起纤程, 在纤程外面阻塞线程, 两边可以混用
+ * 5. 唤醒的纤程放进唤醒方所在线程的 LIFO 槽, 接着就执行; yield 的纤程放进低优先级队列, 先让别的任务执行
+ * 6. sleep_for 用线程池的定时器, 精度是定时器的一格; 在纤程外面调用就是 std::this_thread::sleep_for
+ *    还没到时间线程池就停止了, sleep_for 提前返回并抛出 task_cancelled
+ * 7. spawn 的纤程抛出的异常交给线程池的 exception_handler; submit 的异常在 future 里
+ * 8. 析构时边等边执行线程池里的任务, 直到所有纤程结束; 线程池对象要比它活得久
+ *    线程池 shutdown 之后（包括恢复任务被丢掉）, 还没结束的纤程在析构函数里接着执行完, 这时 spawn 抛出异常
+ * 9. lock_free_queue 模式下环形队列满了, 提交方会顺手执行队列里的任务, 唤醒纤程时也是这样, 可能在纤程栈上嵌套执行别的纤程;
+ *    唤醒总是在放开等待队列的锁之后才做, 嵌套执行的任务再用同一个 fiber_mutex / channel 不会死锁;
+ *    纤程很多时把 queue_capacity 调大, 或者用另外两种模式
+ */
+
+namespace YHL {
+
+    class fiber_scheduler;
+
+    struct fiber_options {
+        size_t stack_size = 64 * 1024;   // 包括保护页
+        bool guard_page = true;
+        size_t keep_stacks = 1024;       // 栈池最多缓存多少个栈
+    };
+
+    namespace detail {
+
+        struct fiber_context;             // 定义在 fiber.cpp
+        class stack_pool;
+
+        // 等待队列里的一项 : 在纤程里就挂起纤程, 否则在 cv 上阻塞线程
+        struct waiter {
+            fiber_context *fiber;
+            std::condition_variable cv;
+            bool woken = false;
+            waiter();
+        };
+
+        // 调用时 guard 已经加锁, 返回时也是; 挂起期间 guard 是放开的
+        void wait(waiter&, std::unique_lock<std::mutex>& guard);
+
+        // 唤醒的纤程先记在这里, 析构时才交给线程池; 要声明在 guard 的锁之前, 这样析构时 guard 已经放开了 :
+        // 交给线程池时可能就地执行别的任务（lock_free_queue 满了）, 它们可能要用同一个 guard
+        class wakeups final : boost::noncopyable {
+        private:
+            fiber_context *first = nullptr;
+            std::vector<fiber_context*> rest;
+        public:
+            wakeups() = default;
+            ~wakeups();
+            void add(fiber_context*);
+        };
+
+        // 调用方持有等待队列的 guard
+        bool wake_one(std::deque<waiter*>&, wakeups&);
+        void wake_all(std::deque<waiter*>&, wakeups&);
+
+        bool in_fiber() noexcept;
+        void yield();
+        void sleep_until(std::chrono::steady_clock::time_point);
+    }
+
+    class fiber_scheduler final : boost::noncopyable {
+    private:
+        thread_pool& pool;
+        std::shared_ptr<detail::stack_pool> stacks;   // 纤程的栈释放时还要用, 由纤程共同持有
+        std::atomic<size_t> count;                     // 还没结束的纤程数
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<detail::fiber_context*> orphans;   // 线程池已经停止, 等析构时执行的纤程, 由 mtx 保护
+
+        friend struct detail::fiber_context;
+
+        void launch(unique_task&&);
+        void resume(detail::fiber_context*);
+        void resume_later(detail::fiber_context*, const bool yielded);
+        void adopt(detail::fiber_context*);
+        void finish_one();
+
+    public:
+        explicit fiber_scheduler(thread_pool&, const fiber_options& = fiber_options());
+        ~fiber_scheduler();
+
+        template<typename F>
+        void spawn(F&& fun);
+
+        template<typename F, class... Args>
+        auto submit(F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type>;
+
+        // 还没结束的纤程数
+        size_t alive() const noexcept { return count.load(); }
+    };
+
+    namespace this_fiber {
+
+        // 让出线程, 排到低优先级队列的末尾
+        inline void yield() { detail::yield(); }
+
+        // 只挂起纤程, 时间到了再回到某个工作线程上
+        template<class Rep, class Period>
+        void sleep_for(const std::chrono::duration<Rep, Period>& delay) {
+            if(not detail::in_fiber()) {
+                std::this_thread::sleep_for(delay);
+                return;
+            }
+            detail::sleep_until(std::chrono::steady_clock::now()
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay));
+        }
+
+        // 当前是不是在纤程里
+        inline bool in_fiber() noexcept { return detail::in_fiber(); }
+    }
+
+    // 拿不到锁就挂起纤程; 解锁时直接把锁交给排在最前面的等待者, 不会被后来的插队
+    class fiber_mutex final : boost::noncopyable {
+    private:
+        std::mutex guard;
+        bool locked = false;
+        std::deque<detail::waiter*> waiters;
+
+    public:
+        void lock();
+        bool try_lock();
+        void unlock();
+    };
+
+    class fiber_condition_variable final : boost::noncopyable {
+    private:
+        std::mutex guard;
+        std::deque<detail::waiter*> waiters;
+
+    public:
+        void wait(std::unique_lock<fiber_mutex>&);
+
+        template<typename Predicate>
+        void wait(std::unique_lock<fiber_mutex>& lck, Predicate pred) {
+            while(not pred())
+                this->wait(lck);
+        }
+
+        void notify_one();
+        void notify_all();
+    };
+
+    // 有界的多生产者多消费者通道; 满了 push 挂起, 空了 pop 挂起
+    template<typename T>
+    class channel final : boost::noncopyable {
+    private:
+        std::mutex guard;
+        std::deque<T> items;
+        const size_t capacity;
+        bool closed = false;
+        std::deque<detail::waiter*> senders, receivers;
+
+    public:
+        explicit channel(const size_t _capacity = 64) : capacity(_capacity > 0 ? _capacity : 1) {}
+
+        // 关闭之后返回 false, 元素没有放进去
+        bool push(T value) {
+            detail::wakeups woken;
+            std::unique_lock<std::mutex> lck(this->guard);
+            while(not this->closed and this->items.size() >= this->capacity) {
+                detail::waiter one;
+                this->senders.push_back(&one);
+                detail::wait(one, lck);
+            }
+            if(this->closed)
+                return false;
+            this->items.emplace_back(std::move(value));
+            detail::wake_one(this->receivers, woken);
+            return true;
+        }
+
+        // 关闭并且取完之后返回 false
+        bool pop(T& value) {
+            detail::wakeups woken;
+            std::unique_lock<std::mutex> lck(this->guard);
+            while(this->items.empty() and not this->closed) {
+                detail::waiter one;
+                this->receivers.push_back(&one);
+                detail::wait(one, lck);
+            }
+            if(this->items.empty())
+                return false;
+            value = std::move(this->items.front());
+            this->items.pop_front();
+            detail::wake_one(this->senders, woken);
+            return true;
+        }
+
+        // 唤醒所有等待的 push 和 pop; 已经放进去的元素还可以取出来
+        void close() {
+            detail::wakeups woken;
+            std::lock_guard<std::mutex> lck(this->guard);
+            this->closed = true;
+            detail::wake_all(this->senders, woken);
+            detail::wake_all(this->receivers, woken);
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> lck(this->guard);
+            return this->items.size();
+        }
+    };
+
+    template<typename F>
+    void fiber_scheduler::spawn(F&& fun) {
+        this->launch(unique_task(std::forward<F>(fun)));
+    }
+
+    template<typename F, class... Args>
+    auto fiber_scheduler::submit(F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type> {
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        auto pair = make_task_pair<return_type>(this->pool.blocks, this->pool.executor());
+
+        this->launch(unique_task(
+            [promise = std::move(pair.first),
+             fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                promise.run(std::move(fun), std::move(args));
+            }));
+
+        return std::move(pair.second);
+    }
+
+}
+
+#endif // FIBER_H
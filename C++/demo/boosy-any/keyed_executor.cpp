@@ -0,0 +1,166 @@
+#include "keyed_executor.h"
+#include <algorithm>
+
+namespace {
+    constexpr size_t sample_every  = 16;     // 每多少次提交采样一次 key
+    constexpr size_t balance_every = 1024;   // 每多少次提交检查一次是否均衡
+    constexpr size_t min_depth     = 64;     // 最长的队列不到这个长度不挪
+}
+
+YHL::keyed_executor::keyed_executor(thread_pool& _pool, const double _skew)
+    : pool(_pool),
+      shards(std::max<size_t>(1, _pool.size())),
+      skew(_skew),
+      partitions(new partition[shards]),
+      submitted(0),
+      moving(0),
+      moved(0) {}
+
+YHL::keyed_executor::~keyed_executor() {
+    std::unique_lock<std::mutex> lck(this->mtx);
+    this->cv.wait(lck, [this]{ return this->moving.load() == 0; });
+}
+
+// std::hash 对整数往往就是原值, 连续的 key 取模后会扎堆, 先打散
+size_t YHL::keyed_executor::mix(size_t hash) noexcept {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+size_t YHL::keyed_executor::current_shard(const size_t hash) {
+    partition& part = this->partitions[this->home(hash)];
+    std::lock_guard<std::mutex> lck(part.mtx);
+    auto it = part.routes.find(hash);
+    return it == part.routes.end() ? this->home(hash) : it->second.shard;
+}
+
+// 入队也在锁里, 否则搬家的标记可能排到这个任务前面
+void YHL::keyed_executor::dispatch(const size_t hash, unique_task&& task) {
+    {
+        partition& part = this->partitions[this->home(hash)];
+        std::lock_guard<std::mutex> lck(part.mtx);
+        auto it = part.routes.find(hash);
+        if(it == part.routes.end())
+            this->pool.post_to(this->home(hash), std::move(task));
+        else if(it->second.moving)
+            it->second.held.emplace_back(std::move(task));
+        else
+            this->pool.post_to(it->second.shard, std::move(task));
+    }
+
+    const size_t n = ++this->submitted;
+    if(n % sample_every == 0)
+        this->sample(hash);
+    if(n % balance_every == 0)
+        this->rebalance();
+}
+
+void YHL::keyed_executor::sample(const size_t hash) {
+    std::lock_guard<std::mutex> lck(this->sample_mtx);
+    ++this->samples[hash];
+}
+
+std::vector<size_t> YHL::keyed_executor::depths() const {
+    std::vector<size_t> result(this->shards);
+    for(size_t i = 0; i < this->shards; ++i)
+        result[i] = this->pool.pinned_depth(i);
+    return result;
+}
+
+bool YHL::keyed_executor::rebalance() {
+    std::unique_lock<std::mutex> balance_lck(this->balance_mtx, std::try_to_lock);
+    if(not balance_lck.owns_lock() or this->shards < 2)
+        return false;
+
+    const std::vector<size_t> depth = this->depths();
+    const auto busiest = std::max_element(depth.begin(), depth.end()) - depth.begin();
+    const auto idlest  = std::min_element(depth.begin(), depth.end()) - depth.begin();
+    size_t total = 0;
+    for(const auto it : depth)
+        total += it;
+    const double average = static_cast<double>(total) / this->shards;
+    if(depth[busiest] < min_depth or depth[busiest] < this->skew * average)
+        return false;
+
+    // 在最忙的分片上找最热和第二热的 key, 顺便让采样衰减, 反映的是最近的热度
+    size_t hottest = 0, hottest_count = 0, second = 0, second_count = 0, busiest_count = 0;
+    {
+        std::lock_guard<std::mutex> lck(this->sample_mtx);
+        for(auto it = this->samples.begin(); it not_eq this->samples.end(); ) {
+            const size_t count = it->second;
+            if(this->current_shard(it->first) == static_cast<size_t>(busiest)) {
+                busiest_count += count;
+                if(count > hottest_count) {
+                    second = hottest, second_count = hottest_count;
+                    hottest = it->first, hottest_count = count;
+                }
+                else if(count > second_count)
+                    second = it->first, second_count = count;
+            }
+            it->second /= 2;
+            if(it->second == 0)
+                it = this->samples.erase(it);
+            else
+                ++it;
+        }
+    }
+    // 一个 key 占了一半以上, 挪它只是换个分片堵, 挪走第二热的让其余的 key 透口气
+    size_t victim = hottest, victim_count = hottest_count;
+    if(hottest_count * 2 > busiest_count)
+        victim = second, victim_count = second_count;
+    if(victim_count == 0)
+        return false;
+
+    size_t from = 0;
+    {
+        partition& part = this->partitions[this->home(victim)];
+        std::lock_guard<std::mutex> lck(part.mtx);
+        auto it = part.routes.find(victim);
+        from = it == part.routes.end() ? this->home(victim) : it->second.shard;
+        if(from not_eq static_cast<size_t>(busiest) or (it not_eq part.routes.end() and it->second.moving))
+            return false;
+        ++this->moving;
+        route& target = part.routes[victim];
+        target.shard = idlest;
+        target.moving = true;
+    }
+    // 登记之后新提交的任务都暂存了, 标记放在锁外也一定排在旧任务后面
+    // 放不进去（线程池已经停止）时 marker 析构会结束这次搬家
+    try {
+        this->pool.post_to(from, marker(this, victim));
+    }
+    catch(...) {
+        return false;
+    }
+    ++this->moved;
+    return true;
+}
+
+// 旧分片上这个 key 的任务都执行完了, 把搬家期间暂存的任务按顺序交给新分片
+void YHL::keyed_executor::settle(const size_t hash) {
+    {
+        partition& part = this->partitions[this->home(hash)];
+        std::lock_guard<std::mutex> lck(part.mtx);
+        auto it = part.routes.find(hash);
+        if(it not_eq part.routes.end()) {
+            std::vector<unique_task> held = std::move(it->second.held);
+            const size_t shard = it->second.shard;
+            it->second.moving = false;
+            if(shard == this->home(hash))
+                part.routes.erase(it);
+            for(auto& task : held) {
+                try {
+                    this->pool.post_to(shard, std::move(task));
+                }
+                catch(...) {}             // 线程池已经停止, 剩下的任务随 held 一起丢掉
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(--this->moving == 0)
+        this->cv.notify_all();
+}
@@ -0,0 +1,144 @@
+#ifndef KEYED_EXECUTOR_H
+#define KEYED_EXECUTOR_H
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <tuple>
+#include <unordered_map>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+#include "threadpool.h"
+
+/* 使用说明
+    YHL::thread_pool pool(8);
+    YHL::keyed_executor accounts(pool);      // 8 个分片, 第 i 个分片固定在第 i 个线程上
+
+    // 同一个账户的任务总在同一个线程上按顺序执行, 账户的状态不用加锁
+    std::unordered_map<long, double> balance;   // 只在 key 所在的线程上访问
+    accounts.post(account_id, [&, account_id, amount]{ balance[account_id] += amount; });
+    auto total = accounts.submit(account_id, [&, account_id]{ return balance[account_id]; });
+
+    accounts.rebalance();     // 一般不用手动调用, 提交时会定期检查
+ */
+
+/*
+ * 注意事项
+ * 1. key 先 std::hash 再打散, 对分片数取模, 分片 i 的任务用 thread_pool::post_to(i) 放进第 i 个线程的 pinned 队列,
+ *    不会被别的线程偷走, 所以同一个 key 的任务串行执行, 缓存也一直是热的
+ * 2. 不同的 key 可能落在同一个分片上, 它们之间也是串行的; 某个 key 特别热时, 所在分片的队列会比别的长很多
+ * 3. 每 16 次提交采样一次 key, 每 1024 次提交检查一次各分片的队列长度; 最长的超过平均的 skew 倍（并且至少 64）,
+ *    就把这个分片上采样最多的 key 挪到最短的分片; 如果它一个就占了这个分片一半以上的采样, 挪它只是换个地方堵,
+ *    改为挪走第二热的 key
+ * 4. 挪动时不能乱序 : 先把 key 标记为搬家中, 再往旧分片放一个标记任务, 搬家期间提交的任务暂存起来;
+ *    标记任务执行时, 旧分片上这个 key 之前的任务都已经执行完, 这时才把暂存的任务按顺序交给新分片
+ * 5. 路由表按 key 原来的分片拆成多份, 各自一把锁, 提交时只锁 key 所在的那一份, 锁里只做查表和入队
+ * 6. 析构时会等还没完成的搬家, 不会等已经提交的任务; 线程池要比它活得久
+ */
+
+namespace YHL {
+
+    class keyed_executor final : boost::noncopyable {
+    private:
+        // 被挪走的 key 现在的去处
+        struct route {
+            size_t shard;
+            bool moving;                          // 旧分片上的任务还没执行完
+            std::vector< unique_task > held;      // 搬家期间提交的任务, 按提交顺序
+        };
+
+        // key 原来在第 i 个分片的, 它的路由记录在 partitions[i]
+        struct partition {
+            std::mutex mtx;
+            std::unordered_map<size_t, route> routes;
+        };
+
+        // 搬家的标记任务 : 被线程池丢掉（比如 shutdown）时也要结束搬家, 否则析构会一直等
+        struct marker {
+            keyed_executor *self;
+            size_t hash;
+            marker(keyed_executor *_self, const size_t _hash) noexcept : self(_self), hash(_hash) {}
+            marker(marker&& other) noexcept : self(other.self), hash(other.hash) { other.self = nullptr; }
+            ~marker() { if(self) self->settle(hash); }
+            void operator()() {
+                keyed_executor *one = self;
+                self = nullptr;
+                one->settle(hash);
+            }
+        };
+
+        thread_pool& pool;
+        const size_t shards;
+        const double skew;
+        std::unique_ptr<partition[]> partitions;
+        std::atomic<size_t> submitted;
+
+        // 热点采样 : key 的哈希 -> 采样次数
+        std::mutex sample_mtx;
+        std::unordered_map<size_t, size_t> samples;
+
+        std::mutex balance_mtx;                   // 同一时刻只有一个线程在 rebalance
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::atomic<size_t> moving;               // 还没完成的搬家
+        std::atomic<size_t> moved;                // 一共挪过多少次 key
+
+        static size_t mix(size_t hash) noexcept;
+        size_t home(const size_t hash) const noexcept { return hash % shards; }
+        size_t current_shard(const size_t hash);
+        void dispatch(const size_t hash, unique_task&&);
+        void settle(const size_t hash);
+        void sample(const size_t hash);
+
+    public:
+        // skew : 最长的分片队列超过平均长度的多少倍时开始挪 key
+        explicit keyed_executor(thread_pool&, const double skew = 2.0);
+        ~keyed_executor();
+
+        template<typename Key, typename F>
+        void post(const Key& key, F&& fun);
+
+        template<typename Key, typename F, class... Args>
+        auto submit(const Key& key, F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type>;
+
+        size_t shard_count() const noexcept { return shards; }
+
+        // key 现在归哪个分片（也就是哪个线程）
+        template<typename Key>
+        size_t shard_of(const Key& key) { return current_shard(mix(std::hash<Key>()(key))); }
+
+        size_t moved_keys() const noexcept { return moved.load(); }
+
+        // 各分片排队的任务数
+        std::vector<size_t> depths() const;
+
+        // 队列长度不均衡时挪走一个热点 key, 挪了返回 true
+        bool rebalance();
+    };
+
+    template<typename Key, typename F>
+    void keyed_executor::post(const Key& key, F&& fun) {
+        this->dispatch(mix(std::hash<Key>()(key)), unique_task(std::forward<F>(fun)));
+    }
+
+    template<typename Key, typename F, class... Args>
+    auto keyed_executor::submit(const Key& key, F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type> {
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        auto pair = make_task_pair<return_type>(this->pool.blocks, this->pool.executor());
+
+        this->dispatch(mix(std::hash<Key>()(key)), unique_task(
+            [promise = std::move(pair.first),
+             fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                promise.run(std::move(fun), std::move(args));
+            }));
+
+        return std::move(pair.second);
+    }
+
+}
+
+#endif // KEYED_EXECUTOR_H
@@ -0,0 +1,114 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <boost/noncopyable.hpp>
+
+/* 使用说明
+    YHL::mpmc_queue<int> queue(1024);
+    queue.try_push(7);       // 满了返回 false
+    int value;
+    queue.try_pop(value);    // 空了返回 false
+ */
+
+/*
+ * 注意事项
+ * 1. 有界环形缓冲, 多生产者多消费者, 不加锁
+ * 2. 每个槽位带一个序号 sequence :
+ *         （1）sequence == pos       槽位空闲, 生产者可以写
+ *         （2）sequence == pos + 1   槽位有数据, 消费者可以读
+ *         （3）读完之后 sequence = pos + capacity, 留给下一圈的生产者
+ * 3. 生产者和消费者各自 CAS 抢位置, 抢到之后独占这个槽位
+ * 4. 容量向上取整到 2 的幂, 用 & mask 代替取模
+ */
+
+namespace YHL {
+
+    template<typename T>
+    class mpmc_queue final : boost::noncopyable {
+    private:
+        struct cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        // 读写位置各占一个缓存行, 避免生产者和消费者互相干扰
+        static constexpr size_t cache_line = 64;
+
+        std::unique_ptr<cell[]> buffer;
+        const size_t mask;
+        char pad0[cache_line];
+        std::atomic<size_t> enqueue_pos;
+        char pad1[cache_line - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> dequeue_pos;
+        char pad2[cache_line - sizeof(std::atomic<size_t>)];
+
+        static size_t round_up(const size_t capacity) {
+            size_t res = 2;
+            while(res < capacity)
+                res <<= 1;
+            return res;
+        }
+
+    public:
+        explicit mpmc_queue(const size_t capacity)
+            : buffer(new cell[round_up(capacity)]),
+              mask(round_up(capacity) - 1),
+              enqueue_pos(0), dequeue_pos(0) {
+            for(size_t i = 0;i <= mask; ++i)
+                buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        size_t capacity() const noexcept {
+            return mask + 1;
+        }
+
+        template<typename U>
+        bool try_push(U&& value) {
+            cell *target = nullptr;
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            for(;;) {
+                target = &buffer[pos & mask];
+                const size_t seq = target->sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                if(diff == 0) {
+                    if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if(diff < 0)
+                    return false;     // 满了
+                else
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+            target->data = std::forward<U>(value);
+            target->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(T& value) {
+            cell *target = nullptr;
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            for(;;) {
+                target = &buffer[pos & mask];
+                const size_t seq = target->sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+                if(diff == 0) {
+                    if(dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if(diff < 0)
+                    return false;     // 空了
+                else
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+            value = std::move(target->data);
+            target->data = T();       // 及时释放任务持有的资源
+            target->sequence.store(pos + mask + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+}
+
+#endif // MPMC_QUEUE_H
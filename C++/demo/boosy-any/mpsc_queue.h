@@ -0,0 +1,74 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+#include <atomic>
+#include <utility>
+#include <boost/noncopyable.hpp>
+
+/* 使用说明
+    YHL::mpsc_queue<int> queue;
+    queue.push(7);           // 任意多个线程同时 push, 不会失败
+    int value;
+    queue.try_pop(value);    // 只能有一个线程 pop, 空了返回 false
+ */
+
+/*
+ * 注意事项
+ * 1. 无界单向链表, 多生产者单消费者, 不加锁; 每个元素一个节点
+ * 2. 生产者用一次 exchange 把新节点换成 head, 再把旧 head 的 next 指向它, 没有 CAS 重试, 是 wait-free 的
+ * 3. 消费者持有 tail（一个已经读过的哨兵节点）, 读 tail->next, 读完之后 next 成为新的哨兵
+ * 4. 生产者换了 head 还没连上 next 的瞬间, 后面的元素暂时看不到, try_pop 会返回 false;
+ *    调用方如果另有计数知道队列不空, 让出 CPU 再试一次即可
+ */
+
+namespace YHL {
+
+    template<typename T>
+    class mpsc_queue final : boost::noncopyable {
+    private:
+        struct node {
+            std::atomic<node*> next;
+            T data;
+            node() : next(nullptr) {}
+        };
+
+        static constexpr size_t cache_line = 64;
+
+        std::atomic<node*> head;       // 生产者 : 最新放进去的节点
+        char pad0[cache_line - sizeof(std::atomic<node*>)];
+        node *tail;                    // 消费者 : 哨兵, 它的 next 才是最老的元素
+        char pad1[cache_line - sizeof(node*)];
+
+    public:
+        mpsc_queue() : head(new node), tail(head.load(std::memory_order_relaxed)) {}
+
+        ~mpsc_queue() {
+            while(tail not_eq nullptr) {
+                node *next = tail->next.load(std::memory_order_relaxed);
+                delete tail;
+                tail = next;
+            }
+        }
+
+        template<typename U>
+        void push(U&& value) {
+            node *one = new node;
+            one->data = std::forward<U>(value);
+            node *prev = head.exchange(one, std::memory_order_acq_rel);
+            prev->next.store(one, std::memory_order_release);
+        }
+
+        bool try_pop(T& value) {
+            node *next = tail->next.load(std::memory_order_acquire);
+            if(next == nullptr)
+                return false;
+            value = std::move(next->data);
+            next->data = T();         // 及时释放元素持有的资源, 这个节点接下来当哨兵
+            delete tail;
+            tail = next;
+            return true;
+        }
+    };
+
+}
+
+#endif // MPSC_QUEUE_H
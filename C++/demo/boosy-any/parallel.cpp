@@ -0,0 +1,95 @@
+#include "parallel.h"
+#include <algorithm>
+
+namespace {
+    // 一次 parallel_for 的共享状态, 调用线程和帮忙的任务各持有一份
+    struct chunk_job {
+        const size_t total;
+        const size_t grain;
+        const size_t participants;
+        const std::function<void(size_t, size_t)> *range;  // 只有抢到块的人才会用, 调用者等到抢走的块都做完才返回
+
+        std::atomic<size_t> next;
+        std::atomic<size_t> finished;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::exception_ptr error;
+
+        chunk_job(const size_t _total, const size_t _grain, const size_t _participants,
+                  const std::function<void(size_t, size_t)> *_range)
+            : total(_total), grain(std::max<size_t>(_grain, 1)), participants(_participants),
+              range(_range), next(0), finished(0) {}
+
+        // 抢一块, 块的大小随剩余量递减
+        bool claim(size_t& first, size_t& last) {
+            size_t cur = next.load();
+            do {
+                if(cur >= total)
+                    return false;
+                const size_t size = std::max(grain, (total - cur) / (2 * participants));
+                last = std::min(total, cur + size);
+            } while(not next.compare_exchange_weak(cur, last));
+            first = cur;
+            return true;
+        }
+
+        void complete(const size_t count) {
+            if(finished.fetch_add(count) + count == total) {
+                { std::lock_guard<std::mutex> lck(mtx); }
+                cv.notify_all();
+            }
+        }
+
+        void work() {
+            size_t first = 0, last = 0;
+            while(claim(first, last)) {
+                try {
+                    (*range)(first, last);
+                }
+                catch(...) {
+                    {
+                        std::lock_guard<std::mutex> lck(mtx);
+                        if(not error)
+                            error = std::current_exception();
+                    }
+                    // 没抢走的块不做了, 直接算作完成
+                    const size_t rest = next.exchange(total);
+                    if(rest < total)
+                        complete(total - rest);
+                }
+                complete(last - first);
+            }
+        }
+    };
+}
+
+void YHL::detail::run_chunked(thread_pool& pool, const size_t total, const size_t grain,
+                              const std::function<void(size_t, size_t)>& range) {
+    if(total == 0)
+        return;
+    const size_t chunks = (total + std::max<size_t>(grain, 1) - 1) / std::max<size_t>(grain, 1);
+    const size_t helpers = std::min(pool.size(), chunks - 1);
+    auto job = std::make_shared<chunk_job>(total, grain, helpers + 1, &range);
+
+    // 提交失败（线程池已经停止、有界队列满了）就不再找帮手, 剩下的块由调用线程自己做
+    // 已经提交的帮手可能正在用 range, 所以不能直接把异常抛出去, 还是要等所有抢走的块做完
+    for(size_t i = 0;i < helpers; ++i) {
+        try {
+            pool.post([job]{ job->work(); });
+        }
+        catch(...) {
+            break;
+        }
+    }
+
+    // 调用线程自己也干活, 抢完所有块才返回; 没来得及执行（或者被 shutdown、drop_oldest 丢掉）的帮手一块也没抢到,
+    // 不用等它们, 之后再执行也只会发现没有块可抢, 不会再碰 range
+    job->work();
+
+    {
+        std::unique_lock<std::mutex> lck(job->mtx);
+        job->cv.wait(lck, [&job]{ return job->finished.load() == job->total; });
+    }
+    if(job->error)
+        std::rethrow_exception(job->error);
+}
@@ -0,0 +1,86 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <mutex>
+#include <iterator>
+#include <functional>
+#include "threadpool.h"
+
+/* 使用说明
+    YHL::thread_pool pool(4);
+    std::vector<double> data(1 << 20, 1.0);
+
+    YHL::parallel_for(pool, size_t(0), data.size(), size_t(4096), [&](size_t i){ data[i] *= 2; });
+
+    double sum = YHL::parallel_reduce(pool, size_t(0), data.size(), size_t(4096), 0.0,
+        [&](size_t i){ return data[i]; },
+        [](double a, double b){ return a + b; });
+
+    std::vector<double> out(data.size());
+    YHL::parallel_transform(pool, data.begin(), data.end(), out.begin(), 4096,
+        [](double x){ return x * x; });
+ */
+
+/*
+ * 注意事项
+ * 1. 区间切成块, 每个参与者用一个原子下标抢下一块, 做完一块再抢, 快的线程自然多做
+ * 2. 块的大小是自适应的 : 剩余 / (2 * 参与者数), 但不小于 grain;
+ *    开始时块大, 调度次数少; 快结束时块小, 各线程差不多同时做完
+ * 3. 调用线程也是参与者, 自己抢块做, 做完才等别人手上的最后几块, 不会干等 future::get()
+ * 4. 某一块抛出异常后, 剩下没抢的块全部放弃, 异常在调用线程里重新抛出
+ * 5. parallel_reduce 的 reduce 必须满足结合律和交换律, 各块合并的顺序不确定
+ * 6. 帮忙的任务提交失败（线程池已经停止、有界队列满了）或者被丢掉时, 剩下的块都由调用线程做完, 不会抛出提交的异常
+ */
+
+namespace YHL {
+
+    namespace detail {
+        // 把 [0, total) 分块交给 range(first, last) 执行, 返回前所有块都已做完
+        void run_chunked(thread_pool& pool, const size_t total, const size_t grain,
+                         const std::function<void(size_t, size_t)>& range);
+    }
+
+    // 对 [begin, end) 的每个下标（或随机访问迭代器）调用 body(i)
+    template<typename Index, typename Body>
+    void parallel_for(thread_pool& pool, Index begin, Index end, const size_t grain, Body body) {
+        if(not (begin < end))
+            return;
+        const size_t total = static_cast<size_t>(end - begin);
+        detail::run_chunked(pool, total, grain, [&](size_t first, size_t last) {
+            for(size_t i = first;i < last; ++i)
+                body(begin + i);
+        });
+    }
+
+    // 返回 reduce(identity, map(begin), map(begin + 1), ...)
+    template<typename Index, typename T, typename Map, typename Reduce>
+    T parallel_reduce(thread_pool& pool, Index begin, Index end, const size_t grain,
+                      T identity, Map map, Reduce reduce) {
+        if(not (begin < end))
+            return identity;
+        std::mutex mtx;
+        T res = identity;
+        const size_t total = static_cast<size_t>(end - begin);
+        detail::run_chunked(pool, total, grain, [&](size_t first, size_t last) {
+            T local = identity;       // 块内先局部归约, 每块只加一次锁
+            for(size_t i = first;i < last; ++i)
+                local = reduce(std::move(local), map(begin + i));
+            std::lock_guard<std::mutex> lck(mtx);
+            res = reduce(std::move(res), std::move(local));
+        });
+        return res;
+    }
+
+    // out[i] = op(first[i]), 两边都是随机访问迭代器
+    template<typename InputIt, typename OutputIt, typename UnaryOp>
+    OutputIt parallel_transform(thread_pool& pool, InputIt first, InputIt last, OutputIt out,
+                                const size_t grain, UnaryOp op) {
+        const auto total = std::distance(first, last);
+        parallel_for(pool, decltype(total)(0), total, grain, [&](decltype(total) i) {
+            out[i] = op(first[i]);
+        });
+        return out + total;
+    }
+
+}
+
+#endif // PARALLEL_H
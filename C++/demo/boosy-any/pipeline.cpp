@@ -0,0 +1,89 @@
+#include "pipeline.h"
+
+YHL::detail::pipeline_core::pipeline_core(thread_pool& _pool, const size_t max_in_flight)
+    : pool(_pool),
+      limit(max_in_flight > 0 ? max_in_flight : 1),
+      in_flight(0),
+      active(0),
+      failed(false),
+      sequence(0) {}
+
+YHL::detail::pipeline_core::~pipeline_core() {
+    this->wait_idle();
+}
+
+// 工作线程上不能干等 : 等的可能正是排在自己后面的 stage 任务
+void YHL::detail::pipeline_core::help_or_wait(std::unique_lock<std::mutex>& lck) {
+    if(this->on_worker()) {
+        lck.unlock();
+        const bool ran = this->pool.try_run_one();
+        lck.lock();
+        if(ran)
+            return;
+    }
+    this->cv.wait_for(lck, std::chrono::microseconds(200));
+}
+
+bool YHL::detail::pipeline_core::admit() {
+    if(this->in_flight.fetch_add(1) < this->limit) {
+        if(this->ok())
+            return true;
+        this->retire();
+        return false;
+    }
+    this->retire();
+    std::unique_lock<std::mutex> lck(this->mtx);
+    while(this->ok()) {
+        size_t now = this->in_flight.load();
+        while(now < this->limit)
+            if(this->in_flight.compare_exchange_weak(now, now + 1))
+                return true;
+        this->help_or_wait(lck);
+    }
+    return false;
+}
+
+void YHL::detail::pipeline_core::retire() {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    --this->in_flight;
+    this->cv.notify_all();
+}
+
+void YHL::detail::pipeline_core::leave() {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(--this->active == 0)
+        this->cv.notify_all();
+}
+
+void YHL::detail::pipeline_core::push(unique_task&& task, const bool again) {
+    if(again)
+        this->pool.requeue(std::move(task));
+    else
+        this->pool.push_task(std::move(task));
+}
+
+bool YHL::detail::pipeline_core::on_worker() const noexcept {
+    return thread_pool::local_pool == &this->pool;
+}
+
+void YHL::detail::pipeline_core::fail(std::exception_ptr one) noexcept {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(not this->error)
+        this->error = one;
+    this->failed = true;
+}
+
+void YHL::detail::pipeline_core::abandon() noexcept {
+    this->fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+}
+
+void YHL::detail::pipeline_core::wait_idle() {
+    std::unique_lock<std::mutex> lck(this->mtx);
+    while(this->in_flight.load() > 0 or this->active.load() > 0)
+        this->help_or_wait(lck);
+}
+
+std::exception_ptr YHL::detail::pipeline_core::take_error() {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    return this->error;
+}
@@ -0,0 +1,434 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <type_traits>
+#include <condition_variable>
+#include <boost/optional.hpp>
+#include <boost/noncopyable.hpp>
+#include "threadpool.h"
+
+/* 使用说明
+    YHL::thread_pool pool(8);
+
+    // 读 -> 解析 -> 转换 -> 写, 同时在流水线里的行最多 256 个
+    auto job = YHL::make_pipeline<std::string>(pool, 256)
+        .serial([](std::string line){ return parse(line); })            // 一次一个, 按输入的顺序
+        .parallel([](record one){ return transform(one); })             // 多个线程同时执行
+        .sink([&out](result one){ out << one; }, YHL::output_order::input);   // 一次一个, 按输入的顺序写出
+
+    std::string line;
+    while(std::getline(in, line))
+        job.push(std::move(line));      // 流水线满了就等, 读得再快也不会把内存撑爆
+    job.wait();                         // 等所有行写完, 重新抛出第一个异常
+ */
+
+/*
+ * 注意事项
+ * 1. 每一级都在线程池上执行, 不创建线程; serial 和 sink 一次只执行一个, parallel 的每一项是线程池里的一个任务
+ * 2. push 给每一项编号; serial 按编号的顺序执行, 前面的还没到就先放进缓冲里等着; sink 默认按到达的顺序, output_order::input 按编号
+ * 3. 各级之间的缓冲加起来不超过 max_in_flight : push 时流水线里已经有这么多项就等, 直到 sink 处理完一项
+ * 4. 工作线程上调用 push / wait 不会干等, 而是顺手执行线程池里的任务
+ * 5. serial / sink 在工作线程上收到正好轮到的那一项时直接执行, 否则交给线程池; 连续执行 64 项后重新排队, 让别的任务也轮得到
+ * 6. 某一级抛出异常后, 后面的项不再执行任何一级（只是流过去, 好让计数归零）, push 返回 false, wait 重新抛出这个异常
+ * 7. 析构时等所有项流完, 不再抛出异常; 线程池要比它活得久
+ * 8. stage 任务提交失败（线程池已经停止）或者排队时被丢掉（shutdown、drop_oldest）, 按 6 处理, 异常是 std::future_error(broken_promise)
+ */
+
+namespace YHL {
+
+    enum class output_order { completion, input };
+
+    namespace detail {
+
+        class pipeline_core final : boost::noncopyable {
+        private:
+            struct stage_base {
+                virtual ~stage_base() = default;
+            };
+            template<typename Stage>
+            struct holder final : stage_base {
+                Stage stage;
+                template<typename... Args>
+                explicit holder(Args&& ...args) : stage(std::forward<Args>(args)...) {}
+            };
+
+            thread_pool& pool;
+            const size_t limit;
+            std::vector< std::unique_ptr<stage_base> > stages;
+
+            std::atomic<size_t> in_flight;      // push 了还没有流出 sink 的项
+            std::atomic<size_t> active;         // 正在执行或者排在线程池里的 stage 任务
+            std::atomic<bool> failed;
+            std::exception_ptr error;           // 由 mtx 保护
+            std::mutex mtx;
+            std::condition_variable cv;
+
+            void help_or_wait(std::unique_lock<std::mutex>&);
+            void push(unique_task&&, const bool again);
+
+        public:
+            std::atomic<size_t> sequence;       // 下一个 push 的编号
+
+            pipeline_core(thread_pool&, const size_t max_in_flight);
+            ~pipeline_core();
+
+            template<typename Stage, typename... Args>
+            Stage* add(Args&& ...args) {
+                auto one = new holder<Stage>(std::forward<Args>(args)...);
+                this->stages.emplace_back(one);
+                return &one->stage;
+            }
+
+            // 有空位才返回; 已经失败返回 false
+            bool admit();
+            void retire();
+
+            // stage 任务 : enter 之后才能交给线程池, 执行完最后一步 leave
+            // 提交失败（线程池已经停止）或者排队时被丢掉（shutdown、drop_oldest）, 包装析构时调用 drop 把它按失败流完
+            // again : 执行了一批之后重新排队, 不进 LIFO 槽
+            void enter() { ++this->active; }
+            void leave();
+            template<typename Fun, typename Drop>
+            void post(Fun&& fun, Drop&& drop, const bool again = false) {
+                try {
+                    this->push(unique_task(make_abandonable(std::forward<Fun>(fun), std::forward<Drop>(drop))), again);
+                }
+                catch(...) {
+                    // 包装析构时已经调用过 drop 了
+                }
+            }
+            bool on_worker() const noexcept;
+
+            void fail(std::exception_ptr) noexcept;
+            void abandon() noexcept;
+            bool ok() const noexcept { return not failed.load(); }
+
+            // 所有项流完, 没有 stage 任务了
+            void wait_idle();
+            std::exception_ptr take_error();
+
+            size_t flying() const noexcept { return in_flight.load(); }
+            size_t capacity() const noexcept { return limit; }
+        };
+
+        // 每一级的入口; skip 是失败的项, 只是占住编号往后传
+        template<typename T>
+        struct stage_input {
+            virtual void accept(const size_t seq, T&& item) = 0;
+            virtual void skip(const size_t seq) = 0;
+        protected:
+            ~stage_input() = default;
+        };
+
+        template<typename T>
+        struct stage_output {
+            stage_input<T> *next = nullptr;
+        };
+
+        // push 进来的项从这里出发
+        template<typename T>
+        struct source final : stage_output<T> {};
+
+        template<typename In, typename Out, typename F>
+        class parallel_stage final : public stage_input<In>, public stage_output<Out> {
+        private:
+            pipeline_core& core;
+            F fun;
+
+            void run(const size_t seq, In& item) {
+                if(not this->core.ok()) {
+                    this->next->skip(seq);
+                    return;
+                }
+                bool done = false;
+                try {
+                    Out out = fun(std::move(item));
+                    done = true;
+                    this->next->accept(seq, std::move(out));
+                }
+                catch(...) {
+                    this->core.fail(std::current_exception());
+                    if(not done)
+                        this->next->skip(seq);
+                }
+            }
+
+        public:
+            template<typename Fun>
+            parallel_stage(pipeline_core& _core, Fun&& _fun) : core(_core), fun(std::forward<Fun>(_fun)) {}
+
+            void accept(const size_t seq, In&& item) override {
+                this->core.enter();
+                this->core.post(
+                    [this, seq, item = std::move(item)]() mutable {
+                        this->run(seq, item);
+                        this->core.leave();
+                    },
+                    [this, seq]{
+                        this->core.abandon();
+                        this->next->skip(seq);
+                        this->core.leave();
+                    });
+            }
+
+            void skip(const size_t seq) override {
+                this->next->skip(seq);
+            }
+        };
+
+        // serial 和 sink 共用 : 一次只处理一项, ordered 时按编号的顺序
+        template<typename In>
+        class serial_runner : public stage_input<In> {
+        private:
+            static constexpr size_t batch = 64;
+
+            const bool ordered;
+            std::mutex mtx;
+            std::map< size_t, boost::optional<In> > waiting;                 // ordered : 按编号排好
+            std::deque< std::pair<size_t, boost::optional<In>> > arrived;    // 否则按到达的顺序
+            size_t expected = 0;
+            bool busy = false;
+
+            bool ready() const {
+                if(this->ordered)
+                    return not this->waiting.empty() and this->waiting.begin()->first == this->expected;
+                return not this->arrived.empty();
+            }
+
+            void enqueue(const size_t seq, boost::optional<In>&& item) {
+                {
+                    std::lock_guard<std::mutex> lck(this->mtx);
+                    if(this->ordered)
+                        this->waiting.emplace(seq, std::move(item));
+                    else
+                        this->arrived.emplace_back(seq, std::move(item));
+                    if(this->busy or not this->ready())
+                        return;
+                    this->busy = true;
+                }
+                this->core.enter();
+                if(this->core.on_worker())
+                    this->drain(false);
+                else
+                    this->schedule(false);
+            }
+
+            // drain 被丢掉 : 流水线算失败, 就地把排着的项全部流过去（失败的项不执行）, 计数才能归零
+            void schedule(const bool again) {
+                this->core.post(
+                    [this]{ this->drain(false); },
+                    [this]{
+                        this->core.abandon();
+                        this->drain(true);
+                    },
+                    again);
+            }
+
+            // all : 一直处理到没有排着的项, 不分批重新排队
+            void drain(const bool all) {
+                for(size_t i = 0;all or i < batch; ++i) {
+                    size_t seq;
+                    boost::optional<In> item;
+                    {
+                        std::lock_guard<std::mutex> lck(this->mtx);
+                        if(this->ordered) {
+                            auto it = this->waiting.begin();
+                            seq = it->first;
+                            item = std::move(it->second);
+                            this->waiting.erase(it);
+                            ++this->expected;
+                        }
+                        else {
+                            seq = this->arrived.front().first;
+                            item = std::move(this->arrived.front().second);
+                            this->arrived.pop_front();
+                        }
+                    }
+                    this->process(seq, std::move(item));
+                    {
+                        std::lock_guard<std::mutex> lck(this->mtx);
+                        if(not this->ready()) {
+                            this->busy = false;
+                            break;
+                        }
+                    }
+                    if(not all and i + 1 == batch) {
+                        this->schedule(true);     // 还有, 排到线程池队尾
+                        return;
+                    }
+                }
+                this->core.leave();
+            }
+
+        protected:
+            pipeline_core& core;
+
+            // 不抛出异常; item 为空表示这一项已经失败
+            virtual void process(const size_t seq, boost::optional<In>&& item) = 0;
+
+        public:
+            serial_runner(pipeline_core& _core, const bool _ordered) : ordered(_ordered), core(_core) {}
+
+            void accept(const size_t seq, In&& item) override {
+                this->enqueue(seq, boost::optional<In>(std::move(item)));
+            }
+
+            void skip(const size_t seq) override {
+                this->enqueue(seq, boost::none);
+            }
+        };
+
+        template<typename In, typename Out, typename F>
+        class serial_stage final : public serial_runner<In>, public stage_output<Out> {
+        private:
+            F fun;
+
+            void process(const size_t seq, boost::optional<In>&& item) override {
+                if(not item or not this->core.ok()) {
+                    this->next->skip(seq);
+                    return;
+                }
+                bool done = false;
+                try {
+                    Out out = fun(std::move(*item));
+                    done = true;
+                    this->next->accept(seq, std::move(out));
+                }
+                catch(...) {
+                    this->core.fail(std::current_exception());
+                    if(not done)
+                        this->next->skip(seq);
+                }
+            }
+
+        public:
+            template<typename Fun>
+            serial_stage(pipeline_core& _core, Fun&& _fun)
+                : serial_runner<In>(_core, true), fun(std::forward<Fun>(_fun)) {}
+        };
+
+        template<typename In, typename F>
+        class sink_stage final : public serial_runner<In> {
+        private:
+            F fun;
+
+            void process(const size_t, boost::optional<In>&& item) override {
+                if(item and this->core.ok()) {
+                    try {
+                        fun(std::move(*item));
+                    }
+                    catch(...) {
+                        this->core.fail(std::current_exception());
+                    }
+                }
+                this->core.retire();
+            }
+
+        public:
+            template<typename Fun>
+            sink_stage(pipeline_core& _core, Fun&& _fun, const output_order order)
+                : serial_runner<In>(_core, order == output_order::input), fun(std::forward<Fun>(_fun)) {}
+        };
+    }
+
+    template<typename In>
+    class pipeline final {
+    private:
+        std::unique_ptr<detail::pipeline_core> core;
+        detail::source<In> *head;
+
+    public:
+        pipeline(std::unique_ptr<detail::pipeline_core>&& _core, detail::source<In> *_head)
+            : core(std::move(_core)), head(_head) {}
+        pipeline(pipeline&&) = default;
+        pipeline(const pipeline&) = delete;
+        pipeline& operator=(const pipeline&) = delete;
+        ~pipeline() {
+            if(this->core)
+                this->core->wait_idle();
+        }
+
+        // 流水线满了就等; 之前有一级抛出了异常就返回 false, 这一项被丢掉
+        bool push(In item) {
+            if(not this->core->admit())
+                return false;
+            this->head->next->accept(this->core->sequence++, std::move(item));
+            return true;
+        }
+
+        // 等已经 push 的项全部流出 sink, 然后重新抛出第一个异常
+        void wait() {
+            this->core->wait_idle();
+            if(auto error = this->core->take_error())
+                std::rethrow_exception(error);
+        }
+
+        size_t in_flight() const noexcept { return this->core->flying(); }
+        size_t max_in_flight() const noexcept { return this->core->capacity(); }
+    };
+
+    // make_pipeline 返回它, 一级一级往后接, 最后接上 sink 得到 pipeline
+    template<typename In, typename Cur>
+    class pipeline_builder final {
+    private:
+        std::unique_ptr<detail::pipeline_core> core;
+        detail::source<In> *head;
+        detail::stage_output<Cur> *tail;
+
+        template<typename, typename> friend class pipeline_builder;
+
+        template<typename F>
+        using result_of_t = typename std::decay<typename std::result_of<F(Cur)>::type>::type;
+
+    public:
+        pipeline_builder(std::unique_ptr<detail::pipeline_core>&& _core,
+                         detail::source<In> *_head, detail::stage_output<Cur> *_tail)
+            : core(std::move(_core)), head(_head), tail(_tail) {}
+
+        // 一次一项, 按 push 的顺序
+        template<typename F>
+        pipeline_builder<In, result_of_t<F>> serial(F&& fun) && {
+            static_assert(not std::is_void<result_of_t<F>>::value, "only the sink stage may return void");
+            using stage = detail::serial_stage<Cur, result_of_t<F>, typename std::decay<F>::type>;
+            stage *one = this->core->add<stage>(*this->core, std::forward<F>(fun));
+            this->tail->next = one;
+            return pipeline_builder<In, result_of_t<F>>(std::move(this->core), this->head, one);
+        }
+
+        // 每一项一个任务, 完成的顺序不定
+        template<typename F>
+        pipeline_builder<In, result_of_t<F>> parallel(F&& fun) && {
+            static_assert(not std::is_void<result_of_t<F>>::value, "only the sink stage may return void");
+            using stage = detail::parallel_stage<Cur, result_of_t<F>, typename std::decay<F>::type>;
+            stage *one = this->core->add<stage>(*this->core, std::forward<F>(fun));
+            this->tail->next = one;
+            return pipeline_builder<In, result_of_t<F>>(std::move(this->core), this->head, one);
+        }
+
+        // 一次一项; output_order::input 时按 push 的顺序
+        template<typename F>
+        pipeline<In> sink(F&& fun, const output_order order = output_order::completion) && {
+            using stage = detail::sink_stage<Cur, typename std::decay<F>::type>;
+            stage *one = this->core->add<stage>(*this->core, std::forward<F>(fun), order);
+            this->tail->next = one;
+            return pipeline<In>(std::move(this->core), this->head);
+        }
+    };
+
+    // max_in_flight : 同时在流水线里的项数上限
+    template<typename In>
+    pipeline_builder<In, In> make_pipeline(thread_pool& pool, const size_t max_in_flight = 64) {
+        std::unique_ptr<detail::pipeline_core> core(new detail::pipeline_core(pool, max_in_flight));
+        auto head = core->add< detail::source<In> >();
+        return pipeline_builder<In, In>(std::move(core), head, head);
+    }
+
+}
+
+#endif // PIPELINE_H
@@ -0,0 +1,84 @@
+#include "strand.h"
+#include <thread>
+
+namespace {
+    // 一次 drain 最多执行这么多个任务, 然后重新排队
+    constexpr size_t drain_batch = 64;
+}
+
+thread_local const YHL::strand* YHL::strand::current = nullptr;
+
+YHL::strand::strand(thread_pool& _pool)
+    : pool(_pool), count(0) {}
+
+// 和 task_group 一样边等边执行别的任务, 在工作线程上析构也不会把线程池等死
+YHL::strand::~strand() {
+    while(this->count.load() > 0) {
+        if(this->pool.try_run_one())
+            continue;
+        std::unique_lock<std::mutex> lck(this->mtx);
+        this->cv.wait_for(lck, std::chrono::microseconds(200), [this]{ return this->count.load() == 0; });
+    }
+    std::lock_guard<std::mutex> lck(this->mtx);
+}
+
+bool YHL::strand::running_in_this_thread() const noexcept {
+    return current == this;
+}
+
+// 先入队再计数, drain 看到计数就一定能取到任务（最多等生产者连上链表）
+void YHL::strand::enqueue(unique_task&& task) {
+    this->queue.push(std::move(task));
+    if(this->count.fetch_add(1) == 0)
+        this->schedule();
+}
+
+// drain 没有执行就被销毁（线程池已经停止、shutdown 或者 drop_oldest 丢掉了它）: 丢掉排队的任务, 计数归零, 析构才不会一直等
+// 提交时抛出的异常再交给调用方
+void YHL::strand::schedule(const bool again) {
+    unique_task task(detail::make_abandonable(
+        [this]{ this->drain(); },
+        [this]{ this->discard(); }));
+    if(again)
+        this->pool.requeue(std::move(task));
+    else
+        this->pool.push_task(std::move(task));
+}
+
+void YHL::strand::drain() {
+    const strand *saved = current;
+    current = this;
+    for(size_t i = 0;i < drain_batch; ++i) {
+        unique_task task;
+        while(not this->queue.try_pop(task))
+            std::this_thread::yield();
+        this->pool.run_task(task);
+        task = unique_task();    // 计数减一之前析构, 它可能引用着等待析构的对象
+        if(this->finish_one() == 0) {
+            current = saved;
+            return;
+        }
+    }
+    current = saved;
+    this->schedule(true);        // 还有任务, 排到线程池队尾（不进 LIFO 槽）, 让别的 strand 也轮得到
+}
+
+// 此时没有 drain 在执行, 调用方就是唯一的消费者
+void YHL::strand::discard() {
+    do {
+        unique_task task;
+        while(not this->queue.try_pop(task))
+            std::this_thread::yield();
+    } while(this->finish_one() > 0);
+}
+
+// 最后一个任务的计数在锁里减, 析构方拿到锁才会返回
+size_t YHL::strand::finish_one() {
+    if(this->count.load() > 1)       // 只有消费者会减, 大于 1 时减完也不会是 0
+        return this->count.fetch_sub(1) - 1;
+    std::lock_guard<std::mutex> lck(this->mtx);
+    const size_t left = this->count.fetch_sub(1) - 1;
+    if(left == 0)
+        this->cv.notify_all();
+    return left;
+}
@@ -0,0 +1,94 @@
+#ifndef STRAND_H
+#define STRAND_H
+#include <mutex>
+#include <atomic>
+#include <tuple>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+#include "threadpool.h"
+#include "mpsc_queue.h"
+
+/* 使用说明
+    YHL::thread_pool pool(4);
+
+    // 每个连接一个 strand : 同一个连接的消息按顺序一个一个处理, 不同连接在各个线程上并行
+    struct session {
+        YHL::strand serial;
+        std::string buffer;        // 只在 serial 上访问, 不用加锁
+        explicit session(YHL::thread_pool& pool) : serial(pool) {}
+    };
+    session one(pool);
+    one.serial.post([&one]{ one.buffer += "hello "; });
+    one.serial.post([&one]{ one.buffer += "world"; });
+    auto size = one.serial.submit([&one]{ return one.buffer.size(); });   // 11
+ */
+
+/*
+ * 注意事项
+ * 1. 每个 strand 一个无锁 MPSC 队列, 外加一个原子计数 : 提交时先入队再加一, 从 0 变成 1 的那个提交方负责把 strand 交给线程池
+ * 2. 线程池里排的是 strand 的 drain 任务, 不是 strand 里的任务; 同一时刻最多一个 drain, 所以 strand 里的任务不会并行
+ * 3. drain 一次最多执行 64 个任务, 还有剩下的就把自己重新排到线程池队尾（不进 LIFO 槽）, 一个忙碌的 strand 不会霸占线程
+ * 4. strand 里排队的任务不计入线程池的 max_queued; post 的任务抛出的异常交给线程池的 exception_handler
+ * 5. 析构时边等边执行线程池里的任务, 直到 strand 里的任务都执行完; 不要在这个 strand 自己的任务里析构它
+ * 6. drain 被线程池丢掉（shutdown、drop_oldest）时, strand 里排队的任务一起丢掉, submit 的 future 得到 broken_promise
+ */
+
+namespace YHL {
+
+    class strand final : boost::noncopyable {
+    private:
+        thread_pool& pool;
+        mpsc_queue< unique_task > queue;
+        std::atomic<size_t> count;        // 还没执行完的任务数
+        std::mutex mtx;
+        std::condition_variable cv;
+
+        static thread_local const strand* current;
+
+        void enqueue(unique_task&&);
+        void schedule(const bool again = false);
+        void drain();
+        void discard();
+        size_t finish_one();
+
+    public:
+        explicit strand(thread_pool&);
+        ~strand();
+
+        // 按提交的顺序, 一次一个地在线程池上执行
+        template<typename F>
+        void post(F&& fun);
+
+        template<typename F, class... Args>
+        auto submit(F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type>;
+
+        // 当前线程是不是正在执行这个 strand 的任务
+        bool running_in_this_thread() const noexcept;
+    };
+
+    template<typename F>
+    void strand::post(F&& fun) {
+        this->enqueue(unique_task(std::forward<F>(fun)));
+    }
+
+    template<typename F, class... Args>
+    auto strand::submit(F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type> {
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        auto pair = make_task_pair<return_type>(this->pool.blocks, this->pool.executor());
+
+        this->enqueue(unique_task(
+            [promise = std::move(pair.first),
+             fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                promise.run(std::move(fun), std::move(args));
+            }));
+
+        return std::move(pair.second);
+    }
+
+}
+
+#endif // STRAND_H
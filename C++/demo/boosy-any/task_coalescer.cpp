@@ -0,0 +1,141 @@
+#include "task_coalescer.h"
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+    std::atomic<uint64_t> next_id(1);
+
+    // 这个线程在各个 coalescer 里的缓冲; last 是最近用过的那个, 连续提交时不用查表
+    // unordered_map 的元素地址在 rehash 之后不变, 可以留指针
+    struct thread_buffers {
+        uint64_t last_id = 0;
+        const std::shared_ptr<YHL::detail::coalesce_buffer> *last = nullptr;
+        std::unordered_map< uint64_t, std::shared_ptr<YHL::detail::coalesce_buffer> > all;
+    };
+    thread_local thread_buffers mine;
+}
+
+YHL::task_coalescer::task_coalescer(thread_pool& _pool, const size_t _threshold, const std::chrono::microseconds _timeout)
+    : pool(_pool), threshold(_threshold > 0 ? _threshold : 1), timeout(_timeout), id(next_id++) {}
+
+YHL::task_coalescer::~task_coalescer() {
+    try {
+        this->flush_all();
+    }
+    catch(...) {
+        // 线程池已经停止, 攒着的任务随缓冲一起丢掉
+    }
+}
+
+const std::shared_ptr<YHL::detail::coalesce_buffer>& YHL::task_coalescer::local() {
+    if(mine.last_id == this->id)
+        return *mine.last;
+    auto it = mine.all.find(this->id);
+    if(it == mine.all.end()) {
+        // 只剩这里一份引用的缓冲, 它的 coalescer 已经析构了, 顺手清掉
+        for(auto one = mine.all.begin(); one not_eq mine.all.end(); ) {
+            if(one->second.use_count() == 1)
+                one = mine.all.erase(one);
+            else
+                ++one;
+        }
+        auto buffer = std::make_shared<detail::coalesce_buffer>();
+        buffer->tasks.reserve(this->threshold);
+        std::vector< std::shared_ptr<detail::coalesce_buffer> > dead;
+        {
+            std::lock_guard<std::mutex> lck(this->mtx);
+            // 表比上次清理后翻了一倍才清, 短命线程很多时均摊下来每次注册是常数时间
+            if(this->buffers.size() >= this->prune_at) {
+                this->retire(dead);
+                this->prune_at = std::max<size_t>(this->buffers.size() * 2, 16);
+            }
+            this->buffers.push_back(buffer);
+        }
+        it = mine.all.emplace(this->id, std::move(buffer)).first;
+        for(auto& one : dead)
+            flush_buffer(this->pool, *one, false);
+    }
+    mine.last_id = this->id;
+    mine.last = &it->second;
+    return it->second;
+}
+
+void YHL::task_coalescer::add(unique_task&& task) {
+    const std::shared_ptr<detail::coalesce_buffer>& one = this->local();
+    std::vector< unique_task > batch;
+    bool arm = false;
+    {
+        std::lock_guard<std::mutex> lck(one->mtx);
+        one->tasks.emplace_back(std::move(task));
+        if(one->tasks.size() >= this->threshold) {
+            batch.reserve(this->threshold);      // 换给缓冲, 下一批不用重新分配
+            batch.swap(one->tasks);
+        }
+        else if(not one->armed)
+            arm = one->armed = true;
+    }
+    if(not batch.empty()) {
+        submit_batch(this->pool, batch);
+        return;
+    }
+    if(not arm)
+        return;
+    // 定时任务只拿着缓冲和线程池, coalescer 先析构也没关系
+    thread_pool *target = &this->pool;
+    std::shared_ptr<detail::coalesce_buffer> keep = one;
+    try {
+        this->pool.schedule_after(this->timeout, [target, keep]{ flush_buffer(*target, *keep, true); });
+    }
+    catch(...) {
+        flush_buffer(this->pool, *one, true);
+        throw;
+    }
+}
+
+void YHL::task_coalescer::flush_buffer(thread_pool& pool, detail::coalesce_buffer& one, const bool disarm) {
+    std::vector< unique_task > batch;
+    {
+        std::lock_guard<std::mutex> lck(one.mtx);
+        if(disarm)
+            one.armed = false;
+        if(one.tasks.empty())
+            return;
+        batch.reserve(one.tasks.capacity());
+        batch.swap(one.tasks);
+    }
+    submit_batch(pool, batch);
+}
+
+void YHL::task_coalescer::submit_batch(thread_pool& pool, std::vector< unique_task >& batch) {
+    if(pool.admit(batch.data(), batch.size()))
+        pool.push_bulk(batch.data(), batch.size());
+}
+
+void YHL::task_coalescer::flush() {
+    flush_buffer(this->pool, *this->local(), false);
+}
+
+void YHL::task_coalescer::flush_all() {
+    std::vector< std::shared_ptr<detail::coalesce_buffer> > all;
+    {
+        std::lock_guard<std::mutex> lck(this->mtx);
+        this->retire(all);
+        all.insert(all.end(), this->buffers.begin(), this->buffers.end());
+    }
+    for(auto& one : all)
+        flush_buffer(this->pool, *one, false);
+}
+
+// 只剩表里一份引用的缓冲 : 线程已经退出, 定时任务也没挂着, 不会再有人往里放任务
+// 从表里拿出来交给调用方, 在锁外把剩下的任务入队; 调用方持有 mtx
+void YHL::task_coalescer::retire(std::vector< std::shared_ptr<detail::coalesce_buffer> >& dead) {
+    auto alive = this->buffers.begin();
+    for(auto& one : this->buffers) {
+        if(one.use_count() == 1)
+            dead.emplace_back(std::move(one));
+        else
+            *alive++ = std::move(one);
+    }
+    this->buffers.erase(alive, this->buffers.end());
+}
@@ -0,0 +1,119 @@
+#ifndef TASK_COALESCER_H
+#define TASK_COALESCER_H
+#include <mutex>
+#include <tuple>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <boost/noncopyable.hpp>
+#include "threadpool.h"
+
+/* 使用说明
+    YHL::thread_pool pool(4);
+
+    // 每个任务只有几十纳秒, 一个一个 post 的话时间都花在入队的锁和唤醒上
+    YHL::task_coalescer coalesce(pool, 64, std::chrono::milliseconds(1));
+    for(int i = 0;i < 1000000; ++i)
+        coalesce.post([i]{ tiny(i); });      // 攒在当前线程的缓冲里, 攒够 64 个整批入队
+    auto last = coalesce.submit([]{ return 42; });
+    coalesce.flush();                        // 不想等 1ms 的话, 当前线程攒着的马上入队
+ */
+
+/*
+ * 注意事项
+ * 1. 每个提交线程一个缓冲, post 只锁自己的缓冲, 几乎没有竞争; 攒够 threshold 个就在提交方线程上整批交给线程池 :
+ *    有界队列检查一次, 全局队列加一次锁, 最多唤醒 min(个数, 空闲线程数) 个线程
+ * 2. 缓冲从空变成不空时挂一个 timeout 之后触发的定时任务, 到时把这个缓冲里的任务入队, 停止提交的线程攒着的任务不会一直等;
+ *    精度是定时器的一格（1ms）
+ * 3. 攒批换来的是延迟 : 一个任务最多晚 timeout 才入队; 要马上执行的任务直接用线程池的 post, 或者提交完调用 flush
+ * 4. 整批入队和定时入队可能同时发生, 同一个线程提交的任务也不保证按顺序执行
+ * 5. 有界队列按整批处理, caller_runs 时整批在提交方执行; 定时器触发的入队在工作线程上, 不受 max_queued 限制
+ * 6. 析构时把所有线程的缓冲入队; 要在线程池 shutdown 之前析构, 否则攒着的任务会被丢掉（future 得到 broken_promise）
+ * 7. 线程退出后它的缓冲在 flush_all 或者有新线程注册时清掉, 提交线程来来去去也不会一直攒着缓冲
+ */
+
+namespace YHL {
+
+    namespace detail {
+        // 一个线程攒着的任务
+        struct coalesce_buffer {
+            std::mutex mtx;
+            std::vector< unique_task > tasks;
+            bool armed = false;      // 已经挂了定时任务, 还没触发
+        };
+    }
+
+    class task_coalescer final : boost::noncopyable {
+    private:
+        thread_pool& pool;
+        const size_t threshold;
+        const std::chrono::microseconds timeout;
+        const uint64_t id;                  // 线程局部的缓冲表用它找到这个 coalescer 的缓冲
+        std::mutex mtx;
+        std::vector< std::shared_ptr<detail::coalesce_buffer> > buffers;   // 所有线程的缓冲, 由 mtx 保护
+        size_t prune_at = 16;               // buffers 到这么多时清掉已经退出的线程的缓冲, 由 mtx 保护
+
+        const std::shared_ptr<detail::coalesce_buffer>& local();
+        void add(unique_task&&);
+        static void flush_buffer(thread_pool&, detail::coalesce_buffer&, const bool disarm);
+        static void submit_batch(thread_pool&, std::vector< unique_task >&);
+        void retire(std::vector< std::shared_ptr<detail::coalesce_buffer> >&);
+
+    public:
+        // threshold : 一个线程攒够多少个就入队; timeout : 最早的任务最多攒多久
+        explicit task_coalescer(thread_pool&, const size_t threshold = 64,
+                                const std::chrono::microseconds timeout = std::chrono::milliseconds(1));
+        ~task_coalescer();
+
+        template<typename F>
+        void post(F&& fun);
+
+        template<typename F, class... Args>
+        void post(F&& fun, Args&& ...args);
+
+        template<typename F, class... Args>
+        auto submit(F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type>;
+
+        // 当前线程攒着的任务马上入队
+        void flush();
+
+        // 所有线程攒着的任务马上入队
+        void flush_all();
+    };
+
+    template<typename F>
+    void task_coalescer::post(F&& fun) {
+        this->add(unique_task(std::forward<F>(fun)));
+    }
+
+    template<typename F, class... Args>
+    void task_coalescer::post(F&& fun, Args&& ...args) {
+        this->add(unique_task(
+            [fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                detail::apply_tuple(std::move(fun), std::move(args));
+            }));
+    }
+
+    template<typename F, class... Args>
+    auto task_coalescer::submit(F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type> {
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        auto pair = make_task_pair<return_type>(this->pool.blocks, this->pool.executor());
+
+        this->add(unique_task(
+            [promise = std::move(pair.first),
+             fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                promise.run(std::move(fun), std::move(args));
+            }));
+
+        return std::move(pair.second);
+    }
+
+}
+
+#endif // TASK_COALESCER_H
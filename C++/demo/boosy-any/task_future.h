@@ -0,0 +1,590 @@
+#ifndef TASK_FUTURE_H
+#define TASK_FUTURE_H
+#include <new>
+#include <tuple>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <future>
+#include <exception>
+#include <thread>
+#include <type_traits>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+#include "unique_task.h"
+
+/* 使用说明
+    auto pool = std::make_shared<YHL::task_block_pool>();
+    YHL::task_promise<int> promise;
+    YHL::task_future<int> future;
+    std::tie(promise, future) = YHL::make_task_pair<int>(pool);
+    promise.set_value(7);
+    std::cout << future.get() << "\n";
+
+    // 后续任务 : 结果就绪后才把 lambda 交给线程池, 中间没有线程在 get() 上等待
+    auto text = pool.submit([]{ return 21; })
+        .then([](YHL::task_future<int> x){ return x.get() * 2; })
+        .then([](YHL::task_future<int> x){ return std::to_string(x.get()); });
+
+    std::vector< YHL::task_future<int> > parts;
+    parts.emplace_back(pool.submit([]{ return 1; }));
+    parts.emplace_back(pool.submit([]{ return 2; }));
+    auto all = YHL::when_all(std::move(parts));      // 全部就绪, 得到原来的 future
+    auto any = YHL::when_any(std::move(others));     // 第一个就绪, index 是它的下标
+ */
+
+/*
+ * 注意事项
+ * 1. 相当于 std::promise / std::future, 但共享状态不用 new, 而是从 task_block_pool 里取一块
+ * 2. task_block_pool 是一个空闲链表, 块大小固定; 装不下的共享状态才退回 operator new
+ * 3. 共享状态由 promise 和 future 各持有一个引用, 两边都放手之后把块还给空闲链表
+ * 4. 共享状态持有 task_block_pool 的 shared_ptr, 所以 future 比线程池活得久也没问题
+ * 5. promise 没有设置结果就析构, future 会得到 broken_promise, 不会一直等下去
+ * 6. 共享状态上可以挂一个后续任务, 结果（包括异常和 broken_promise）就绪时由设置结果的线程取出来
+ *    then 的后续任务交给 executor（线程池的 submit 会填上这个线程池）, 没有 executor 或者线程池已经停止就地执行
+ *    when_all / when_any 挂的是计数用的回调, 直接在设置结果的线程上执行
+ * 7. 线程池析构之后 future 还可以 then / co_await : executor 的 gate 已经关上, 后续任务在设置结果（或者挂上）的线程上执行
+ * 8. when_any 交出结果前取下挂在其余 future 上的回调, 交回来的 future 还可以再 then / when_any
+ */
+
+namespace YHL {
+
+    // 固定大小的内存块空闲链表, 用一个自旋锁保护, 临界区只有几条指令
+    class task_block_pool final : boost::noncopyable {
+    public:
+        static constexpr size_t block_size = 384;   // 放得下带后续任务槽的共享状态
+
+    private:
+        struct block { block *next; };
+
+        block *head;
+        size_t idle;            // 链表里的块数, 由 spin 保护
+        std::atomic_flag spin;
+
+        void lock() noexcept {
+            while(spin.test_and_set(std::memory_order_acquire))
+                ;
+        }
+        void unlock() noexcept {
+            spin.clear(std::memory_order_release);
+        }
+
+    public:
+        task_block_pool() noexcept : head(nullptr), idle(0) {
+            spin.clear();
+        }
+
+        ~task_block_pool() noexcept {
+            while(head not_eq nullptr) {
+                block *next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+
+        void* allocate() {
+            lock();
+            block *res = head;
+            if(res not_eq nullptr) {
+                head = res->next;
+                --idle;
+            }
+            unlock();
+            return res not_eq nullptr ? res : ::operator new(block_size);
+        }
+
+        void deallocate(void *raw) noexcept {
+            block *one = static_cast<block*>(raw);
+            lock();
+            one->next = head;
+            head = one;
+            ++idle;
+            unlock();
+        }
+
+        // 链表里至少留 n 块, 之后同时存在的共享状态不超过 n 个就不用再 new
+        void reserve(const size_t n) {
+            for(;;) {
+                lock();
+                const bool enough = idle >= n;
+                unlock();
+                if(enough)
+                    return;
+                deallocate(::operator new(block_size));
+            }
+        }
+    };
+
+    // executor 还能不能用 : 线程池析构前关上, 之后不会再有人碰 context
+    // 进出只是两次原子操作; close 等正在提交的人出来
+    class executor_gate final : boost::noncopyable {
+    private:
+        std::atomic<int> users;
+        std::atomic<bool> open;
+    public:
+        executor_gate() noexcept : users(0), open(true) {}
+
+        bool enter() noexcept {
+            ++users;
+            if(open.load())
+                return true;
+            --users;
+            return false;
+        }
+
+        void leave() noexcept {
+            --users;
+        }
+
+        void close() noexcept {
+            open = false;
+            while(users.load() > 0)
+                std::this_thread::yield();
+        }
+    };
+
+    // 后续任务交给谁执行, 线程池 submit 的时候填上自己
+    // gate 为空表示 context 一直有效; 关上之后后续任务就地执行
+    struct task_executor {
+        void (*post)(void*, unique_task&&) = nullptr;
+        void *context = nullptr;
+        std::shared_ptr<executor_gate> gate;
+    };
+
+    namespace detail {
+
+        // 保存任务的结果, void 和引用单独处理
+        template<typename R>
+        class task_value {
+        private:
+            typename std::aligned_storage<sizeof(R), alignof(R)>::type storage;
+            bool has = false;
+        public:
+            ~task_value() {
+                if(has)
+                    reinterpret_cast<R*>(&storage)->~R();
+            }
+            template<typename U>
+            void set(U&& value) {
+                ::new(static_cast<void*>(&storage)) R(std::forward<U>(value));
+                has = true;
+            }
+            R take() {
+                return std::move(*reinterpret_cast<R*>(&storage));
+            }
+        };
+
+        template<typename R>
+        class task_value<R&> {
+        private:
+            R *ptr = nullptr;
+        public:
+            void set(R& value) { ptr = std::addressof(value); }
+            R& take() { return *ptr; }
+        };
+
+        template<>
+        class task_value<void> {
+        public:
+            void set() {}
+            void take() {}
+        };
+
+        // C++14 还没有 std::apply
+        template<typename F, typename Tuple, size_t... I>
+        auto apply_tuple(F&& fun, Tuple&& args, std::index_sequence<I...>)
+            -> decltype(std::forward<F>(fun)(std::get<I>(std::forward<Tuple>(args))...)) {
+            return std::forward<F>(fun)(std::get<I>(std::forward<Tuple>(args))...);
+        }
+
+        template<typename F, typename Tuple>
+        auto apply_tuple(F&& fun, Tuple&& args)
+            -> decltype(apply_tuple(std::forward<F>(fun), std::forward<Tuple>(args),
+                    std::make_index_sequence<std::tuple_size<typename std::decay<Tuple>::type>::value>())) {
+            return apply_tuple(std::forward<F>(fun), std::forward<Tuple>(args),
+                    std::make_index_sequence<std::tuple_size<typename std::decay<Tuple>::type>::value>());
+        }
+
+        // promise 和 future 共享的状态
+        template<typename R>
+        class task_state final : boost::noncopyable {
+        public:
+            std::atomic<int> refs;
+            std::mutex mtx;
+            std::condition_variable cv;
+            bool ready;
+            std::exception_ptr error;
+            task_value<R> value;
+            std::shared_ptr<task_block_pool> owner;   // nullptr 表示是 new 出来的
+            task_executor executor;
+            unique_task continuation;                  // 由 mtx 保护
+            bool post_continuation;                    // true 交给 executor, false 就地执行
+
+            task_state(std::shared_ptr<task_block_pool> _owner, const task_executor& _executor)
+                : refs(2), ready(false), owner(std::move(_owner)), executor(_executor), post_continuation(false) {}
+
+            static task_state* create(const std::shared_ptr<task_block_pool>& owner, const task_executor& executor) {
+                if(owner == nullptr or sizeof(task_state) > task_block_pool::block_size
+                        or alignof(task_state) > alignof(std::max_align_t))
+                    return new task_state(nullptr, executor);
+                void *raw = owner->allocate();
+                return ::new(raw) task_state(owner, executor);
+            }
+
+            void release() noexcept {
+                if(refs.fetch_sub(1, std::memory_order_acq_rel) not_eq 1)
+                    return;
+                if(owner == nullptr) {
+                    delete this;
+                    return;
+                }
+                std::shared_ptr<task_block_pool> pool = std::move(owner);
+                this->~task_state();
+                pool->deallocate(this);
+            }
+
+            // 设置结果之后唤醒等待的一方, 再执行挂着的后续任务; 已经有结果就返回 false
+            template<typename Setter>
+            bool complete(Setter&& setter) {
+                unique_task next;
+                bool post = false;
+                {
+                    std::lock_guard<std::mutex> lck(mtx);
+                    if(ready)
+                        return false;
+                    setter();
+                    ready = true;
+                    next = std::move(continuation);
+                    post = post_continuation;
+                }
+                cv.notify_all();
+                if(next)
+                    resume(std::move(next), post);
+                return true;
+            }
+
+            template<typename Setter>
+            void finish(Setter&& setter) {
+                if(not complete(std::forward<Setter>(setter)))
+                    throw std::future_error(std::future_errc::promise_already_satisfied);
+            }
+
+            // 挂上后续任务, 已经就绪就马上执行; 一个共享状态只能挂一个
+            void attach(unique_task&& job, const bool post) {
+                {
+                    std::lock_guard<std::mutex> lck(mtx);
+                    if(continuation)
+                        throw std::future_error(std::future_errc::future_already_retrieved);
+                    if(not ready) {
+                        continuation = std::move(job);
+                        post_continuation = post;
+                        return;
+                    }
+                }
+                resume(std::move(job), post);
+            }
+
+            // 取下还没执行的后续任务, 在锁外销毁; 已经就绪的话后续任务已经被取走了
+            void detach() noexcept {
+                unique_task job;
+                std::lock_guard<std::mutex> lck(mtx);
+                if(not ready)
+                    job = std::move(continuation);
+            }
+
+            // job 执行完可能已经释放了这个共享状态, 之后不能再碰成员
+            void resume(unique_task&& job, const bool post) {
+                if(post and executor.post not_eq nullptr
+                        and (executor.gate == nullptr or executor.gate->enter())) {
+                    bool posted = false;
+                    try {
+                        executor.post(executor.context, std::move(job));
+                        posted = true;
+                    }
+                    catch(...) {
+                        // 线程池已经停止, 就地执行
+                    }
+                    if(executor.gate not_eq nullptr)
+                        executor.gate->leave();
+                    if(posted)
+                        return;
+                }
+                if(job)
+                    job();
+            }
+        };
+
+        struct future_access;
+    }
+
+    template<typename R>
+    class task_future;
+
+    template<typename R>
+    class task_promise final {
+    private:
+        detail::task_state<R> *state;
+
+        template<typename T>
+        friend class task_promise;
+
+    public:
+        task_promise() noexcept : state(nullptr) {}
+        explicit task_promise(detail::task_state<R> *_state) noexcept : state(_state) {}
+
+        task_promise(task_promise&& other) noexcept : state(other.state) {
+            other.state = nullptr;
+        }
+
+        task_promise& operator=(task_promise&& other) noexcept {
+            if(this not_eq &other) {
+                abandon();
+                state = other.state;
+                other.state = nullptr;
+            }
+            return *this;
+        }
+
+        ~task_promise() { abandon(); }
+
+        template<typename... U>
+        void set_value(U&&... value) {
+            state->finish([&]{ state->value.set(std::forward<U>(value)...); });
+        }
+
+        void set_exception(std::exception_ptr error) {
+            state->finish([&]{ state->error = error; });
+        }
+
+        // 执行 fun(args...), 把返回值或异常放进共享状态
+        template<typename F, typename Tuple>
+        void run(F&& fun, Tuple&& args) {
+            try {
+                run_impl(std::forward<F>(fun), std::forward<Tuple>(args), std::is_void<R>());
+            }
+            catch(...) {
+                set_exception(std::current_exception());
+            }
+        }
+
+    private:
+        template<typename F, typename Tuple>
+        void run_impl(F&& fun, Tuple&& args, std::true_type) {
+            detail::apply_tuple(std::forward<F>(fun), std::forward<Tuple>(args));
+            set_value();
+        }
+
+        template<typename F, typename Tuple>
+        void run_impl(F&& fun, Tuple&& args, std::false_type) {
+            set_value(detail::apply_tuple(std::forward<F>(fun), std::forward<Tuple>(args)));
+        }
+
+        void abandon() noexcept {
+            if(state == nullptr)
+                return;
+            state->complete([this]{
+                state->error = std::make_exception_ptr(
+                    std::future_error(std::future_errc::broken_promise));
+            });
+            state->release();
+            state = nullptr;
+        }
+
+        task_promise(const task_promise&) = delete;
+        task_promise& operator=(const task_promise&) = delete;
+    };
+
+    template<typename R>
+    class task_future final {
+    private:
+        detail::task_state<R> *state;
+
+        friend struct detail::future_access;
+
+    public:
+        task_future() noexcept : state(nullptr) {}
+        explicit task_future(detail::task_state<R> *_state) noexcept : state(_state) {}
+
+        task_future(task_future&& other) noexcept : state(other.state) {
+            other.state = nullptr;
+        }
+
+        task_future& operator=(task_future&& other) noexcept {
+            if(this not_eq &other) {
+                if(state not_eq nullptr)
+                    state->release();
+                state = other.state;
+                other.state = nullptr;
+            }
+            return *this;
+        }
+
+        ~task_future() {
+            if(state not_eq nullptr)
+                state->release();
+        }
+
+        bool valid() const noexcept {
+            return state not_eq nullptr;
+        }
+
+        bool is_ready() const {
+            std::lock_guard<std::mutex> lck(state->mtx);
+            return state->ready;
+        }
+
+        void wait() const {
+            std::unique_lock<std::mutex> lck(state->mtx);
+            state->cv.wait(lck, [this]{ return state->ready; });
+        }
+
+        template<typename Rep, typename Period>
+        std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+            std::unique_lock<std::mutex> lck(state->mtx);
+            return state->cv.wait_for(lck, timeout, [this]{ return state->ready; })
+                ? std::future_status::ready : std::future_status::timeout;
+        }
+
+        // 和 std::future 一样只能 get 一次, 之后 valid() 为 false
+        R get() {
+            if(state == nullptr)
+                throw std::future_error(std::future_errc::no_state);
+            wait();
+            detail::task_state<R> *one = state;
+            state = nullptr;
+            std::unique_ptr<detail::task_state<R>, void(*)(detail::task_state<R>*)> guard(
+                one, [](detail::task_state<R>* raw){ raw->release(); });
+            if(one->error)
+                std::rethrow_exception(one->error);
+            return one->value.take();
+        }
+
+        // 结果就绪后把 fun(这个 future) 交给线程池执行, 返回 fun 的结果的 future
+        // 调用之后这个 future 失效; fun 里调用 get() 不会阻塞, 异常也从那里抛出
+        template<typename F>
+        auto then(F&& fun)
+            -> task_future<typename std::result_of<typename std::decay<F>::type(task_future<R>)>::type>;
+
+    private:
+        task_future(const task_future&) = delete;
+        task_future& operator=(const task_future&) = delete;
+    };
+
+    // 一次分配（通常来自空闲链表）得到一对 promise / future
+    template<typename R>
+    std::pair< task_promise<R>, task_future<R> >
+    make_task_pair(const std::shared_ptr<task_block_pool>& pool, const task_executor& executor = task_executor()) {
+        detail::task_state<R> *state = detail::task_state<R>::create(pool, executor);
+        return std::make_pair(task_promise<R>(state), task_future<R>(state));
+    }
+
+    namespace detail {
+        // when_all / when_any 要用到共享状态, 但不应该成为 task_future 的公开接口
+        struct future_access {
+            template<typename R>
+            static task_state<R>* state(const task_future<R>& future) {
+                if(future.state == nullptr)
+                    throw std::future_error(std::future_errc::no_state);
+                return future.state;
+            }
+
+            // 新的共享状态和 from 用同一个空闲链表、同一个 executor
+            template<typename U, typename R>
+            static std::pair< task_promise<U>, task_future<U> > pair_like(const task_future<R> *from) {
+                if(from == nullptr)
+                    return make_task_pair<U>(nullptr);
+                return make_task_pair<U>(state(*from)->owner, state(*from)->executor);
+            }
+        };
+    }
+
+    template<typename R>
+    template<typename F>
+    auto task_future<R>::then(F&& fun)
+            -> task_future<typename std::result_of<typename std::decay<F>::type(task_future<R>)>::type> {
+        using return_type = typename std::result_of<typename std::decay<F>::type(task_future<R>)>::type;
+
+        detail::task_state<R> *one = detail::future_access::state(*this);
+        auto pair = detail::future_access::pair_like<return_type>(this);
+        one->attach(unique_task(
+            [promise = std::move(pair.first), fun = std::forward<F>(fun), self = std::move(*this)]() mutable {
+                promise.run(std::move(fun), std::make_tuple(std::move(self)));
+            }), true);
+        return std::move(pair.second);
+    }
+
+    // 全部就绪后, 返回的 future 里是原来的那些 future, 可以逐个 get
+    template<typename T>
+    task_future< std::vector< task_future<T> > > when_all(std::vector< task_future<T> > futures) {
+        using result_type = std::vector< task_future<T> >;
+        struct gather {
+            std::atomic<size_t> remaining;
+            result_type futures;
+            task_promise<result_type> promise;
+        };
+        auto pair = detail::future_access::pair_like<result_type>(futures.empty() ? nullptr : &futures.front());
+        auto shared = std::make_shared<gather>();
+        shared->remaining = futures.size() + 1;    // 多出来的 1 是自己, 挂完所有回调之前不能交出结果
+        shared->futures = std::move(futures);
+        shared->promise = std::move(pair.first);
+        const auto arrive = [](const std::shared_ptr<gather>& one) {
+            if(--one->remaining == 0)
+                one->promise.set_value(std::move(one->futures));
+        };
+        for(auto& it : shared->futures)
+            detail::future_access::state(it)->attach(unique_task([shared, arrive]{ arrive(shared); }), false);
+        arrive(shared);
+        return std::move(pair.second);
+    }
+
+    template<typename T>
+    struct when_any_result {
+        size_t index;                              // 第一个就绪的下标, 输入为空时是 size_t(-1)
+        std::vector< task_future<T> > futures;
+    };
+
+    // 任意一个就绪就返回, 其余的 future 原样交回
+    template<typename T>
+    task_future< when_any_result<T> > when_any(std::vector< task_future<T> > futures) {
+        using result_type = when_any_result<T>;
+        struct race {
+            std::atomic<int> stage;          // 挂回调 + 出现第一个, 两件事都完成才交出结果
+            std::atomic<bool> fired;
+            size_t index;
+            std::vector< task_future<T> > futures;
+            task_promise<result_type> promise;
+        };
+        auto pair = detail::future_access::pair_like<result_type>(futures.empty() ? nullptr : &futures.front());
+        auto shared = std::make_shared<race>();
+        shared->stage = futures.empty() ? 1 : 2;
+        shared->fired = false;
+        shared->index = size_t(-1);
+        shared->futures = std::move(futures);
+        shared->promise = std::move(pair.first);
+        // 回调都挂完了才会走到 0, 这时取下其余 future 上的回调
+        const auto advance = [](const std::shared_ptr<race>& one) {
+            if(--one->stage not_eq 0)
+                return;
+            for(size_t i = 0;i < one->futures.size(); ++i)
+                if(i not_eq one->index)
+                    detail::future_access::state(one->futures[i])->detach();
+            one->promise.set_value(result_type{ one->index, std::move(one->futures) });
+        };
+        for(size_t i = 0;i < shared->futures.size(); ++i) {
+            detail::future_access::state(shared->futures[i])->attach(unique_task([shared, advance, i]{
+                if(shared->fired.exchange(true))
+                    return;
+                shared->index = i;
+                advance(shared);
+            }), false);
+        }
+        advance(shared);
+        return std::move(pair.second);
+    }
+
+}
+
+#endif // TASK_FUTURE_H
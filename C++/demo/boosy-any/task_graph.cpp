@@ -0,0 +1,173 @@
+#include "task_graph.h"
+#include <stdexcept>
+
+YHL::task_graph::task_graph()
+    : capacity(0), checked(true), pool(nullptr), unfinished(0), failed(false), running(false) {}
+
+YHL::task_graph::~task_graph() {
+    std::unique_lock<std::mutex> lck(this->mtx);
+    this->cv.wait(lck, [this]{ return not this->running; });
+}
+
+YHL::task_graph::node_id YHL::task_graph::add(std::function<void()> fun) {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(this->running)
+        throw std::logic_error("modify task_graph while it is running\n");
+    this->nodes.emplace_back();
+    this->nodes.back().fun = std::move(fun);
+    this->checked = false;
+    return this->nodes.size() - 1;
+}
+
+void YHL::task_graph::precede(const node_id before, const node_id after) {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(this->running)
+        throw std::logic_error("modify task_graph while it is running\n");
+    if(before >= this->nodes.size() or after >= this->nodes.size())
+        throw std::out_of_range("no such node in task_graph\n");
+    this->nodes[before].successors.emplace_back(after);
+    ++this->nodes[after].predecessors;
+    this->checked = false;
+}
+
+// Kahn 拓扑排序, 排不完说明有环
+void YHL::task_graph::check() {
+    if(this->checked)
+        return;
+    std::vector<size_t> degree(this->nodes.size());
+    std::vector<node_id> ready;
+    for(node_id i = 0;i < this->nodes.size(); ++i) {
+        degree[i] = this->nodes[i].predecessors;
+        if(degree[i] == 0)
+            ready.emplace_back(i);
+    }
+    size_t visited = 0;
+    while(not ready.empty()) {
+        const node_id one = ready.back();
+        ready.pop_back();
+        ++visited;
+        for(const node_id next : this->nodes[one].successors) {
+            if(--degree[next] == 0)
+                ready.emplace_back(next);
+        }
+    }
+    if(visited not_eq this->nodes.size())
+        throw std::logic_error("task_graph has a cycle\n");
+    this->checked = true;
+}
+
+YHL::task_future<void> YHL::task_graph::launch(thread_pool& executor) {
+    auto pair = make_task_pair<void>(nullptr);
+    {
+        std::lock_guard<std::mutex> lck(this->mtx);
+        if(this->running)
+            throw std::logic_error("task_graph is already running\n");
+        this->check();
+        if(this->nodes.empty()) {
+            pair.first.set_value();
+            return std::move(pair.second);
+        }
+        if(this->capacity < this->nodes.size()) {
+            this->remaining.reset(new std::atomic<size_t>[this->nodes.size()]);
+            this->capacity = this->nodes.size();
+        }
+        for(node_id i = 0;i < this->nodes.size(); ++i)
+            this->remaining[i].store(this->nodes[i].predecessors, std::memory_order_relaxed);
+        this->pool = &executor;
+        this->unfinished.store(this->nodes.size());
+        this->failed = false;
+        this->error = nullptr;
+        this->promise = std::move(pair.first);
+        this->running = true;
+    }
+
+    // 先数好根节点再提交, 提交出去的节点可能马上就把整张图跑完
+    std::vector<node_id> roots;
+    for(node_id i = 0;i < this->nodes.size(); ++i) {
+        if(this->nodes[i].predecessors == 0)
+            roots.emplace_back(i);
+    }
+    for(const node_id one : roots)
+        this->post_node(one);
+    return std::move(pair.second);
+}
+
+// 节点交给线程池 : 提交失败（线程池停止、有界队列满了）或者排队时被丢掉, 包装析构时按失败把它数完
+void YHL::task_graph::post_node(const node_id one) {
+    try {
+        this->pool->post(detail::make_abandonable(
+            [this, one]{ this->execute(one); },
+            [this, one]{ this->abandon(one); }));
+    }
+    catch(...) {
+        // 包装析构时已经调用了 abandon, 这次启动的 future 里是 broken_promise
+    }
+}
+
+// 在析构函数里调用, 不能抛异常; 之后的节点都不再执行, 只把计数减完
+void YHL::task_graph::abandon(const node_id one) noexcept {
+    {
+        std::lock_guard<std::mutex> lck(this->mtx);
+        if(not this->error)
+            this->error = std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+        this->failed = true;
+    }
+    this->execute(one);
+}
+
+void YHL::task_graph::execute(node_id one) {
+    std::vector<node_id> skipped;     // 失败之后就绪的节点不再提交, 留在这里直接数完
+    while(one not_eq node_id(-1)) {
+        node& cur = this->nodes[one];
+        if(not this->failed.load(std::memory_order_relaxed)) {
+            try {
+                cur.fun();
+            }
+            catch(...) {
+                std::lock_guard<std::mutex> lck(this->mtx);
+                if(not this->error)
+                    this->error = std::current_exception();
+                this->failed = true;
+            }
+        }
+
+        // 就绪的后继 : 第一个留给自己, 其余交给线程池
+        node_id next = node_id(-1);
+        for(const node_id succ : cur.successors) {
+            if(this->remaining[succ].fetch_sub(1, std::memory_order_acq_rel) not_eq 1)
+                continue;
+            if(next == node_id(-1))
+                next = succ;
+            else if(this->failed.load(std::memory_order_relaxed))
+                skipped.emplace_back(succ);
+            else
+                this->post_node(succ);
+        }
+        if(this->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            this->finish();
+            return;
+        }
+        if(next == node_id(-1) and not skipped.empty()) {
+            next = skipped.back();
+            skipped.pop_back();
+        }
+        one = next;
+    }
+}
+
+// 最后一个节点完成 : 先交出结果, 再允许析构或者下一次启动
+void YHL::task_graph::finish() {
+    task_promise<void> done;
+    std::exception_ptr first;
+    {
+        std::lock_guard<std::mutex> lck(this->mtx);
+        done = std::move(this->promise);
+        first = this->error;
+        this->running = false;
+        this->cv.notify_all();
+    }
+    if(first)
+        done.set_exception(first);
+    else
+        done.set_value();
+}
@@ -0,0 +1,91 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+#include "threadpool.h"
+
+/* 使用说明
+    YHL::task_graph graph;
+    auto extract = graph.add([]{ std::cout << "extract\n"; });
+    auto clean   = graph.add([]{ std::cout << "clean\n"; });
+    auto index   = graph.add([]{ std::cout << "index\n"; });
+    auto load    = graph.add([]{ std::cout << "load\n"; });
+    graph.precede(extract, clean);      // clean 依赖 extract
+    graph.precede(extract, index);
+    graph.precede(clean, load);
+    graph.precede(index, load);         // clean 和 index 可以并行, 都完成后才 load
+
+    YHL::thread_pool pool(4);
+    for(int night = 0;night < 7; ++night)
+        graph.launch(pool).get();       // 建一次, 跑很多次
+ */
+
+/*
+ * 注意事项
+ * 1. 每个节点一个原子计数器, 启动时置为前驱的个数; 前驱完成时减一, 减到 0 的节点马上可以执行
+ * 2. 一个节点完成后, 就绪的后继里留一个在当前线程上接着执行, 其余的交给线程池, 链状的图不用反复进出队列
+ * 3. 第一次启动（以及改过图之后）用拓扑排序检查环, 有环就抛出 std::logic_error
+ * 4. 某个节点抛出异常后, 还没开始的节点不再执行（但计数照常进行）, 异常放进 launch 返回的 future
+ * 5. 同一个图不能同时启动两次; 运行期间不能修改图; 析构时会等正在运行的那一次结束
+ * 6. 节点没能交给线程池（线程池已经停止、有界队列满了）或者排队时被丢掉（shutdown、drop_oldest）, 按 4 处理,
+ *    future 里是 std::future_error(broken_promise); 这一次照样会结束, 之后可以再启动
+ */
+
+namespace YHL {
+
+    class task_graph final : boost::noncopyable {
+    public:
+        using node_id = size_t;
+
+    private:
+        struct node {
+            std::function<void()> fun;
+            std::vector<node_id> successors;
+            size_t predecessors = 0;
+        };
+
+        std::vector<node> nodes;
+        std::unique_ptr< std::atomic<size_t>[] > remaining;   // 本次启动里每个节点还差几个前驱
+        size_t capacity;
+        bool checked;                                          // 改图之后要重新检查环
+
+        // 本次启动的状态
+        thread_pool *pool;
+        std::atomic<size_t> unfinished;
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+        task_promise<void> promise;
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool running;
+
+        void check();
+        void post_node(const node_id);
+        void abandon(const node_id) noexcept;
+        void execute(node_id);
+        void finish();
+
+    public:
+        task_graph();
+        ~task_graph();
+
+        node_id add(std::function<void()> fun);
+
+        // before 完成之后才能开始 after
+        void precede(const node_id before, const node_id after);
+
+        size_t size() const noexcept { return nodes.size(); }
+
+        // 把所有没有前驱的节点交给线程池, 全部节点完成后返回的 future 就绪
+        task_future<void> launch(thread_pool&);
+    };
+
+}
+
+#endif // TASK_GRAPH_H
@@ -0,0 +1,43 @@
+#include "task_group.h"
+
+YHL::task_group::task_group(thread_pool& _pool)
+    : pool(_pool), pending(0) {}
+
+YHL::task_group::~task_group() {
+    this->help();
+}
+
+// 计数在锁里减, 等待方拿到锁之后才会返回并析构这个组
+void YHL::task_group::finish_one() {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(--this->pending == 0)
+        this->cv.notify_all();
+}
+
+void YHL::task_group::fail(std::exception_ptr one) noexcept {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(not this->error)
+        this->error = std::move(one);
+}
+
+void YHL::task_group::help() {
+    while(this->pending.load() > 0) {
+        if(this->pool.try_run_one())
+            continue;
+        // 组里剩下的任务正在别的线程上执行, 它们还可能拆出新的子任务, 所以只等一小会
+        std::unique_lock<std::mutex> lck(this->mtx);
+        this->cv.wait_for(lck, std::chrono::microseconds(200), [this]{ return this->pending.load() == 0; });
+    }
+    std::lock_guard<std::mutex> lck(this->mtx);
+}
+
+void YHL::task_group::wait() {
+    this->help();
+    std::exception_ptr first;
+    {
+        std::lock_guard<std::mutex> lck(this->mtx);
+        std::swap(first, this->error);
+    }
+    if(first)
+        std::rethrow_exception(first);
+}
@@ -0,0 +1,88 @@
+#ifndef TASK_GROUP_H
+#define TASK_GROUP_H
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <exception>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+#include "threadpool.h"
+
+/* 使用说明
+    YHL::thread_pool pool(4);
+
+    // 递归的分治 : 子任务交给线程池, 等待的时候顺手执行队列里的任务
+    std::function<long(int)> fib = [&](int n) -> long {
+        if(n < 20)
+            return serial_fib(n);
+        long left = 0;
+        YHL::task_group group(pool);
+        group.run([&]{ left = fib(n - 1); });
+        const long right = fib(n - 2);
+        group.wait();
+        return left + right;
+    };
+    std::cout << pool.submit(fib, 35).get() << "\n";
+ */
+
+/*
+ * 注意事项
+ * 1. 任务里 enqueue 子任务再 get(), 这个线程就睡着了; 嵌套得够深, 所有线程都在等还在排队的任务, 整个线程池死锁
+ * 2. task_group::wait 不睡眠, 而是调用 thread_pool::try_run_one 执行排队的任务, 直到组里的任务都完成;
+ *    工作窃取模式下先拿自己队列尾部的任务, 通常就是刚刚 run 进去的子任务
+ * 3. 队列里没有任务, 但是组里的任务还在别的线程上执行, 才短暂地等一下, 然后再看队列
+ * 4. wait 可能顺手执行别的组的任务, 所以 wait 返回的时间可能比组里的任务完成得晚
+ * 5. 组里第一个异常在 wait 里重新抛出; 析构时会等所有任务完成, 但不再抛出异常
+ * 6. 还没执行就被线程池丢掉的任务（shutdown、drop_oldest）也算完成, wait 里抛出 std::future_error(broken_promise);
+ *    run 本身抛出异常时（线程池已经停止、有界队列满了）同样记一个 broken_promise
+ */
+
+namespace YHL {
+
+    class task_group final : boost::noncopyable {
+    private:
+        thread_pool& pool;
+        std::atomic<size_t> pending;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::exception_ptr error;     // 由 mtx 保护
+
+        void finish_one();
+        void fail(std::exception_ptr) noexcept;
+        void help();
+
+    public:
+        explicit task_group(thread_pool& _pool);
+        ~task_group();
+
+        template<typename F>
+        void run(F&& fun);
+
+        // 边等边干活, 返回时组里的任务全部完成
+        void wait();
+    };
+
+    template<typename F>
+    void task_group::run(F&& fun) {
+        ++this->pending;
+        // 提交时抛出异常, 或者排队时被线程池丢掉, 包装析构时记一个 broken_promise 并把计数减掉
+        this->pool.post(detail::make_abandonable(
+            [this, fun = std::forward<F>(fun)]() mutable {
+                try {
+                    auto body = std::move(fun);    // 在计数减一之前析构, 它可能引用着等待方的栈
+                    body();
+                }
+                catch(...) {
+                    this->fail(std::current_exception());
+                }
+                this->finish_one();
+            },
+            [this]{
+                this->fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+                this->finish_one();
+            }));
+    }
+
+}
+
+#endif // TASK_GROUP_H
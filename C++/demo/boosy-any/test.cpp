@@ -2,6 +2,47 @@
 #include <fstream>
 #include <string>
 #include <list>
+#include <cstdlib>
+#include <new>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <sys/stat.h>
+#include <sched.h>
+#include <ctime>
+
+// 统计全局 operator new 的调用次数, 给 testTaskAllocation 用; 只在 allocation_scope 里计数, 别的测试不受影响
+// 不让编译器内联, 否则它会看到 malloc 配 delete 而误报 -Wmismatched-new-delete
+namespace {
+    std::atomic<bool> counting(false);
+    std::atomic<size_t> allocations(0);
+
+    // 作用域内所有线程的 operator new 都计数
+    class allocation_scope {
+    private:
+        const size_t before;
+    public:
+        allocation_scope() : before(allocations.load()) { counting = true; }
+        ~allocation_scope() { counting = false; }
+        size_t count() const { return allocations.load() - before; }
+    };
+}
+
+__attribute__((noinline)) void* operator new(std::size_t size) {
+    if(counting.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void *raw = std::malloc(size == 0 ? 1 : size))
+        return raw;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *raw) noexcept {
+    std::free(raw);
+}
+
+__attribute__((noinline)) void operator delete(void *raw, std::size_t) noexcept {
+    std::free(raw);
+}
 
 int test::cnt = 0;
 std::mutex test::m;
@@ -259,3 +300,2073 @@ void test::testSingletonCtor () {
         std::cout << it.get () << std::endl;
     }
 }
+
+namespace {
+    // 在给定模式和线程数下, 分别跑空任务和 fan-out/fan-in 任务, 返回每秒完成的任务数
+    double emptyTasksPerSecond(const YHL::schedule_mode mode, const size_t threads, const int total) {
+        YHL::pool_options options;
+        options.mode = mode;
+        YHL::thread_pool pool(threads, options);
+
+        std::atomic<int> done(0);
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0;i < total; ++i)
+            pool.enqueue([&done]{ ++done; });
+        while(done.load() < total)
+            std::this_thread::yield();
+        std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+        return total / cost.count();
+    }
+
+    double fanOutTasksPerSecond(const YHL::schedule_mode mode, const size_t threads,
+                                const int roots, const int children) {
+        YHL::pool_options options;
+        options.mode = mode;
+        YHL::thread_pool pool(threads, options);
+
+        const int total = roots * children;
+        std::atomic<int> done(0);
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0;i < roots; ++i) {
+            pool.enqueue([&pool, &done, children]{
+                for(int j = 0;j < children; ++j)   // 在工作线程里提交子任务
+                    pool.enqueue([&done]{ ++done; });
+            });
+        }
+        while(done.load() < total)                  // fan-in
+            std::this_thread::yield();
+        std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+        return total / cost.count();
+    }
+}
+
+namespace {
+    void busyFor(const std::chrono::microseconds cost) {
+        const auto until = std::chrono::steady_clock::now() + cost;
+        while(std::chrono::steady_clock::now() < until)
+            ;
+    }
+
+    // 返回排序后第 percent% 个值
+    double percentile(std::vector<double> samples, const double percent) {
+        if(samples.empty())
+            return 0;
+        std::sort(samples.begin(), samples.end());
+        const size_t index = static_cast<size_t>(percent / 100 * (samples.size() - 1));
+        return samples[index];
+    }
+}
+
+void test::benchWorkStealing () {
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> counts;
+    for(size_t n = 1;n < cores; n *= 2)
+        counts.emplace_back(n);
+    counts.emplace_back(cores);
+
+    const std::pair<YHL::schedule_mode, const char*> modes[] = {
+        { YHL::schedule_mode::shared_queue, "shared_queue " },
+        { YHL::schedule_mode::work_stealing, "work_stealing" }
+    };
+    for(const auto& mode : modes) {
+        for(const auto threads : counts) {
+            std::cout << mode.second << "  threads : " << threads
+                      << "\tempty  : " << static_cast<long>(emptyTasksPerSecond(mode.first, threads, 200000))
+                      << " /s\tfan-out : " << static_cast<long>(fanOutTasksPerSecond(mode.first, threads, 64, 2000))
+                      << " /s\n";
+        }
+    }
+}
+
+void test::benchLockFreeQueue () {
+    // 多个生产者同时提交空任务, 对比共享锁队列和无锁有界队列
+    const int producers = 4, per_producer = 50000;
+    const int total = producers * per_producer;
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency());
+
+    const std::pair<YHL::schedule_mode, const char*> modes[] = {
+        { YHL::schedule_mode::shared_queue, "shared_queue   " },
+        { YHL::schedule_mode::lock_free_queue, "lock_free_queue" }
+    };
+    for(const auto& mode : modes) {
+        YHL::pool_options options;
+        options.mode = mode.first;
+        options.queue_capacity = 8192;
+        YHL::thread_pool pool(threads, options);
+
+        std::atomic<int> done(0);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> submitters;
+        for(int i = 0;i < producers; ++i) {
+            submitters.emplace_back([&pool, &done]{
+                for(int j = 0;j < per_producer; ++j)
+                    pool.enqueue([&done]{ ++done; });
+            });
+        }
+        for(auto& it : submitters)
+            it.join();
+        std::chrono::duration<double> submit = std::chrono::steady_clock::now() - start;
+        while(done.load() < total)
+            std::this_thread::yield();
+        std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+
+        std::cout << mode.second << "  producers : " << producers
+                  << "\tsubmit : " << submit.count() * 1e9 / total << " ns/task"
+                  << "\ttotal : " << static_cast<long>(total / cost.count()) << " /s\n";
+    }
+}
+
+void test::testTaskAllocation () {
+    // 默认的 shared_queue 用环形缓冲, lock_free_queue 的槽位预先分配好, 热身之后统计到的就只有任务本身的分配
+    const std::pair<YHL::schedule_mode, const char*> modes[] = {
+        { YHL::schedule_mode::shared_queue,    "shared_queue   " },
+        { YHL::schedule_mode::lock_free_queue, "lock_free_queue" },
+    };
+    bool zero = true;
+    for(const auto& mode : modes) {
+        YHL::pool_options options;
+        options.mode = mode.first;
+        options.queue_capacity = 4096;
+        YHL::thread_pool pool(2, options);
+
+        const int total = 1000;
+        std::vector< YHL::task_future<int> > answers;
+        answers.reserve(total);
+        std::vector< std::future<int> > olds;
+        olds.reserve(total);
+
+        auto round = [&]{
+            for(int i = 0;i < total; ++i)
+                answers.emplace_back(pool.submit([](int x){ return x + 1; }, i));
+            long sum = 0;
+            for(auto& it : answers)
+                sum += it.get();
+            answers.clear();
+            return sum;
+        };
+        // 预热不靠运气 : 共享状态先备好两轮的量（上一轮的 promise 可能还没放手）;
+        // 两个线程都被占住时整轮提交, 全局环形缓冲一次扩到峰值; 批量缓冲在线程登记队列时已经备好
+        pool.reserve_futures(2 * total);
+        {
+            std::atomic<int> started(0);
+            std::atomic<bool> release(false);
+            for(int i = 0;i < 2; ++i)
+                pool.post([&]{
+                    ++started;
+                    while(not release.load())
+                        std::this_thread::yield();
+                });
+            while(started.load() < 2)
+                std::this_thread::yield();
+            for(int i = 0;i < total; ++i)
+                answers.emplace_back(pool.submit([](int x){ return x + 1; }, i));
+            release = true;
+            for(auto& it : answers)
+                it.get();
+            answers.clear();
+        }
+        // 再跑到一轮不分配为止, 剩下的只可能是线程局部的一次性分配
+        for(int warm = 0;warm < 10; ++warm) {
+            allocation_scope scope;
+            round();
+            if(scope.count() == 0)
+                break;
+        }
+
+        const int rounds = 5;
+        long sum = 0;
+        size_t submit_cost = 0, enqueue_cost = 0;
+        {
+            allocation_scope scope;
+            for(int i = 0;i < rounds; ++i)
+                sum += round();
+            submit_cost = scope.count();
+        }
+        {
+            allocation_scope scope;
+            for(int i = 0;i < total; ++i)
+                olds.emplace_back(pool.enqueue([](int x){ return x + 1; }, i));
+            for(auto& it : olds)
+                it.get();
+            enqueue_cost = scope.count();
+        }
+        zero = zero and submit_cost == 0;
+
+        std::cout << mode.second << "  sum  :  " << sum
+                  << "\tsubmit mallocs per task  :  " << static_cast<double>(submit_cost) / (rounds * total)
+                  << "\tenqueue mallocs per task  :  " << static_cast<double>(enqueue_cost) / total << "\n";
+    }
+    std::cout << (zero ? "Success !\n" : "Failed : submit allocates\n");
+}
+
+void test::benchPost () {
+    // 同样的空任务, 分别用 enqueue / submit / post 提交, 比较每个任务的开销
+    const int total = 200000;
+    YHL::thread_pool pool(std::max(1u, std::thread::hardware_concurrency()));
+
+    std::atomic<int> done(0);
+    auto measure = [&](const char* name, const std::function<void()>& submitAll) {
+        done = 0;
+        auto start = std::chrono::steady_clock::now();
+        submitAll();
+        while(done.load() < total)
+            std::this_thread::yield();
+        std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+        std::cout << name << "  :  " << cost.count() * 1e9 / total << " ns/task\n";
+    };
+
+    measure("enqueue", [&]{
+        for(int i = 0;i < total; ++i)
+            pool.enqueue([&done]{ ++done; });
+    });
+    measure("submit ", [&]{
+        for(int i = 0;i < total; ++i)
+            pool.submit([&done]{ ++done; });
+    });
+    measure("post   ", [&]{
+        for(int i = 0;i < total; ++i)
+            pool.post([&done]{ ++done; });
+    });
+
+    // 异常不会悄悄丢掉
+    std::atomic<int> errors(0);
+    pool.set_exception_handler([&errors](std::exception_ptr){ ++errors; });
+    pool.post([]{ throw std::runtime_error("lost ?"); });
+    pool.post([&done](int x){ done += x; }, 1);
+    while(errors.load() == 0)
+        std::this_thread::yield();
+    std::cout << "errors reported  :  " << errors.load() << "\n";
+}
+
+void test::benchBulkSubmit () {
+    // 一批 10000 个任务, 逐个 enqueue 和 enqueue_bulk / post_bulk 的提交开销
+    const int total = 10000, rounds = 20;
+    YHL::thread_pool pool(std::max(1u, std::thread::hardware_concurrency()));
+
+    std::atomic<int> done(0);
+    std::vector< std::function<void()> > batch(total, [&done]{ ++done; });
+
+    auto measure = [&](const char* name, const std::function<void()>& submitAll) {
+        double submit = 0;
+        for(int r = 0;r < rounds; ++r) {
+            done = 0;
+            auto start = std::chrono::steady_clock::now();
+            submitAll();
+            submit += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            while(done.load() < total)
+                std::this_thread::yield();
+        }
+        std::cout << name << "  submit  :  " << submit * 1e9 / (total * rounds) << " ns/task\n";
+    };
+
+    measure("enqueue x N ", [&]{
+        std::vector< std::future<void> > res;
+        for(auto& it : batch)
+            res.emplace_back(pool.enqueue(it));
+    });
+    measure("enqueue_bulk", [&]{
+        auto res = pool.enqueue_bulk(batch.begin(), batch.end());
+    });
+    measure("post x N    ", [&]{
+        for(auto& it : batch)
+            pool.post(it);
+    });
+    measure("post_bulk   ", [&]{
+        pool.post_bulk(batch.begin(), batch.end());
+    });
+
+    done = 0;
+    auto all_done = pool.post_bulk(batch.begin(), batch.end());
+    all_done.get();
+    std::cout << "post_bulk finished  :  " << done.load() << "\n";
+}
+
+void test::benchParallel () {
+    YHL::thread_pool pool(std::max(1u, std::thread::hardware_concurrency()));
+    const size_t n = 1 << 22, grain = 1 << 14;
+    std::vector<double> data(n);
+    YHL::parallel_for(pool, size_t(0), n, grain, [&data](size_t i){ data[i] = static_cast<double>(i % 7); });
+
+    auto timeIt = [](const char* name, const std::function<double()>& fun) {
+        auto start = std::chrono::steady_clock::now();
+        const double res = fun();
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        std::cout << name << "  :  " << cost.count() << " ms\tresult : " << res << "\n";
+    };
+    auto plus = [](double a, double b){ return a + b; };
+    auto heavy = [](size_t i){ return std::sqrt(static_cast<double>(i)) * std::sin(static_cast<double>(i)); };
+
+    // 以前的写法 : 手动切块, 每块 enqueue 一次, 再逐个 get()
+    auto handWritten = [&](const std::function<double(size_t)>& map) {
+        std::vector< std::future<double> > parts;
+        for(size_t first = 0;first < n; first += grain) {
+            parts.emplace_back(pool.enqueue([&map, first, grain, n]{
+                double local = 0;
+                for(size_t i = first;i < std::min(n, first + grain); ++i)
+                    local += map(i);
+                return local;
+            }));
+        }
+        double res = 0;
+        for(auto& it : parts)
+            res += it.get();
+        return res;
+    };
+
+    std::cout << "----------- 访存密集 : 数组求和 -----------\n";
+    timeIt("serial         ", [&]{ double res = 0; for(auto x : data) res += x; return res; });
+    timeIt("enqueue + get  ", [&]{ return handWritten([&data](size_t i){ return data[i]; }); });
+    timeIt("parallel_reduce", [&]{
+        return YHL::parallel_reduce(pool, size_t(0), n, grain, 0.0, [&data](size_t i){ return data[i]; }, plus);
+    });
+
+    std::cout << "----------- 计算密集 : sqrt * sin -----------\n";
+    timeIt("serial         ", [&]{ double res = 0; for(size_t i = 0;i < n; ++i) res += heavy(i); return res; });
+    timeIt("enqueue + get  ", [&]{ return handWritten(heavy); });
+    timeIt("parallel_reduce", [&]{ return YHL::parallel_reduce(pool, size_t(0), n, grain, 0.0, heavy, plus); });
+
+    std::vector<double> squares(n);
+    timeIt("parallel_transform", [&]{
+        YHL::parallel_transform(pool, data.begin(), data.end(), squares.begin(), grain,
+                                [](double x){ return x * x; });
+        return squares[n - 1];
+    });
+
+    try {
+        YHL::parallel_for(pool, 0, 1000, 10, [](int i){
+            if(i == 500)
+                throw std::runtime_error("parallel_for failed at 500");
+        });
+    }
+    catch(const std::exception& e) {
+        std::cout << "caught  :  " << e.what() << "\n";
+    }
+
+    // 帮手提交不进去 : 有界队列满了（reject）或者线程池已经停止, 调用线程自己做完
+    YHL::pool_options bounded;
+    bounded.max_queued = 1;
+    bounded.overflow = YHL::overflow_policy::reject;
+    YHL::thread_pool full(2, bounded);
+    std::atomic<bool> release(false);
+    std::atomic<int> busy(0);
+    for(int i = 0;i < 2; ++i) {
+        full.post([&release, &busy]{
+            ++busy;
+            while(not release.load())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+        while(busy.load() <= i)
+            std::this_thread::yield();
+    }
+    full.post([]{});       // 占住唯一的空位
+    std::atomic<long> covered(0);
+    YHL::parallel_for(full, 0, 1000, 10, [&covered](int i){ covered += i; });
+    release = true;
+    full.shutdown();
+    YHL::parallel_for(full, 0, 1000, 10, [&covered](int i){ covered += i; });
+    std::cout << "parallel_for without helpers  :  " << (covered.load() == 2 * 499500 ? "ok" : "WRONG") << "\n";
+}
+
+void test::benchPriority () {
+    // 线程池被大量批处理任务占满时, 关键任务从提交到开始执行要等多久
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    const int background = static_cast<int>(threads) * 400, critical = 200;
+
+    auto run = [&](const char* name, const YHL::task_priority batch, const YHL::task_priority urgent) {
+        YHL::thread_pool pool(threads);
+        std::atomic<int> done(0);
+        for(int i = 0;i < background; ++i)
+            pool.post_with_priority(batch, [&done]{ busyFor(std::chrono::microseconds(200)); ++done; });
+
+        std::vector<double> delays(critical);
+        std::atomic<int> finished(0);
+        for(int i = 0;i < critical; ++i) {
+            const auto submitted = std::chrono::steady_clock::now();
+            pool.post_with_priority(urgent, [&delays, &finished, submitted, i]{
+                std::chrono::duration<double, std::micro> wait = std::chrono::steady_clock::now() - submitted;
+                delays[i] = wait.count();
+                ++finished;
+            });
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+        while(finished.load() < critical or done.load() < background)
+            std::this_thread::yield();
+        std::cout << name << "  p50 : " << percentile(delays, 50) << " us"
+                  << "\tp99 : " << percentile(delays, 99) << " us\n";
+    };
+    run("single FIFO        ", YHL::task_priority::normal, YHL::task_priority::normal);
+    run("low batch, high req", YHL::task_priority::low, YHL::task_priority::high);
+}
+
+void test::testTimerWheel () {
+    YHL::thread_pool pool(2);
+
+    // 先插入的不一定先执行, 按到期时间排序
+    std::mutex order_mtx;
+    std::vector<int> order;
+    auto record = [&order_mtx, &order](int id) {
+        return [&order_mtx, &order, id]{
+            std::lock_guard<std::mutex> lck(order_mtx);
+            order.emplace_back(id);
+        };
+    };
+    pool.schedule_after(std::chrono::milliseconds(30), record(30));
+    pool.schedule_after(std::chrono::milliseconds(10), record(10));
+    pool.schedule_at(std::chrono::system_clock::now() + std::chrono::milliseconds(20), record(20));
+    auto cancelled = pool.schedule_after(std::chrono::milliseconds(15), record(15));
+    std::cout << "cancel pending  :  " << std::boolalpha << cancelled.cancel() << "\n";
+
+    std::atomic<int> ticks(0);
+    auto every = pool.schedule_every(std::chrono::milliseconds(5), [&ticks]{ ++ticks; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    every.cancel();
+    const int stopped_at = ticks.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    std::cout << "order  :  ";
+    for(auto id : order)
+        std::cout << id << "  ";
+    std::cout << "\nperiodic ticks in 60ms  :  " << stopped_at
+              << "\tafter cancel  :  " << ticks.load() - stopped_at << "\n";
+
+    // 一百万个定时器的插入和取消开销
+    const int total = 1000000;
+    std::mt19937 gen(1229);
+    std::uniform_int_distribution<int> delay(1000, 3600 * 1000);
+    std::vector<YHL::timer_handle> handles;
+    handles.reserve(total);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0;i < total; ++i)
+        handles.emplace_back(pool.schedule_after(std::chrono::milliseconds(delay(gen)), []{}));
+    std::chrono::duration<double> insert = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    size_t removed = 0;
+    for(auto& it : handles)
+        removed += it.cancel();
+    std::chrono::duration<double> cancel = std::chrono::steady_clock::now() - start;
+    std::cout << "insert  :  " << insert.count() * 1e9 / total << " ns/timer"
+              << "\tcancel  :  " << cancel.count() * 1e9 / total << " ns/timer"
+              << "\tremoved  :  " << removed << "\n";
+
+    // 只能转移的定时任务 : 一次性的交出 promise, 周期的每次调用同一个对象
+    std::promise<int> fired;
+    auto answer = fired.get_future();
+    pool.schedule_after(std::chrono::milliseconds(5), [promise = std::move(fired)]() mutable { promise.set_value(42); });
+    std::unique_ptr<std::atomic<int>> counter(new std::atomic<int>(0));
+    std::atomic<int> *seen = counter.get();
+    auto repeat = pool.schedule_every(std::chrono::milliseconds(2), [own = std::move(counter)]{ ++*own; });
+    const int value = answer.get();
+    while(seen->load() < 3)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    repeat.cancel();
+    std::cout << "move-only timers  :  " << value << "\tticks  :  " << (seen->load() >= 3 ? "ok" : "WRONG") << "\n";
+
+    // 每 2ms 触发一次, 每次执行 7ms : 执行期间到期的跳过, 同一个对象不会被两个线程同时调用
+    std::atomic<int> inside(0), overlapped(0), runs(0);
+    auto slow = pool.schedule_every(std::chrono::milliseconds(2), [&, calls = 0]() mutable {
+        if(++inside > 1)
+            ++overlapped;
+        ++calls;            // 没有保护的状态, 重叠执行就是数据竞争
+        std::this_thread::sleep_for(std::chrono::milliseconds(7));
+        runs = calls;
+        --inside;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    slow.cancel();
+    while(inside.load() > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::cout << "slow periodic  :  runs  :  " << runs.load() << "\toverlapped  :  " << overlapped.load() << "\n";
+}
+
+void test::testElasticPool () {
+    YHL::pool_options options;
+    options.min_threads = 1;
+    options.max_threads = 8;
+    options.idle_timeout = std::chrono::milliseconds(50);
+    options.spawn_delay = std::chrono::milliseconds(2);
+
+    // 回放一段突发流量 : 每 250us 到达 rate 个 1ms 的任务, 需要大约 4 * rate 个线程
+    // 每一段记录线程数的峰值和段末的线程数
+    struct phase { const char *name; int rate; int millis; };
+    const phase trace[] = {
+        { "idle", 0, 100 }, { "burst 4/ms", 1, 150 }, { "idle", 0, 300 },
+        { "burst 8/ms", 2, 150 }, { "idle", 0, 300 }
+    };
+    const YHL::schedule_mode modes[] = {
+        YHL::schedule_mode::shared_queue, YHL::schedule_mode::work_stealing, YHL::schedule_mode::lock_free_queue
+    };
+    const char *names[] = { "shared_queue", "work_stealing", "lock_free_queue" };
+    for(int m = 0;m < 3; ++m) {
+        options.mode = modes[m];
+        YHL::thread_pool pool(1, options);
+        std::atomic<int> done(0);
+        int posted = 0;
+        bool follows = true;
+        std::cout << names[m] << "\n";
+        for(const auto& one : trace) {
+            size_t peak = 0;
+            auto next = std::chrono::steady_clock::now();
+            const auto end = next + std::chrono::milliseconds(one.millis);
+            while(next < end) {
+                for(int i = 0;i < one.rate; ++i, ++posted) {
+                    pool.post([&done]{
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        ++done;
+                    });
+                }
+                peak = std::max(peak, pool.size());
+                next += std::chrono::microseconds(250);
+                std::this_thread::sleep_until(next);
+            }
+            std::cout << "    " << one.name << "\tpeak threads  :  " << peak
+                      << "\tat end  :  " << pool.size() << "\n";
+            if(one.rate == 0)
+                follows = follows and pool.size() == options.min_threads;
+            else
+                follows = follows and peak >= static_cast<size_t>(4 * one.rate);
+        }
+        while(done.load() < posted)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::cout << "    worker count follows load  :  " << std::boolalpha << follows << "\n";
+    }
+}
+
+void test::benchWakeup () {
+    // 乒乓 : 主线程提交一个任务, 等它开始执行, 隔 gap 再提交下一个
+    // 记录从提交到任务开始执行的时间, 也就是唤醒一个空闲线程的延迟
+    const int rounds = 5000;
+    const YHL::schedule_mode modes[] = {
+        YHL::schedule_mode::shared_queue, YHL::schedule_mode::work_stealing, YHL::schedule_mode::lock_free_queue
+    };
+    const char *names[] = { "shared_queue   ", "work_stealing  ", "lock_free_queue" };
+    const std::chrono::microseconds gaps[] = { std::chrono::microseconds(10), std::chrono::microseconds(1000) };
+    for(auto gap : gaps) {
+        std::cout << "gap " << gap.count() << " us\n";
+        for(int m = 0;m < 3; ++m) {
+            for(auto idle : { YHL::idle_policy::power_saving, YHL::idle_policy::low_latency }) {
+                YHL::pool_options options;
+                options.mode = modes[m];
+                options.idle = idle;
+                YHL::thread_pool pool(2, options);
+                std::vector<double> delays;
+                delays.reserve(rounds);
+                const int count = gap.count() >= 1000 ? rounds / 10 : rounds;
+                for(int i = 0;i < count; ++i) {
+                    std::atomic<bool> started(false);
+                    std::chrono::steady_clock::time_point at;
+                    const auto submitted = std::chrono::steady_clock::now();
+                    pool.post([&started, &at]{
+                        at = std::chrono::steady_clock::now();
+                        started.store(true);
+                    });
+                    while(not started.load())
+                        std::this_thread::yield();
+                    delays.emplace_back(std::chrono::duration<double, std::micro>(at - submitted).count());
+                    std::this_thread::sleep_for(gap);
+                }
+                std::cout << "    " << names[m]
+                          << (idle == YHL::idle_policy::low_latency ? "  low_latency " : "  power_saving")
+                          << "  p50 : " << percentile(delays, 50) << " us"
+                          << "\tp99 : " << percentile(delays, 99) << " us\n";
+            }
+        }
+    }
+}
+
+void test::testAffinity () {
+    // 造一个假的 /sys : 2 个 package, 每个 2 个物理核, 每个核 2 个超线程, 每个 package 一个 L3
+    // 编号和 Linux 一样, 超线程兄弟是 n 和 n + 4
+    const std::string root = "/tmp/yhl_fake_cpu";
+    ::mkdir(root.c_str(), 0755);
+    std::ofstream(root + "/online") << "0-7\n";
+    for(int id = 0;id < 8; ++id) {
+        const int package = (id % 4) / 2, core = id % 2;
+        const std::string dir = root + "/cpu" + std::to_string(id);
+        ::mkdir(dir.c_str(), 0755);
+        ::mkdir((dir + "/topology").c_str(), 0755);
+        ::mkdir((dir + "/cache").c_str(), 0755);
+        ::mkdir((dir + "/cache/index0").c_str(), 0755);
+        ::mkdir((dir + "/cache/index1").c_str(), 0755);
+        std::ofstream(dir + "/topology/physical_package_id") << package << "\n";
+        std::ofstream(dir + "/topology/core_id") << core << "\n";
+        std::ofstream(dir + "/cache/index0/level") << 1 << "\n";
+        std::ofstream(dir + "/cache/index1/level") << 3 << "\n";
+        std::ofstream(dir + "/cache/index1/shared_cpu_list")
+            << (package == 0 ? "0-1,4-5" : "2-3,6-7") << "\n";
+    }
+    auto cpus = YHL::read_cpu_topology(root);
+    for(auto& it : cpus) {
+        std::cout << "cpu " << it.id << "  core " << it.core << "  l3 " << it.l3 << "  smt " << it.smt << "\n";
+        it.allowed = true;    // 这台机器上未必真有 8 个核
+    }
+    const auto print = [](const char *name, const std::vector<int>& order) {
+        std::cout << name;
+        for(auto id : order)
+            std::cout << id << "  ";
+        std::cout << "\n";
+    };
+    const auto spread = YHL::plan_placement(cpus, YHL::cpu_placement::spread);
+    const auto compact = YHL::plan_placement(cpus, YHL::cpu_placement::compact);
+    const auto reserved = YHL::plan_placement(cpus, YHL::cpu_placement::spread, { 0, 4 });
+    print("spread   :  ", spread);      // 应该是 0 2 1 3 4 6 5 7
+    print("compact  :  ", compact);     // 应该是 0 1 4 5 2 3 6 7
+    print("reserved :  ", reserved);    // 0 号物理核整个留出去, 应该是 1 2 3 5 6 7
+    std::cout << "plans as expected  :  " << std::boolalpha
+              << (spread == std::vector<int>{ 0, 2, 1, 3, 4, 6, 5, 7 }
+                  and compact == std::vector<int>{ 0, 1, 4, 5, 2, 3, 6, 7 }
+                  and reserved == std::vector<int>{ 1, 2, 3, 5, 6, 7 }) << "\n";
+
+    // 真实的机器 : 每个线程都只允许在一个 cpu 上运行
+    YHL::pool_options options;
+    options.placement = YHL::cpu_placement::spread;
+    YHL::thread_pool pool(4, options);
+    std::vector< std::future<int> > masks;
+    for(int i = 0;i < 16; ++i) {
+        masks.emplace_back(pool.enqueue([]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+            return CPU_COUNT(&set);
+        }));
+    }
+    bool pinned = true;
+    for(auto& it : masks)
+        pinned = pinned and it.get() == 1;
+    std::cout << "local cpus  :  " << YHL::read_cpu_topology().size()
+              << "\tevery worker pinned to one cpu  :  " << pinned << "\n";
+}
+
+void test::testContinuation () {
+    // 只有一个线程 : 如果后续任务要占着线程等 get(), 这里就会死锁
+    YHL::thread_pool pool(1);
+
+    auto text = pool.submit([]{ return 20; })
+        .then([](YHL::task_future<int> x){ return x.get() + 1; })
+        .then([](YHL::task_future<int> x){ return std::to_string(x.get() * 2); });
+    std::cout << "chain  :  " << text.get() << "\n";
+
+    // 异常沿着链条传下去, 在后续任务的 get() 里抛出
+    auto recovered = pool.submit([]() -> int { throw std::runtime_error("stage 1 failed"); })
+        .then([](YHL::task_future<int> x){
+            try {
+                return x.get();
+            }
+            catch(const std::exception& e) {
+                std::cout << "caught in continuation  :  " << e.what() << "\n";
+                return -1;
+            }
+        });
+    std::cout << "recovered  :  " << recovered.get() << "\n";
+
+    // promise 没有设置结果就析构, 后续任务照样会执行
+    auto pair = YHL::make_task_pair<int>(nullptr);
+    auto orphan = pair.second.then([](YHL::task_future<int> x){
+        try {
+            x.get();
+            return std::string("value");
+        }
+        catch(const std::future_error& e) {
+            return std::string(e.what());
+        }
+    });
+    { auto dropped = std::move(pair.first); }
+    std::cout << "abandoned  :  " << orphan.get() << "\n";
+
+    // when_all : 1000 个任务全部完成后求和, 求和本身也是后续任务
+    std::vector< YHL::task_future<int> > parts;
+    for(int i = 1;i <= 1000; ++i)
+        parts.emplace_back(pool.submit([i]{ return i; }));
+    auto sum = YHL::when_all(std::move(parts)).then([](YHL::task_future< std::vector< YHL::task_future<int> > > all){
+        int res = 0;
+        for(auto& it : all.get())
+            res += it.get();
+        return res;
+    });
+    std::cout << "when_all sum  :  " << sum.get() << "\n";
+
+    // when_any : 用第二个线程池跑慢任务, 第一个完成的是睡得最短的那个
+    YHL::thread_pool sleepers(3);
+    std::vector< YHL::task_future<int> > racers;
+    for(int millis : { 60, 10, 30 })
+        racers.emplace_back(sleepers.submit([millis]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+            return millis;
+        }));
+    auto first = YHL::when_any(std::move(racers)).get();
+    std::cout << "when_any index  :  " << first.index << "\tvalue  :  " << first.futures[first.index].get() << "\n";
+    // 输掉的 future 上的回调已经取下, 还可以再挂后续任务
+    auto loser = first.futures[(first.index + 1) % 3].then([](YHL::task_future<int> x){ return x.get(); });
+    std::cout << "loser continued  :  " << loser.get() << "\n";
+
+    // 线程池已经析构, 后续任务在挂上的线程就地执行
+    YHL::task_future<int> survivor;
+    {
+        YHL::thread_pool gone(1);
+        survivor = gone.submit([]{ return 5; });
+    }
+    auto late = survivor.then([](YHL::task_future<int> x){ return x.get() * 2; });
+    std::cout << "continued after pool destroyed  :  " << late.get() << "\n";
+
+    // 一万条三段的请求流水线, 全部挂在两个线程上
+    YHL::thread_pool two(2);
+    const int requests = 10000;
+    std::vector< YHL::task_future<int> > replies;
+    replies.reserve(requests);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0;i < requests; ++i) {
+        replies.emplace_back(two.submit([i]{ return i; })
+            .then([](YHL::task_future<int> x){ return x.get() * 2; })
+            .then([](YHL::task_future<int> x){ return x.get() + 1; }));
+    }
+    long long total = 0;
+    for(auto& it : replies)
+        total += it.get();
+    std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+    std::cout << "pipelines  :  " << requests << "\tthreads  :  " << two.size()
+              << "\tchecksum  :  " << total << "\t" << cost.count() << " ms\n";
+}
+
+namespace {
+    long serialFib(const int n) {
+        return n < 2 ? n : serialFib(n - 1) + serialFib(n - 2);
+    }
+
+    // 每一层都开一个组, 一半交给线程池, 一半自己算, 然后边等边干活
+    long groupFib(YHL::thread_pool& pool, const int n, const int cutoff) {
+        if(n < cutoff)
+            return serialFib(n);
+        long left = 0;
+        YHL::task_group group(pool);
+        group.run([&pool, &left, n, cutoff]{ left = groupFib(pool, n - 1, cutoff); });
+        const long right = groupFib(pool, n - 2, cutoff);
+        group.wait();
+        return left + right;
+    }
+
+    void groupSort(YHL::thread_pool& pool, std::vector<int>& data, const size_t first, const size_t last) {
+        if(last - first < 4096) {
+            std::sort(data.begin() + first, data.begin() + last);
+            return;
+        }
+        const int pivot = data[first + (last - first) / 2];
+        auto middle1 = std::partition(data.begin() + first, data.begin() + last,
+                                      [pivot](int x){ return x < pivot; });
+        auto middle2 = std::partition(middle1, data.begin() + last,
+                                      [pivot](int x){ return not (pivot < x); });
+        const size_t left = middle1 - data.begin(), right = middle2 - data.begin();
+        YHL::task_group group(pool);
+        group.run([&pool, &data, first, left]{ groupSort(pool, data, first, left); });
+        groupSort(pool, data, right, last);
+        group.wait();
+    }
+}
+
+void test::testTaskGroup () {
+    // 两个线程上递归好几万层的组, 如果 wait 会睡眠早就死锁了
+    const YHL::schedule_mode modes[] = {
+        YHL::schedule_mode::shared_queue, YHL::schedule_mode::work_stealing, YHL::schedule_mode::lock_free_queue
+    };
+    const char *names[] = { "shared_queue   ", "work_stealing  ", "lock_free_queue" };
+    const long expect = serialFib(30);
+    for(int m = 0;m < 3; ++m) {
+        YHL::pool_options options;
+        options.mode = modes[m];
+        YHL::thread_pool pool(2, options);
+
+        auto start = std::chrono::steady_clock::now();
+        const long fib = pool.submit([&pool]{ return groupFib(pool, 30, 12); }).get();
+        std::chrono::duration<double, std::milli> fib_cost = std::chrono::steady_clock::now() - start;
+
+        std::vector<int> data(1 << 21);
+        std::mt19937 gen(1229);
+        for(auto& it : data)
+            it = static_cast<int>(gen() % 100000);
+        start = std::chrono::steady_clock::now();
+        groupSort(pool, data, 0, data.size());     // 外部线程也可以当第一层的等待方
+        std::chrono::duration<double, std::milli> sort_cost = std::chrono::steady_clock::now() - start;
+
+        std::cout << names[m] << "  fib(30)  :  " << (fib == expect ? "ok" : "WRONG") << "  " << fib_cost.count() << " ms"
+                  << "\tquicksort 2M  :  " << (std::is_sorted(data.begin(), data.end()) ? "ok" : "WRONG")
+                  << "  " << sort_cost.count() << " ms\n";
+    }
+
+    // 组里的异常在 wait 里抛出
+    YHL::thread_pool pool(2);
+    YHL::task_group group(pool);
+    for(int i = 0;i < 10; ++i)
+        group.run([i]{ if(i == 7) throw std::runtime_error("task 7 failed"); });
+    try {
+        group.wait();
+    }
+    catch(const std::exception& e) {
+        std::cout << "caught  :  " << e.what() << "\n";
+    }
+
+    // 组里的任务还在排队时 shutdown(abort), 丢掉的任务也要算完成, wait 不能一直等
+    YHL::thread_pool single(1);
+    std::atomic<bool> release(false);
+    single.post([&release]{
+        while(not release.load())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    std::atomic<int> ran(0);
+    YHL::task_group orphans(single);
+    for(int i = 0;i < 10; ++i)
+        orphans.run([&ran]{ ++ran; });
+    std::thread closer([&single]{ single.shutdown(YHL::drain_policy::abort); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release = true;
+    closer.join();
+    bool broken = false;
+    try {
+        orphans.wait();
+    }
+    catch(const std::future_error& e) {
+        broken = e.code() == std::future_errc::broken_promise;
+    }
+    std::cout << "abort with queued children  :  " << (broken and ran.load() == 0 ? "ok" : "WRONG") << "\n";
+}
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+namespace {
+    YHL::task<int> leaf(YHL::thread_pool& pool, const int key) {
+        co_await pool.schedule();
+        co_return key * 2;
+    }
+
+    YHL::task<int> fanIn(YHL::thread_pool& pool, const int depth) {
+        if(depth == 0)
+            co_return co_await leaf(pool, 1);
+        const int left = co_await fanIn(pool, depth - 1);
+        const int right = co_await fanIn(pool, depth - 1);
+        co_return left + right;
+    }
+
+    YHL::task<std::string> request(YHL::thread_pool& pool, const int id) {
+        co_await YHL::sleep_for(pool, std::chrono::milliseconds(20));                 // 定时器, 不占线程
+        const int answer = co_await pool.submit([id]{ return id * 10; });            // 等 task_future, 也不占线程
+        if(id < 0)
+            throw std::invalid_argument("negative id");
+        co_return "reply " + std::to_string(answer);
+    }
+
+    YHL::task<void> session(YHL::thread_pool& pool, std::atomic<int>& done, const int id) {
+        co_await request(pool, id);
+        ++done;
+    }
+
+    YHL::task<int> nothing() {
+        co_return 1;
+    }
+
+    // 被移走的 task 没有协程可等
+    YHL::task<int> awaitMoved() {
+        YHL::task<int> first = nothing();
+        YHL::task<int> second = std::move(first);
+        const int value = co_await second;
+        try {
+            co_await first;
+        }
+        catch(const std::logic_error&) {
+            co_return value;
+        }
+        co_return -1;
+    }
+
+    // 等线程池恢复自己, 恢复任务被丢掉时收到 task_cancelled
+    YHL::task<void> parked(YHL::thread_pool& pool, std::atomic<int>& cancelled) {
+        try {
+            co_await pool.schedule();
+        }
+        catch(const YHL::task_cancelled&) {
+            ++cancelled;
+        }
+    }
+
+    YHL::task<void> napping(YHL::thread_pool& pool, std::atomic<int>& cancelled) {
+        try {
+            co_await YHL::sleep_for(pool, std::chrono::seconds(10));
+        }
+        catch(const YHL::task_cancelled&) {
+            ++cancelled;
+        }
+    }
+}
+
+void test::testCoroutine () {
+    YHL::thread_pool pool(2);
+    std::cout << "request  :  " << YHL::sync_wait(request(pool, 4)) << "\n";
+    try {
+        YHL::sync_wait(request(pool, -1));
+    }
+    catch(const std::exception& e) {
+        std::cout << "caught  :  " << e.what() << "\n";
+    }
+    std::cout << "fan in 2^10 leaves  :  " << YHL::sync_wait(fanIn(pool, 10)) << "\n";
+
+    // 200 个请求同时睡 20ms, 两个线程也只需要 20ms 多一点
+    std::atomic<int> done(0);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0;i < 200; ++i)
+        YHL::spawn(pool, session(pool, done, i));
+    while(done.load() < 200)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+    std::cout << "200 sleeping requests on 2 threads  :  " << done.load() << " done in " << cost.count() << " ms\n";
+
+    // 协程帧从线程局部的空闲链表分配, 热身之后不再调用 operator new
+    YHL::sync_wait(nothing());
+    const int rounds = 10000;
+    int sum = 0;
+    size_t frames = 0;
+    {
+        allocation_scope scope;
+        for(int i = 0;i < rounds; ++i)
+            sum += YHL::sync_wait(nothing());
+        frames = scope.count();
+    }
+    std::cout << "frame mallocs per coroutine  :  "
+              << static_cast<double>(frames) / rounds << "\tsum  :  " << sum << "\n";
+
+    // shutdown(abort) 时一个协程的恢复任务还在排队, 一个还在睡 : 都在 co_await 处收到 task_cancelled
+    YHL::thread_pool doomed(1);
+    std::atomic<bool> release(false);
+    doomed.post([&release]{
+        while(not release.load())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    std::atomic<int> cancelled(0);
+    std::thread queued([&]{ YHL::sync_wait(parked(doomed, cancelled)); });
+    std::thread sleeping([&]{ YHL::sync_wait(napping(doomed, cancelled)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::thread closer([&doomed]{ doomed.shutdown(YHL::drain_policy::abort); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release = true;
+    closer.join();
+    queued.join();
+    sleeping.join();
+    std::cout << "coroutines dropped by shutdown  :  " << (cancelled.load() == 2 ? "ok" : "WRONG") << "\n";
+    std::cout << "co_await a moved-from task  :  " << (YHL::sync_wait(awaitMoved()) == 1 ? "logic_error" : "WRONG") << "\n";
+}
+#else
+void test::testCoroutine () {
+    std::cout << "coroutines need C++20\n";
+}
+#endif
+
+void test::benchTaskGraph () {
+    // 100 层, 每层 100 个节点, 每个节点依赖上一层随机的 3 个节点; 节点本身只做一点点计算
+    const int layers = 100, width = 100, fan_in = 3, launches = 20;
+    std::vector<double> cells(layers * width, 1.0);
+    std::vector< std::vector<int> > inputs(layers * width);
+    std::mt19937 gen(1229);
+    std::uniform_int_distribution<int> pick(0, width - 1);
+    for(int l = 1;l < layers; ++l) {
+        for(int w = 0;w < width; ++w) {
+            for(int k = 0;k < fan_in; ++k)
+                inputs[l * width + w].emplace_back((l - 1) * width + pick(gen));
+        }
+    }
+    const auto compute = [&cells, &inputs](const int id) {
+        double sum = 1.0;
+        for(int from : inputs[id])
+            sum += cells[from] * 0.5;
+        for(int i = 0;i < 200; ++i)
+            sum = std::sqrt(sum + i);
+        cells[id] = sum;
+    };
+
+    YHL::pool_options options;
+    options.mode = YHL::schedule_mode::work_stealing;
+    YHL::thread_pool pool(std::max(2u, std::thread::hardware_concurrency()), options);
+
+    YHL::task_graph graph;
+    for(int id = 0;id < layers * width; ++id)
+        graph.add([&compute, id]{ compute(id); });
+    for(int id = 0;id < layers * width; ++id) {
+        for(int from : inputs[id])
+            graph.precede(from, id);
+    }
+    graph.launch(pool).get();      // 第一次启动要检查环, 不计时
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0;i < launches; ++i)
+        graph.launch(pool).get();
+    std::chrono::duration<double, std::milli> dag = std::chrono::steady_clock::now() - start;
+    const double dag_result = cells.back();
+
+    // 对照 : 手写的按层推进, 每层所有任务 enqueue 之后逐个 get, 层与层之间是一道屏障
+    start = std::chrono::steady_clock::now();
+    for(int i = 0;i < launches; ++i) {
+        for(int l = 0;l < layers; ++l) {
+            std::vector< std::future<void> > stage;
+            stage.reserve(width);
+            for(int w = 0;w < width; ++w)
+                stage.emplace_back(pool.enqueue(compute, l * width + w));
+            for(auto& it : stage)
+                it.get();
+        }
+    }
+    std::chrono::duration<double, std::milli> staged = std::chrono::steady_clock::now() - start;
+
+    // 只在一个线程上按编号顺序算, 作为计算量本身的基准
+    start = std::chrono::steady_clock::now();
+    for(int i = 0;i < launches; ++i) {
+        for(int id = 0;id < layers * width; ++id)
+            compute(id);
+    }
+    std::chrono::duration<double, std::milli> serial = std::chrono::steady_clock::now() - start;
+
+    std::cout << "nodes  :  " << graph.size() << "\tedges  :  " << (layers - 1) * width * fan_in << "\n"
+              << "task_graph      :  " << dag.count() / launches << " ms/launch\t"
+              << dag.count() * 1e6 / launches / graph.size() << " ns/node\n"
+              << "staged futures  :  " << staged.count() / launches << " ms/launch\t"
+              << staged.count() * 1e6 / launches / graph.size() << " ns/node"
+              << "\tsame result  :  " << std::boolalpha << (dag_result == cells.back()) << "\n"
+              << "serial          :  " << serial.count() / launches << " ms/launch\n";
+
+    // 有环的图启动时报错
+    YHL::task_graph cycle;
+    auto a = cycle.add([]{}), b = cycle.add([]{});
+    cycle.precede(a, b);
+    cycle.precede(b, a);
+    try {
+        cycle.launch(pool);
+    }
+    catch(const std::logic_error& e) {
+        std::cout << "caught  :  " << e.what();
+    }
+
+    // 节点还在排队时 shutdown(abort) : 这一次以 broken_promise 结束, 图可以在别的线程池上再启动
+    YHL::task_graph chain;
+    std::atomic<bool> release(false);
+    std::atomic<int> ran(0);
+    auto head = chain.add([&release]{
+        while(not release.load())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    for(int i = 0;i < 8; ++i)
+        chain.precede(head, chain.add([&ran]{ ++ran; }));
+    const auto outcome = [](YHL::task_future<void> done) -> std::string {
+        try {
+            done.get();
+            return "ok";
+        }
+        catch(const std::future_error& e) {
+            return e.code() == std::future_errc::broken_promise ? "broken_promise" : "WRONG";
+        }
+    };
+    YHL::thread_pool doomed(1);
+    auto first = chain.launch(doomed);
+    std::thread closer([&doomed]{ doomed.shutdown(YHL::drain_policy::abort); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release = true;
+    closer.join();
+    const std::string aborted = outcome(std::move(first));
+    const std::string stopped = outcome(chain.launch(doomed));      // 线程池已经停止
+    const int before = ran.exchange(0);
+    const std::string again = outcome(chain.launch(pool));
+    std::cout << "aborted launch  :  " << aborted << "\tlaunch on stopped pool  :  " << stopped
+              << "\trelaunch  :  " << again << "\tnodes run  :  " << before << " then " << ran.load() << "\n";
+}
+
+namespace {
+    // 一个请求 : 分 10 步做完, 每步之间检查一次取消
+    int handleRequest(const int id) {
+        for(int step = 0;step < 10; ++step) {
+            YHL::this_task::throw_if_cancelled();
+            busyFor(std::chrono::microseconds(50));
+        }
+        return id;
+    }
+}
+
+void test::benchCancellation () {
+    // 过载 : 2 个线程, 每 100us 来一个 500us 的请求, 是处理能力的 2.5 倍; 客户端等 5ms 不到结果就放弃
+    const int requests = 1000;
+    const auto interval = std::chrono::microseconds(100);
+    const auto patience = std::chrono::milliseconds(5);
+    double baseline = 0;
+    for(const bool cancel : { false, true }) {
+        YHL::thread_pool pool(2);
+        struct request {
+            std::chrono::steady_clock::time_point deadline;
+            YHL::cancel_source source;
+            std::future<int> reply;
+        };
+        std::deque<request> waiting;
+        size_t answered = 0, abandoned = 0;
+        const auto give_up = [&](const bool all) {
+            while(not waiting.empty()) {
+                auto& front = waiting.front();
+                if(front.reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                    try {
+                        front.reply.get();
+                        ++answered;
+                    }
+                    catch(const YHL::task_cancelled&) {}
+                }
+                else if(all or std::chrono::steady_clock::now() >= front.deadline) {
+                    if(cancel)
+                        front.source.cancel();
+                    ++abandoned;
+                }
+                else
+                    break;
+                waiting.pop_front();
+            }
+        };
+
+        const std::clock_t cpu_start = std::clock();
+        const auto start = std::chrono::steady_clock::now();
+        for(int i = 0;i < requests; ++i) {
+            std::this_thread::sleep_until(start + interval * i);
+            request one;
+            one.deadline = std::chrono::steady_clock::now() + patience;
+            one.reply = cancel ? pool.enqueue(one.source.token(), handleRequest, i)
+                               : pool.enqueue(handleRequest, i);
+            waiting.emplace_back(std::move(one));
+            give_up(false);
+        }
+        give_up(true);
+        // 等队列里剩下的任务都出队（执行或者丢掉）, 再看花了多少 CPU
+        pool.enqueue([]{}).get();
+        pool.enqueue([]{}).get();
+        std::chrono::duration<double, std::milli> wall = std::chrono::steady_clock::now() - start;
+        const double cpu = 1000.0 * (std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+        std::cout << (cancel ? "with cancel_token  " : "without cancel     ")
+                  << "answered  :  " << answered << "\tabandoned  :  " << abandoned
+                  << "\tcpu  :  " << cpu << " ms\twall  :  " << wall.count() << " ms\n";
+        if(cancel)
+            std::cout << "cpu saved  :  " << baseline - cpu << " ms (" << 100 * (baseline - cpu) / baseline << "%)\n";
+        baseline = cpu;
+    }
+
+    // cancel_all : 排队中的直接丢掉, 执行中的在下一次检查时退出, 普通任务不受影响
+    YHL::thread_pool pool(1);
+    std::vector< std::future<int> > shed;
+    for(int i = 0;i < 100; ++i)
+        shed.emplace_back(pool.enqueue(YHL::cancel_token(), handleRequest, i));
+    auto plain = pool.enqueue([]{ return 7; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    pool.cancel_all();
+    auto later = pool.enqueue(YHL::cancel_token(), handleRequest, 100);
+    size_t finished = 0, cancelled = 0;
+    for(auto& it : shed) {
+        try {
+            it.get();
+            ++finished;
+        }
+        catch(const YHL::task_cancelled&) {
+            ++cancelled;
+        }
+    }
+    std::cout << "cancel_all  :  finished " << finished << "\tcancelled " << cancelled
+              << "\tplain task  :  " << plain.get() << "\tsubmitted after  :  " << later.get() << "\n";
+}
+
+void test::testBoundedQueue () {
+    // 1 个线程卡在 gate 上, 队列容量 8, 再提交 20 个任务, 看各个策略怎么处理多出来的 12 个
+    const std::pair<YHL::overflow_policy, const char*> policies[] = {
+        { YHL::overflow_policy::block, "block      " },
+        { YHL::overflow_policy::reject, "reject     " },
+        { YHL::overflow_policy::caller_runs, "caller_runs" },
+        { YHL::overflow_policy::drop_oldest, "drop_oldest" }
+    };
+    for(const auto& policy : policies) {
+        YHL::pool_options options;
+        options.max_queued = 8;
+        options.overflow = policy.first;
+        YHL::thread_pool pool(1, options);
+        std::promise<void> gate;
+        auto opened = gate.get_future().share();
+        pool.post([opened]{ opened.wait(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        // block : 过一会再放行, 提交方在这之前都等着; 其他策略提交完才放行
+        std::thread opener;
+        if(policy.first == YHL::overflow_policy::block) {
+            opener = std::thread([&gate]{
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                gate.set_value();
+            });
+        }
+        const auto caller = std::this_thread::get_id();
+        std::vector< std::future<std::thread::id> > replies;
+        size_t refused = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for(int i = 0;i < 20; ++i) {
+            try {
+                replies.emplace_back(pool.enqueue([]{ return std::this_thread::get_id(); }));
+            }
+            catch(const YHL::queue_full&) {
+                ++refused;
+            }
+        }
+        std::chrono::duration<double, std::milli> submit = std::chrono::steady_clock::now() - start;
+        if(opener.joinable())
+            opener.join();
+        else
+            gate.set_value();
+        size_t on_caller = 0, broken = 0;
+        for(auto& it : replies) {
+            try {
+                on_caller += it.get() == caller;
+            }
+            catch(const std::future_error&) {
+                ++broken;
+            }
+        }
+        const auto counters = pool.overflow_counters();
+        std::cout << policy.second << "  submit  :  " << submit.count() << " ms\trefused  :  " << refused
+                  << "\tran on caller  :  " << on_caller << "\tbroken  :  " << broken
+                  << "\t(blocked " << counters.blocked << ", rejected " << counters.rejected
+                  << ", caller_ran " << counters.caller_ran << ", dropped " << counters.dropped << ")\n";
+    }
+
+    // block 带超时 : 等不到空位就抛出 queue_full; try_enqueue 满了直接返回 false
+    YHL::pool_options options;
+    options.max_queued = 2;
+    options.block_timeout = std::chrono::milliseconds(10);
+    YHL::thread_pool pool(1, options);
+    std::promise<void> gate;
+    auto opened = gate.get_future().share();
+    pool.post([opened]{ opened.wait(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    pool.post([]{});
+    pool.post([]{});
+    std::future<int> maybe;
+    std::cout << "try_enqueue when full  :  " << std::boolalpha << pool.try_enqueue(maybe, []{ return 1; }) << "\n";
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        pool.post([]{});
+    }
+    catch(const YHL::queue_full& e) {
+        std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - start;
+        std::cout << "caught after " << waited.count() << " ms  :  " << e.what();
+    }
+    gate.set_value();
+
+    // 工作线程上的 try_enqueue 和别的提交一样不受 max_queued 限制, 否则占着线程的任务永远等不到空位
+    auto inside = pool.enqueue([&pool]{
+        pool.post([]{});
+        pool.post([]{});
+        std::future<int> nested;
+        return pool.try_enqueue(nested, []{ return 2; }) and nested.valid();
+    });
+    std::cout << "try_enqueue on a worker when full  :  " << inside.get()
+              << "\trejected  :  " << pool.overflow_counters().rejected << "\n";
+}
+
+void test::testShutdown () {
+    // 2 个线程, 排队 200 个 1ms 的任务, 按三种策略关闭
+    const std::pair<YHL::drain_policy, const char*> policies[] = {
+        { YHL::drain_policy::drain, "drain         " },
+        { YHL::drain_policy::finish_running, "finish_running" },
+        { YHL::drain_policy::abort, "abort         " }
+    };
+    for(const auto& timeout : { std::chrono::milliseconds(0), std::chrono::milliseconds(20) }) {
+        for(const auto& policy : policies) {
+            YHL::thread_pool pool(2);
+            std::vector< std::future<void> > replies;
+            for(int i = 0;i < 200; ++i)
+                replies.emplace_back(pool.enqueue([]{ busyFor(std::chrono::milliseconds(1)); }));
+            // 一个会检查取消的长任务 : 本来要 500ms
+            auto patient = pool.enqueue(YHL::cancel_token(), []{
+                for(int i = 0;i < 500; ++i) {
+                    YHL::this_task::throw_if_cancelled();
+                    busyFor(std::chrono::milliseconds(1));
+                }
+            });
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+            const auto start = std::chrono::steady_clock::now();
+            const size_t discarded = pool.shutdown(policy.first, timeout);
+            std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+            size_t done = 0, broken = 0;
+            for(auto& it : replies) {
+                try {
+                    it.get();
+                    ++done;
+                }
+                catch(const std::future_error&) {
+                    ++broken;
+                }
+            }
+            std::string long_task = "finished";
+            try {
+                patient.get();
+            }
+            catch(const YHL::task_cancelled&) {
+                long_task = "cancelled";
+            }
+            std::cout << policy.second << "  timeout " << timeout.count() << " ms  :  " << cost.count() << " ms"
+                      << "\tdiscarded  :  " << discarded << "\tdone  :  " << done << "\tbroken  :  " << broken
+                      << "\tlong task  :  " << long_task << "\tthreads left  :  " << pool.size() << "\n";
+        }
+    }
+
+    // 析构时 drain : 工作线程在任务里提交的子任务也会执行完
+    std::atomic<int> ran(0);
+    {
+        YHL::pool_options options;
+        options.mode = YHL::schedule_mode::work_stealing;
+        YHL::thread_pool pool(2, options);
+        for(int i = 0;i < 100; ++i) {
+            pool.post([&pool, &ran]{
+                ++ran;
+                pool.post([&ran]{ ++ran; });
+            });
+        }
+    }
+    std::cout << "destructor drained  :  " << ran.load() << " / 200\n";
+
+    // 一边 schedule_after 一边 shutdown : 定时器要么注册成功（随定时线程一起销毁）, 要么抛出异常, 不会用到已经销毁的定时器
+    size_t accepted = 0, refused = 0;
+    for(int round = 0;round < 20; ++round) {
+        YHL::thread_pool pool(1);
+        std::atomic<bool> started(false);
+        std::thread timers([&]{
+            for(;;) {
+                try {
+                    pool.schedule_after(std::chrono::seconds(10), []{});
+                    ++accepted;
+                }
+                catch(const std::runtime_error&) {
+                    ++refused;
+                    return;
+                }
+                started = true;
+            }
+        });
+        while(not started.load())
+            std::this_thread::yield();
+        pool.shutdown();
+        timers.join();
+    }
+    std::cout << "schedule racing shutdown  :  " << accepted << " timers accepted, " << refused << " refused\n";
+}
+
+namespace {
+    struct parse_stats {
+        std::atomic<size_t> same_thread{0};
+        std::atomic<size_t> nodes{0};
+        std::atomic<size_t> remaining{1};
+        std::promise<void> done;
+    };
+
+    // 递归的解析器 : 每个节点读父节点刚产出的数据, 再为两个子节点产出数据并提交
+    void parseNode(YHL::thread_pool& pool, std::shared_ptr< std::vector<uint32_t> > input,
+                   const std::thread::id parent, const int depth, parse_stats& stats) {
+        ++stats.nodes;
+        if(std::this_thread::get_id() == parent)
+            ++stats.same_thread;
+        uint32_t sum = 0;
+        for(const auto x : *input)
+            sum += x;
+        if(depth > 0) {
+            for(uint32_t k = 0;k < 2; ++k) {
+                auto output = std::make_shared< std::vector<uint32_t> >(input->size());
+                for(size_t i = 0;i < input->size(); ++i)
+                    (*output)[i] = (*input)[i] * 31 + k + sum;
+                ++stats.remaining;
+                pool.post([&pool, output, depth, &stats, self = std::this_thread::get_id()]{
+                    parseNode(pool, output, self, depth - 1, stats);
+                });
+            }
+        }
+        if(--stats.remaining == 0)
+            stats.done.set_value();
+    }
+}
+
+void test::benchLifoSlot () {
+    // 深度 14 的二叉树, 每个节点 8KB 数据; 子节点在父节点的线程上执行时数据还在缓存里
+    const int depth = 14, rounds = 5;
+    const unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    const std::pair<YHL::schedule_mode, const char*> modes[] = {
+        { YHL::schedule_mode::shared_queue, "shared_queue   " },
+        { YHL::schedule_mode::lock_free_queue, "lock_free_queue" }
+    };
+    for(const auto& mode : modes) {
+        for(const bool slot : { false, true }) {
+            YHL::pool_options options;
+            options.mode = mode.first;
+            options.lifo_slot = slot;
+            YHL::thread_pool pool(threads, options);
+            size_t nodes = 0, same_thread = 0;
+            const auto start = std::chrono::steady_clock::now();
+            for(int r = 0;r < rounds; ++r) {
+                parse_stats stats;
+                auto root = std::make_shared< std::vector<uint32_t> >(2048, 1);
+                pool.post([&pool, root, &stats]{ parseNode(pool, root, std::thread::id(), depth, stats); });
+                stats.done.get_future().wait();
+                nodes += stats.nodes;
+                same_thread += stats.same_thread;
+            }
+            std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+            std::cout << mode.second << (slot ? "  lifo_slot  " : "  fifo only  ")
+                      << "  " << cost.count() / rounds << " ms/tree\t"
+                      << "children on parent's thread  :  " << 100.0 * same_thread / nodes << "%\n";
+        }
+    }
+}
+
+void test::benchStrand () {
+    // 64 个连接, 每个连接 1000 条消息, 每条消息处理 2us; 同一个连接的消息必须按顺序处理
+    const int sessions = 64, messages = 1000;
+    const unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+    struct session {
+        std::mutex mtx;
+        int last = -1;
+        size_t out_of_order = 0;
+    };
+    const auto handle = [](session& one, const int seq) {
+        if(seq not_eq one.last + 1)
+            ++one.out_of_order;
+        one.last = seq;
+        busyFor(std::chrono::microseconds(2));
+    };
+
+    // 原来的做法 : 消息直接交给线程池, 每个连接一把锁
+    {
+        YHL::thread_pool pool(threads);
+        std::vector<session> all(sessions);
+        std::atomic<int64_t> blocked_ns(0);
+        const auto start = std::chrono::steady_clock::now();
+        for(int seq = 0;seq < messages; ++seq) {
+            for(auto& one : all) {
+                pool.post([&one, seq, &handle, &blocked_ns]{
+                    const auto before = std::chrono::steady_clock::now();
+                    std::lock_guard<std::mutex> lck(one.mtx);
+                    blocked_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - before).count();
+                    handle(one, seq);
+                });
+            }
+        }
+        pool.shutdown();
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        size_t disorder = 0;
+        for(auto& one : all)
+            disorder += one.out_of_order;
+        std::cout << "mutex per session   :  " << cost.count() << " ms\tout of order  :  " << disorder
+                  << "\tblocked on locks  :  " << blocked_ns.load() / 1e6 << " ms\n";
+    }
+
+    // strand : 每个连接一个 strand, 不用锁
+    {
+        YHL::thread_pool pool(threads);
+        std::vector<session> all(sessions);
+        std::vector< std::unique_ptr<YHL::strand> > serial;
+        for(int i = 0;i < sessions; ++i)
+            serial.emplace_back(new YHL::strand(pool));
+        const auto start = std::chrono::steady_clock::now();
+        for(int seq = 0;seq < messages; ++seq) {
+            for(int i = 0;i < sessions; ++i) {
+                session& one = all[i];
+                serial[i]->post([&one, seq, &handle]{ handle(one, seq); });
+            }
+        }
+        serial.clear();    // 析构时等各自的任务执行完
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        size_t disorder = 0;
+        for(auto& one : all)
+            disorder += one.out_of_order;
+        std::cout << "strand per session  :  " << cost.count() << " ms\tout of order  :  " << disorder << "\n";
+    }
+
+    YHL::thread_pool pool(2);
+    YHL::strand serial(pool);
+    std::string text;
+    serial.post([&text]{ text += "hello "; });
+    serial.post([&text]{ text += "world"; });
+    auto inside = serial.submit([&serial, &text]{ return serial.running_in_this_thread() ? text : std::string(); });
+    std::cout << "submit  :  " << inside.get() << "\toutside  :  " << std::boolalpha << serial.running_in_this_thread() << "\n";
+
+    // 一个线程上两个 strand, 都在工作线程里提交 : 执行了一批的 drain 排到队尾, 另一个 strand 最多等一批（64 个）
+    {
+        YHL::thread_pool single(1);
+        YHL::strand left(single), right(single);
+        std::vector<char> order;
+        single.submit([&]{
+            for(int i = 0;i < 500; ++i) {
+                left.post([&order]{ order.emplace_back('L'); });
+                right.post([&order]{ order.emplace_back('R'); });
+            }
+        }).get();
+        left.post([]{});
+        right.submit([]{ return 0; }).get();
+        size_t longest = 0, run = 0;
+        for(size_t i = 0;i < order.size(); ++i) {
+            run = (i > 0 and order[i] == order[i - 1]) ? run + 1 : 1;
+            longest = std::max(longest, run);
+        }
+        std::cout << "longest run of one strand  :  " << longest << (longest <= 64 ? "  ok" : "  WRONG") << "\n";
+    }
+
+    // drain 还在排队时 shutdown(abort) : strand 里的任务一起丢掉, 析构不会一直等
+    YHL::thread_pool doomed(1);
+    std::atomic<bool> release(false);
+    doomed.post([&release]{
+        while(not release.load())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    std::unique_ptr<YHL::strand> orphan(new YHL::strand(doomed));
+    std::atomic<int> ran(0);
+    for(int i = 0;i < 10; ++i)
+        orphan->post([&ran]{ ++ran; });
+    auto lost = orphan->submit([]{ return 1; });
+    std::thread closer([&doomed]{ doomed.shutdown(YHL::drain_policy::abort); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release = true;
+    closer.join();
+    orphan.reset();
+    bool broken = false;
+    try {
+        lost.get();
+    }
+    catch(const std::future_error& e) {
+        broken = e.code() == std::future_errc::broken_promise;
+    }
+    std::cout << "abort with queued drain  :  " << (broken and ran.load() == 0 ? "ok" : "WRONG") << "\n";
+}
+
+void test::benchKeyedExecutor () {
+    // 256 个账户, 每个账户的状态占几条缓存行, 每次更新把它整个扫一遍
+    const int accounts = 256, updates = 200000;
+    const unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+    struct account {
+        std::mutex mtx;
+        double ledger[64] = {};
+        long last = -1;
+        size_t out_of_order = 0;
+    };
+    const auto apply = [](account& one, const long seq) {
+        if(seq not_eq one.last + 1)
+            ++one.out_of_order;
+        one.last = seq;
+        for(auto& it : one.ledger)
+            it += 1.0 / (seq + 1);
+    };
+    const auto disorder = [](std::vector<account>& all) {
+        size_t total = 0;
+        for(auto& one : all)
+            total += one.out_of_order;
+        return total;
+    };
+
+    // 原来的做法 : 任意线程执行, 每个账户一把锁
+    {
+        YHL::thread_pool pool(threads);
+        std::vector<account> all(accounts);
+        std::vector<long> seq(accounts, 0);
+        const auto start = std::chrono::steady_clock::now();
+        for(int i = 0;i < updates; ++i) {
+            const int id = (i * 7919) % accounts;
+            account& one = all[id];
+            const long n = seq[id]++;
+            pool.post([&one, n, &apply]{
+                std::lock_guard<std::mutex> lck(one.mtx);
+                apply(one, n);
+            });
+        }
+        pool.shutdown();
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        std::cout << "mutex per account  :  " << cost.count() << " ms\tout of order  :  " << disorder(all) << "\n";
+    }
+
+    // keyed_executor : 同一个账户总在同一个线程上执行, 不用锁
+    {
+        YHL::thread_pool pool(threads);
+        std::vector<account> all(accounts);
+        std::vector<long> seq(accounts, 0);
+        const auto start = std::chrono::steady_clock::now();
+        {
+            YHL::keyed_executor keyed(pool);
+            for(int i = 0;i < updates; ++i) {
+                const int id = (i * 7919) % accounts;
+                account& one = all[id];
+                const long n = seq[id]++;
+                keyed.post(id, [&one, n, &apply]{ apply(one, n); });
+            }
+        }
+        pool.shutdown();
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        std::cout << "keyed executor     :  " << cost.count() << " ms\tout of order  :  " << disorder(all) << "\n";
+    }
+
+    // 热点 : 一半的更新落在 0 号账户上, 和它同一个分片的账户应该被挪走, 挪动时每个账户的顺序不能乱
+    {
+        YHL::thread_pool pool(threads);
+        std::vector<account> all(accounts);
+        std::vector<long> seq(accounts, 0);
+        std::vector<size_t> before, after;
+        size_t moved = 0;
+        size_t neighbours = 0, stayed = 0;
+        {
+            YHL::keyed_executor keyed(pool);
+            const size_t hot_shard = keyed.shard_of(0);
+            std::vector<int> same;
+            for(int id = 1;id < accounts; ++id)
+                if(keyed.shard_of(id) == hot_shard)
+                    same.push_back(id);
+            neighbours = same.size();
+            for(int i = 0;i < updates; ++i) {
+                const int id = i % 2 == 0 ? 0 : 1 + (i / 2) % (accounts - 1);
+                account& one = all[id];
+                const long n = seq[id]++;
+                keyed.post(id, [&one, n, &apply]{
+                    apply(one, n);
+                    busyFor(std::chrono::microseconds(1));
+                });
+                if(i == updates / 10)
+                    before = keyed.depths();
+            }
+            after = keyed.depths();
+            moved = keyed.moved_keys();
+            for(const auto id : same)
+                stayed += keyed.shard_of(id) == hot_shard;
+        }
+        pool.shutdown();
+        const auto show = [](const std::vector<size_t>& depth) {
+            std::string text;
+            for(const auto it : depth)
+                text += std::to_string(it) + " ";
+            return text;
+        };
+        std::cout << "hot key  :  moved " << moved << " keys\tneighbours still on the hot shard  :  "
+                  << stayed << " / " << neighbours << "\tout of order  :  " << disorder(all) << "\n";
+        std::cout << "depths at 10%  :  " << show(before) << "\n";
+        std::cout << "depths at end  :  " << show(after) << "\n";
+    }
+
+    YHL::thread_pool pool(2);
+    YHL::keyed_executor keyed(pool);
+    auto where = keyed.submit(std::string("alice"), []{ return std::this_thread::get_id(); });
+    auto again = keyed.submit(std::string("alice"), []{ return std::this_thread::get_id(); });
+    std::cout << "same thread for one key  :  " << std::boolalpha << (where.get() == again.get())
+              << "\tshards  :  " << keyed.shard_count() << "\n";
+}
+
+void test::benchFibers () {
+    // 每个请求阻塞一段时间（模拟同步的 IO）
+    const auto latency = std::chrono::milliseconds(100);
+    const unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+
+    // 原来的做法 : 阻塞式的处理函数直接在线程池上执行, 一个请求占住一个线程
+    {
+        const int requests = 80;
+        YHL::thread_pool pool(threads);
+        std::atomic<int> done(0);
+        const auto start = std::chrono::steady_clock::now();
+        for(int i = 0;i < requests; ++i)
+            pool.post([&done, latency]{ std::this_thread::sleep_for(latency); ++done; });
+        pool.shutdown();
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        std::cout << "blocking on threads  " << requests << " requests x 100 ms  :  " << cost.count() << " ms\tdone  :  " << done.load() << "\n";
+    }
+
+    // 纤程 : 同样的写法, 阻塞的只是纤程; 每个请求等 1s, 让所有纤程同时挂起
+    // 十万个纤程同时在等, 要关掉保护页（见 fiber.h 注意事项 3）
+    const auto run = [&](const int requests, const YHL::fiber_options& options, const char *name) {
+        const auto latency = std::chrono::seconds(1);
+        YHL::thread_pool pool(threads);
+        std::atomic<int> done(0), waiting(0), peak(0);
+        const auto start = std::chrono::steady_clock::now();
+        {
+            YHL::fiber_scheduler fibers(pool, options);
+            for(int i = 0;i < requests; ++i)
+                fibers.spawn([&, latency]{
+                    int now = ++waiting, seen = peak.load();
+                    while(now > seen and not peak.compare_exchange_weak(seen, now)) {}
+                    YHL::this_fiber::sleep_for(latency);
+                    --waiting;
+                    ++done;
+                });
+        }
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        std::cout << name << requests << " requests x 1000 ms  :  " << cost.count() << " ms\tdone  :  " << done.load()
+                  << "\tblocked at the same time  :  " << peak.load() << "\n";
+    };
+    YHL::fiber_options guarded;
+    run(20000, guarded, "fibers, guard page   ");
+    YHL::fiber_options small;
+    small.stack_size = 16 * 1024;
+    small.guard_page = false;
+    small.keep_stacks = 100000;
+    run(100000, small, "fibers, 16KB stacks  ");
+
+    YHL::thread_pool pool(threads);
+    YHL::fiber_scheduler fibers(pool);
+
+    // fiber_mutex : 拿着锁挂起, 别的纤程挂起等锁, 线程不会被占住
+    {
+        YHL::fiber_mutex mtx;
+        long counter = 0;
+        size_t overlapped = 0;
+        bool inside = false;
+        for(int i = 0;i < 1000; ++i)
+            fibers.spawn([&]{
+                for(int k = 0;k < 20; ++k) {
+                    std::lock_guard<YHL::fiber_mutex> lck(mtx);
+                    overlapped += inside;
+                    inside = true;
+                    if(k % 4 == 0)
+                        YHL::this_fiber::yield();
+                    ++counter;
+                    inside = false;
+                }
+            });
+        while(fibers.alive() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::cout << "fiber_mutex  counter  :  " << counter << " / 20000\toverlapped  :  " << overlapped << "\n";
+    }
+
+    // channel : 生产者在纤程外面, 一级一级传下去, 每一级的消费者是一个纤程
+    {
+        const int stages = 100, messages = 1000;
+        std::vector< std::unique_ptr< YHL::channel<int> > > links;
+        for(int i = 0;i <= stages; ++i)
+            links.emplace_back(new YHL::channel<int>(16));
+        for(int i = 0;i < stages; ++i)
+            fibers.spawn([&links, i]{
+                int value;
+                while(links[i]->pop(value))
+                    links[i + 1]->push(value + 1);
+                links[i + 1]->close();
+            });
+        const auto start = std::chrono::steady_clock::now();
+        std::thread producer([&]{
+            for(int i = 0;i < messages; ++i)
+                links[0]->push(i);
+            links[0]->close();
+        });
+        long sum = 0;
+        int value, received = 0;
+        bool in_order = true;
+        while(links[stages]->pop(value)) {
+            in_order = in_order and value == received + stages;
+            sum += value;
+            ++received;
+        }
+        producer.join();
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        std::cout << "channel  " << stages << " stages x " << messages << " messages  :  " << cost.count()
+                  << " ms\treceived  :  " << received << "\tin order  :  " << std::boolalpha << in_order << "\n";
+    }
+
+    // fiber_condition_variable
+    {
+        YHL::fiber_mutex mtx;
+        YHL::fiber_condition_variable cv;
+        bool ready = false;
+        auto waiting = fibers.submit([&]{
+            std::unique_lock<YHL::fiber_mutex> lck(mtx);
+            cv.wait(lck, [&ready]{ return ready; });
+            return YHL::this_fiber::in_fiber();
+        });
+        fibers.spawn([&]{
+            YHL::this_fiber::sleep_for(std::chrono::milliseconds(5));
+            std::lock_guard<YHL::fiber_mutex> lck(mtx);
+            ready = true;
+            cv.notify_all();
+        });
+        auto broken = fibers.submit([]{ throw std::runtime_error("fiber failed"); });
+        try {
+            broken.get();
+        }
+        catch(const std::runtime_error& e) {
+            std::cout << "condition variable  :  " << std::boolalpha << waiting.get()
+                      << "\tcaught  :  " << e.what() << "\toutside a fiber  :  " << YHL::this_fiber::in_fiber() << "\n";
+        }
+    }
+
+    // 线程池 abort : 睡着的纤程得到 task_cancelled, 等锁的和排着队的纤程在 fiber_scheduler 析构时执行完, 不会卡住
+    {
+        YHL::thread_pool doomed(2);
+        std::atomic<int> yields(0);
+        const auto start = std::chrono::steady_clock::now();
+        YHL::task_future<bool> sleeper, blocked;
+        YHL::fiber_mutex mtx;
+        std::atomic<bool> holding(false);
+        {
+            YHL::fiber_scheduler fibers(doomed);     // 纤程用到的东西都要比它活得久
+            sleeper = fibers.submit([&]{
+                std::lock_guard<YHL::fiber_mutex> lck(mtx);
+                holding = true;
+                try {
+                    YHL::this_fiber::sleep_for(std::chrono::hours(1));
+                }
+                catch(const YHL::task_cancelled&) {
+                    return true;
+                }
+                return false;
+            });
+            while(not holding.load())
+                std::this_thread::yield();
+            blocked = fibers.submit([&]{
+                std::lock_guard<YHL::fiber_mutex> lck(mtx);
+                return YHL::this_fiber::in_fiber();
+            });
+            for(int i = 0;i < 8; ++i)
+                fibers.spawn([&yields]{
+                    for(int k = 0;k < 1000; ++k) {
+                        YHL::this_fiber::yield();
+                        ++yields;
+                    }
+                });
+            doomed.shutdown(YHL::drain_policy::abort);
+        }
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        std::cout << "abort with fibers  :  " << cost.count() << " ms\tsleeper cancelled  :  " << std::boolalpha << sleeper.get()
+                  << "\tblocked ran  :  " << blocked.get() << "\tyields  :  " << yields.load() << " / 8000\n";
+    }
+}
+
+void test::benchPipeline () {
+    // 读 -> 解析（串行, 1us）-> 转换（并行, 20us）-> 写（串行, 按输入顺序）
+    const int lines = 20000;
+    const unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+    const auto parse = [](const std::string& line) { busyFor(std::chrono::microseconds(1)); return std::stol(line); };
+    const auto transform = [](const long value) { busyFor(std::chrono::microseconds(20)); return value * 2; };
+
+    // 原来的做法 : 每一行 enqueue 一次, future 攒起来按顺序 get, 没有背压
+    {
+        YHL::thread_pool pool(threads);
+        std::vector<long> written;
+        const auto start = std::chrono::steady_clock::now();
+        std::vector< std::future<long> > results;
+        std::atomic<int> finished(0);
+        for(int i = 0;i < lines; ++i)
+            results.emplace_back(pool.enqueue([&parse, &transform, &finished, i]{
+                const long value = transform(parse(std::to_string(i)));
+                ++finished;
+                return value;
+            }));
+        const int peak = lines - finished.load();
+        for(auto& it : results)
+            written.emplace_back(it.get());
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        bool in_order = true;
+        for(int i = 0;i < lines; ++i)
+            in_order = in_order and written[i] == 2L * i;
+        std::cout << "enqueue per line   :  " << cost.count() << " ms\tnot done after reading  :  " << peak
+                  << "\tin order  :  " << std::boolalpha << in_order << "\n";
+    }
+
+    const auto run = [&](const YHL::output_order order, const char *name) {
+        YHL::thread_pool pool(threads);
+        std::vector<long> written;
+        size_t peak = 0;
+        const auto start = std::chrono::steady_clock::now();
+        auto job = YHL::make_pipeline<std::string>(pool, 256)
+            .serial(parse)
+            .parallel(transform)
+            .sink([&written](const long value){ written.emplace_back(value); }, order);
+        for(int i = 0;i < lines; ++i) {
+            job.push(std::to_string(i));
+            peak = std::max(peak, job.in_flight());
+        }
+        job.wait();
+        std::chrono::duration<double, std::milli> cost = std::chrono::steady_clock::now() - start;
+        bool in_order = written.size() == static_cast<size_t>(lines);
+        for(size_t i = 0;in_order and i < written.size(); ++i)
+            in_order = written[i] == 2L * static_cast<long>(i);
+        std::cout << name << cost.count() << " ms\tpeak in flight  :  " << peak << " / " << job.max_in_flight()
+                  << "\tin order  :  " << std::boolalpha << in_order << "\n";
+    };
+    run(YHL::output_order::input, "pipeline, ordered  :  ");
+    run(YHL::output_order::completion, "pipeline, any      :  ");
+
+    // 中间某一行解析失败 : 之后的行不再处理, push 返回 false, wait 抛出异常
+    YHL::thread_pool pool(threads);
+    std::atomic<int> written(0);
+    auto job = YHL::make_pipeline<std::string>(pool, 16)
+        .parallel([](std::string line){
+            if(line == "oops")
+                throw std::invalid_argument("bad line : " + line);
+            return line;
+        })
+        .sink([&written](std::string){ ++written; });
+    int accepted = 0;
+    for(int i = 0;i < 1000; ++i)
+        accepted += job.push(i == 100 ? std::string("oops") : std::to_string(i));
+    try {
+        job.wait();
+    }
+    catch(const std::invalid_argument& e) {
+        std::cout << "caught  :  " << e.what() << "\taccepted  :  " << accepted << "\twritten  :  " << written.load() << "\n";
+    }
+
+    // stage 任务还在排队时 shutdown(abort) : 这些项按失败流完, wait 抛出 broken_promise, 不会一直等
+    YHL::thread_pool doomed(1);
+    std::atomic<bool> release(false);
+    doomed.post([&release]{
+        while(not release.load())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    std::atomic<int> sunk(0);
+    auto stuck = YHL::make_pipeline<int>(doomed, 64)
+        .parallel([](int x){ return x + 1; })
+        .serial([](int x){ return x * 2; })
+        .sink([&sunk](int){ ++sunk; });
+    for(int i = 0;i < 20; ++i)
+        stuck.push(i);
+    std::thread closer([&doomed]{ doomed.shutdown(YHL::drain_policy::abort); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release = true;
+    closer.join();
+    const bool refused = not stuck.push(20);
+    bool broken = false;
+    try {
+        stuck.wait();
+    }
+    catch(const std::future_error& e) {
+        broken = e.code() == std::future_errc::broken_promise;
+    }
+    std::cout << "abort with queued stages  :  " << (broken and refused and sunk.load() == 0 ? "ok" : "WRONG") << "\n";
+}
+
+void test::benchTenants () {
+    // 轻租户每 2ms 来一个 50us 的请求; 重租户一开始就灌进 100 倍的 50us 任务
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    const int light = 200, heavy = light * 100;
+    const auto work = std::chrono::microseconds(50);
+
+    auto run = [&](const char* name, const bool tenants) {
+        YHL::thread_pool pool(threads);
+        const YHL::tenant_id heavy_id = pool.add_tenant(), light_id = pool.add_tenant();
+        std::atomic<int> done(0);
+        for(int i = 0;i < heavy; ++i) {
+            auto task = [&done, work]{ busyFor(work); ++done; };
+            if(tenants)
+                pool.post_for(heavy_id, task);
+            else
+                pool.post(task);
+        }
+
+        std::vector<double> delays(light);
+        std::atomic<int> finished(0);
+        for(int i = 0;i < light; ++i) {
+            const auto submitted = std::chrono::steady_clock::now();
+            auto task = [&delays, &finished, submitted, i, work]{
+                std::chrono::duration<double, std::micro> wait = std::chrono::steady_clock::now() - submitted;
+                delays[i] = wait.count();
+                busyFor(work);
+                ++finished;
+            };
+            if(tenants)
+                pool.post_for(light_id, task);
+            else
+                pool.post(task);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        while(finished.load() < light or done.load() < heavy)
+            std::this_thread::yield();
+        std::cout << name << "  light p50 : " << percentile(delays, 50) << " us"
+                  << "\tp99 : " << percentile(delays, 99) << " us";
+        if(tenants) {
+            const auto h = pool.tenant_usage(heavy_id), l = pool.tenant_usage(light_id);
+            std::cout << "\tcpu  heavy : " << h.cpu_time.count() / 1e6 << " ms"
+                      << "  light : " << l.cpu_time.count() / 1e6 << " ms";
+        }
+        std::cout << "\n";
+    };
+    run("single queue ", false);
+    run("tenant queues", true);
+
+    // 两个租户都排满时, CPU 时间按权重分
+    {
+        YHL::thread_pool pool(threads);
+        const YHL::tenant_id gold = pool.add_tenant(3), bronze = pool.add_tenant(1);
+        std::atomic<int> done(0);
+        const int each = 4000;
+        for(int i = 0;i < each; ++i) {
+            pool.post_for(gold, [&done, work]{ busyFor(work); ++done; });
+            pool.post_for(bronze, [&done, work]{ busyFor(work); ++done; });
+        }
+        // 两边都还有任务排队的时候看一眼
+        while(done.load() < each)
+            std::this_thread::yield();
+        const auto g = pool.tenant_usage(gold), b = pool.tenant_usage(bronze);
+        std::cout << "weights 3 : 1  completed while both busy  :  " << g.completed << " : " << b.completed
+                  << "\tcpu  " << g.cpu_time.count() / 1e6 << " ms : " << b.cpu_time.count() / 1e6 << " ms\n";
+        while(done.load() < 2 * each)
+            std::this_thread::yield();
+    }
+}
+
+void test::benchMicroTasks () {
+    // 100 万个 100ns 的任务从一个外部线程提交, 看每秒能执行多少个
+    const size_t threads = std::max(4u, std::thread::hardware_concurrency());
+    const int count = 1000000;
+
+    auto run = [&](const char* name, const size_t max_batch, const bool coalesce) {
+        YHL::pool_options options;
+        options.max_batch = max_batch;
+        YHL::thread_pool pool(threads, options);
+        std::atomic<int> done(0);
+        auto tiny = [&done]{
+            const auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(100);
+            while(std::chrono::steady_clock::now() < until)
+                ;
+            done.fetch_add(1, std::memory_order_relaxed);
+        };
+        const auto start = std::chrono::steady_clock::now();
+        if(coalesce) {
+            YHL::task_coalescer batch(pool, 64, std::chrono::milliseconds(1));
+            for(int i = 0;i < count; ++i)
+                batch.post(tiny);
+            batch.flush();
+        }
+        else {
+            for(int i = 0;i < count; ++i)
+                pool.post(tiny);
+        }
+        while(done.load() < count)
+            std::this_thread::yield();
+        std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+        std::cout << name << "  " << cost.count() * 1000 << " ms\t" << count / cost.count() / 1e6 << " M tasks/s\n";
+    };
+    run("post, one per lock     ", 1, false);
+    run("post, adaptive batch   ", 32, false);
+    run("coalescer + batch      ", 32, true);
+
+    // 长任务时一次只取一个, 不会有线程攒着任务而别的线程闲着
+    {
+        YHL::thread_pool pool(threads);
+        std::vector< std::future<std::thread::id> > ids;
+        for(size_t i = 0;i < threads * 4; ++i)
+            ids.emplace_back(pool.enqueue([]{ busyFor(std::chrono::milliseconds(2)); return std::this_thread::get_id(); }));
+        std::vector<std::thread::id> seen;
+        for(auto& one : ids) {
+            const auto id = one.get();
+            if(std::find(seen.begin(), seen.end(), id) == seen.end())
+                seen.push_back(id);
+        }
+        std::cout << "2ms tasks spread over  :  " << seen.size() << " / " << threads << " threads\n";
+    }
+
+    // 提交线程来来去去 : 退出的线程的缓冲被清掉之前, 攒着的任务照样入队
+    {
+        YHL::thread_pool pool(threads);
+        std::atomic<int> done(0);
+        const int producers = 2000, each = 3;
+        YHL::task_coalescer batch(pool, 64, std::chrono::milliseconds(1));
+        for(int i = 0;i < producers; ++i) {
+            std::thread([&batch, &done, each]{
+                for(int k = 0;k < each; ++k)
+                    batch.post([&done]{ ++done; });
+            }).join();
+            if(i % 100 == 0)
+                batch.flush_all();
+        }
+        batch.flush_all();
+        while(done.load() < producers * each)
+            std::this_thread::yield();
+        std::cout << "short-lived producers  :  " << done.load() << " / " << producers * each << "\n";
+    }
+}
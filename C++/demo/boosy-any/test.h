@@ -11,6 +11,15 @@
 #include "singleton.h"
 #include "aspect_aop.h"
 #include "any.h"
+#include "parallel.h"
+#include "task_group.h"
+#include "coroutine.h"
+#include "task_graph.h"
+#include "strand.h"
+#include "keyed_executor.h"
+#include "fiber.h"
+#include "pipeline.h"
+#include "task_coalescer.h"
 
 namespace test {
 
@@ -32,6 +41,56 @@ namespace test {
     void testScopeGuard();
 
     void testAny();
+
+    void benchWorkStealing();
+
+    void benchLockFreeQueue();
+
+    void testTaskAllocation();
+
+    void benchPost();
+
+    void benchBulkSubmit();
+
+    void benchParallel();
+
+    void benchPriority();
+
+    void testTimerWheel();
+
+    void testElasticPool();
+
+    void benchWakeup();
+
+    void testAffinity();
+
+    void testContinuation();
+
+    void testTaskGroup();
+
+    void testCoroutine();
+
+    void benchTaskGraph();
+
+    void benchCancellation();
+
+    void testBoundedQueue();
+
+    void testShutdown();
+
+    void benchLifoSlot();
+
+    void benchStrand();
+
+    void benchKeyedExecutor();
+
+    void benchFibers();
+
+    void benchPipeline();
+
+    void benchTenants();
+
+    void benchMicroTasks();
 }
 
 #endif // TEST_H
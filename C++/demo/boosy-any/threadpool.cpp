@@ -1,47 +1,1195 @@
 #include "threadpool.h"
+#include <iostream>
+#include <algorithm>
+#include <time.h>
 
-YHL::thread_pool::thread_pool(const size_t init_size)
-        :stop(false) {
-    for(size_t i = 0; i <init_size; ++i)
+namespace {
+    // low_latency 的等待时间 : 先 pause 这么久, 再 yield 这么久
+    constexpr std::chrono::microseconds spin_for(20);
+    constexpr std::chrono::microseconds yield_for(80);
+
+    // 连续从 LIFO 槽取了这么多个任务, 就让全局队列先走一个, 防止互相提交的任务一直霸占这个线程
+    constexpr size_t max_slot_streak = 16;
+
+    inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+    }
+
+    int64_t steady_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 当前线程用掉的 CPU 时间, 线程被抢占的时间不算
+    int64_t thread_cpu_ns() {
+        timespec now;
+        ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    }
+
+    // 租户的任务里嵌套执行的租户任务一共用了多少 CPU 时间, 外层记账时要减掉
+    thread_local int64_t nested_cpu = 0;
+}
+
+thread_local YHL::thread_pool* YHL::thread_pool::local_pool = nullptr;
+thread_local YHL::thread_pool::worker_queue* YHL::thread_pool::local_queue = nullptr;
+thread_local YHL::thread_pool::tenant_ticket YHL::thread_pool::popped = { nullptr, 0 };
+
+YHL::thread_pool::thread_pool(const size_t init_size, const pool_options& _options)
+        : stop(false), draining(false), workers(0), options(_options),
+          cpu_plan(plan_placement(_options.placement == cpu_placement::none
+                                  ? std::vector<cpu_info>() : read_cpu_topology(),
+                                  _options.placement, _options.reserved_cpus)),
+          placed(0),
+          slots(new std::atomic<worker_queue*>[max_workers]),
+          slot_count(0), pending(0), pinned_pending(0), sleepers(0), spinners(0), next_queue(0),
+          ring(_options.mode == schedule_mode::lock_free_queue
+               ? new mpmc_queue< unique_task >(_options.queue_capacity) : nullptr),
+          blocks(std::make_shared<task_block_pool>()),
+          gate(std::make_shared<executor_gate>()),
+          on_exception([](std::exception_ptr error) {
+              try {
+                  std::rethrow_exception(error);
+              }
+              catch(const std::exception& e) {
+                  std::cerr << "unhandled exception in thread_pool task : " << e.what() << "\n";
+              }
+              catch(...) {
+                  std::cerr << "unhandled exception in thread_pool task\n";
+              }
+          }),
+          lane_pending(0), lane_turn(0), tenant_pending(0), waiting_producers(0),
+          blocked_count(0), rejected_count(0), caller_ran_count(0), dropped_count(0),
+          generation(std::make_shared<detail::cancel_state>()), last_idle(steady_ns()), spawning(false) {
+    for(size_t i = 0; i < max_workers; ++i)
+        this->slots[i].store(nullptr);
+    for(size_t i = 0; i <init_size; ++i) {
         this->pool.emplace_back(get_task());
+        ++this->workers;
+    }
 }
 
-// 获取一个线程
+// 获取一个线程 : 先登记这个线程的队列, 再启动线程
 std::function<void()> YHL::thread_pool::get_task() {
-    auto task = [this] {
-        for(;;) {    // 实现线程池的关键 : 每个线程轮询队列是否有未处理的任务
-            std::function<void()> cur;
-            do{
-                std::unique_lock<std::mutex> lck(this->mtx);
-                this->cv.wait(lck, [this]{ return this->stop || !this->tasks.empty();});
+    return this->make_worker(this->claim_queue());
+}
+
+std::function<void()> YHL::thread_pool::make_worker(worker_queue *queue) {
+    // 绑核失败就不绑, 线程照样运行
+    const int cpu = this->cpu_plan.empty() ? -1 : this->cpu_plan[this->placed++ % this->cpu_plan.size()];
+    if(this->options.mode == schedule_mode::shared_queue)
+        return [this, cpu, queue] { pin_current_thread(cpu); this->run_shared(queue); };
+    if(this->options.mode == schedule_mode::lock_free_queue)
+        return [this, cpu, queue] { pin_current_thread(cpu); this->run_lock_free(queue); };
+    return [this, cpu, queue] { pin_current_thread(cpu); this->run_stealing(queue); };
+}
+
+// 有退出的线程留下的队列就接着用, 没有再新建一个
+YHL::thread_pool::worker_queue* YHL::thread_pool::claim_queue() {
+    std::lock_guard<std::mutex> lck(this->mtx);
+    for(auto& one : this->owned) {
+        std::lock_guard<std::mutex> guard(one->mtx);
+        if(not one->alive) {
+            one->alive = true;
+            return one.get();
+        }
+    }
+    const size_t index = this->slot_count.load();
+    if(index == max_workers)
+        throw std::length_error("too many workers in thread_pool\n");
+    this->owned.emplace_back(new worker_queue);
+    worker_queue *queue = this->owned.back().get();
+    // 批量缓冲一次最多放 max_batch - 1 个, 先备好, 取批量时不用扩容
+    if(this->options.mode == schedule_mode::shared_queue and this->options.max_batch > 1)
+        queue->batch.reserve(this->options.max_batch);
+    this->slots[index].store(queue);
+    this->slot_count.store(index + 1);
+    return queue;
+}
+
+void YHL::thread_pool::run_shared(worker_queue *slot) {
+    local_pool = this;
+    local_queue = slot;
+    for(;;) {    // 实现线程池的关键 : 每个线程轮询队列是否有未处理的任务
+        if(this->halted()) {
+            this->exiting();
+            return;
+        }
+        unique_task cur;
+        if(this->pop_priority(cur, false) or this->pop_pinned(slot, cur)
+                or this->pop_slot(slot, cur) or this->pop_batch(slot, cur) or this->pop_shared(slot, cur)
+                or this->pop_tenant(cur)
+                or this->steal(slot, cur) or this->pop_priority(cur, true)) {
+            this->run_task(cur);  // 本次任务结束, 继续轮询任务队列，把可以执行的任务放到线程中
+            continue;
+        }
+        if(not this->park())
+            return;
+    }
+}
+
+// 工作线程先看自己的队列或者 LIFO 槽（通常是刚拆出来的子任务）, 再看全局队列, 最后去偷; 外部线程没有自己的队列
+bool YHL::thread_pool::try_run_one() {
+    unique_task cur;
+    worker_queue *self = local_pool == this ? local_queue : nullptr;
+    bool found = this->pop_priority(cur, false) or this->pop_pinned(self, cur)
+            or (self not_eq nullptr and this->pop_local(self, cur));
+    if(not found and this->options.mode == schedule_mode::shared_queue)
+        found = this->pop_batch(self, cur) or this->pop_shared(self, cur);
+    if(not found and this->options.mode == schedule_mode::lock_free_queue) {
+        found = this->ring->try_pop(cur);
+        if(found)
+            --this->pending;
+    }
+    if(not found)
+        found = this->pop_tenant(cur) or this->steal(self, cur);
+    if(not found and not this->pop_priority(cur, true))
+        return false;
+    this->run_task(cur);
+    return true;
+}
+
+// 工作线程一次加锁取一批 : 第一个直接执行, 其余的放进自己的批量缓冲; 外部线程一次取一个
+bool YHL::thread_pool::pop_shared(worker_queue *self, unique_task& cur) {
+    const size_t limit = self == nullptr ? 1 : this->batch_limit(self);
+    std::lock_guard<std::mutex> lck(this->mtx);
+    if(this->tasks.empty()) {
+        if(self not_eq nullptr)
+            self->batch_taken = 0;     // 接下来可能空闲, 这段时间不算进任务耗时
+        return false;
+    }
+    cur = std::move(this->tasks.front());
+    this->tasks.pop_front();
+    --this->pending;
+    if(self == nullptr)
+        return true;
+    // 最多拿走剩下的任务里自己的那一份, 其他线程也有得取
+    const size_t share = this->tasks.size() / std::max<size_t>(this->workers.load(), 1);
+    const size_t extra = std::min(limit - 1, share);
+    if(extra > 0) {
+        std::lock_guard<std::mutex> guard(self->mtx);
+        for(size_t i = 0;i < extra; ++i) {
+            self->batch.emplace_back(std::move(this->tasks.front()));
+            this->tasks.pop_front();
+        }
+        self->batch_count += extra;
+    }
+    self->batch_taken = extra + 1;
+    return true;
+}
+
+// 批量缓冲里的任务按取出的顺序执行; pending 在这里才减
+bool YHL::thread_pool::pop_batch(worker_queue *self, unique_task& cur) {
+    if(self == nullptr or self->batch_count.load() == 0)
+        return false;
+    std::lock_guard<std::mutex> lck(self->mtx);
+    if(self->batch.empty())
+        return false;
+    cur = std::move(self->batch.front());
+    self->batch.pop_front();
+    --self->batch_count;
+    --this->pending;
+    return true;
+}
+
+// 缓冲取空了才会走到这里, 距离上一批开始的时间就是这一批的耗时, 用它更新每个任务的估计
+// 这一批最多取多少 : 估计的总耗时不超过 batch_budget, 长任务一次一个
+size_t YHL::thread_pool::batch_limit(worker_queue *self) {
+    if(this->options.max_batch <= 1)
+        return 1;
+    const int64_t now = steady_ns();
+    if(self->batch_taken > 0) {
+        const double per_task = static_cast<double>(now - self->batch_since) / self->batch_taken;
+        self->task_ns = self->task_ns == 0 ? per_task : self->task_ns + (per_task - self->task_ns) / 4;
+    }
+    self->batch_since = now;
+    double limit = static_cast<double>(this->options.max_batch);
+    if(self->task_ns > 0) {
+        const double budget = static_cast<double>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(this->options.batch_budget).count());
+        limit = std::min(limit, budget / self->task_ns);
+    }
+    return std::max<size_t>(static_cast<size_t>(limit), 1);
+}
+
+// LIFO 槽里的任务多半是刚刚从这个线程提交的, 接着执行; 连续取太多次就让全局队列先走一个
+bool YHL::thread_pool::pop_slot(worker_queue *slot, unique_task& cur) {
+    if(slot == nullptr)
+        return false;
+    if(slot->streak >= max_slot_streak or not this->pop_local(slot, cur)) {
+        slot->streak = 0;
+        return false;
+    }
+    ++slot->streak;
+    return true;
+}
+
+// 指定给这个线程的任务, 先进先出
+bool YHL::thread_pool::pop_pinned(worker_queue *self, unique_task& cur) {
+    if(self == nullptr or self->pinned_count.load() == 0)
+        return false;
+    std::lock_guard<std::mutex> lck(self->mtx);
+    if(self->pinned.empty())
+        return false;
+    cur = std::move(self->pinned.front());
+    self->pinned.pop_front();
+    --self->pinned_count;
+    --this->pinned_pending;
+    return true;
+}
+
+void YHL::thread_pool::run_stealing(worker_queue *queue) {
+    local_pool = this;
+    local_queue = queue;
+    for(;;) {
+        if(this->halted()) {
+            this->exiting();
+            return;
+        }
+        unique_task cur;
+        if(this->pop_priority(cur, false) or this->pop_pinned(queue, cur) or this->pop_local(queue, cur)
+                or this->pop_tenant(cur) or this->steal(queue, cur) or this->pop_priority(cur, true)) {
+            this->run_task(cur);
+            continue;
+        }
+        if(not this->park())
+            return;
+    }
+}
+
+void YHL::thread_pool::run_lock_free(worker_queue *slot) {
+    local_pool = this;
+    local_queue = slot;
+    for(;;) {
+        if(this->halted()) {
+            this->exiting();
+            return;
+        }
+        unique_task cur;
+        if(this->pop_priority(cur, false) or this->pop_pinned(slot, cur) or this->pop_slot(slot, cur)) {
+            this->run_task(cur);
+            continue;
+        }
+        if(this->ring->try_pop(cur)) {
+            --this->pending;
+            this->run_task(cur);
+            continue;
+        }
+        if(this->pop_tenant(cur) or this->steal(slot, cur) or this->pop_priority(cur, true)) {
+            this->run_task(cur);
+            continue;
+        }
+        if(not this->park())
+            return;
+    }
+}
+
+// enqueue / submit 的异常都存进了共享状态, 能跑到这里的只有 post 的任务
+void YHL::thread_pool::run_task(unique_task& task) {
+    // 任务已经出队, 有界队列空出了一个位置
+    if(this->waiting_producers.load() > 0) {
+        { std::lock_guard<std::mutex> lck(this->space_mtx); }
+        this->space_cv.notify_all();
+    }
+    // 租户的任务要记 CPU 时间; 先把出队时的记录取走, 任务里 try_run_one 还会出队别的任务
+    const tenant_ticket ticket = popped;
+    popped.owner = nullptr;
+    int64_t start = 0, outer = 0;
+    if(ticket.owner not_eq nullptr) {
+        start = thread_cpu_ns();
+        outer = nested_cpu;
+        nested_cpu = 0;
+    }
+    try {
+        task();
+    }
+    catch(...) {
+        exception_handler handler;
+        {
+            std::lock_guard<std::mutex> lck(this->handler_mtx);
+            handler = this->on_exception;
+        }
+        if(handler)
+            handler(std::current_exception());
+    }
+    if(ticket.owner not_eq nullptr) {
+        const int64_t total = thread_cpu_ns() - start;
+        this->charge(ticket, std::max<int64_t>(total - nested_cpu, 0));
+        nested_cpu = outer + total;
+    }
+}
+
+void YHL::thread_pool::reserve_futures(const size_t n) {
+    this->blocks->reserve(n);
+}
+
+YHL::task_executor YHL::thread_pool::executor() noexcept {
+    task_executor res;
+    res.post = &thread_pool::post_continuation;
+    res.context = this;
+    res.gate = this->gate;
+    return res;
+}
+
+void YHL::thread_pool::post_continuation(void *pool, unique_task&& task) {
+    static_cast<thread_pool*>(pool)->push_task(std::move(task));
+}
 
-                if(this->stop or this->tasks.empty())
-                    return;
+std::shared_ptr<const YHL::detail::cancel_state> YHL::thread_pool::current_generation() {
+    std::lock_guard<std::mutex> lck(this->cancel_mtx);
+    return this->generation;
+}
+
+// 旧的标志置位后换一个新的 : 已经提交的都看到取消, 之后提交的拿到新标志
+void YHL::thread_pool::cancel_all() {
+    std::lock_guard<std::mutex> lck(this->cancel_mtx);
+    this->generation->cancelled.store(true, std::memory_order_release);
+    this->generation = std::make_shared<detail::cancel_state>();
+}
+
+void YHL::thread_pool::set_exception_handler(exception_handler handler) {
+    std::lock_guard<std::mutex> lck(this->handler_mtx);
+    this->on_exception = std::move(handler);
+}
+
+size_t YHL::thread_pool::queued() const noexcept {
+    return this->pending.load() + this->lane_pending.load() + this->pinned_pending.load()
+        + this->tenant_pending.load();
+}
 
-                cur = std::move(this->tasks.front());
-                this->tasks.pop();
-            } while(0);
+// 这个线程有没有可以执行的任务 : 别人的 pinned 队列不算
+bool YHL::thread_pool::has_work(const worker_queue *self) const noexcept {
+    return this->pending.load() > 0 or this->lane_pending.load() > 0 or this->tenant_pending.load() > 0
+        or (self not_eq nullptr and self->pinned_count.load() > 0);
+}
 
-            cur();  // 本次任务结束, 继续轮询任务队列，把可以执行的任务放到线程中
+// 公开的提交接口入队之前先经过这里, 返回 false 表示任务已经在这里执行掉了, 不用再入队
+// nonblocking（try_enqueue）: 没有空位就记一次 rejected 返回 false, 任务没有执行, 不管 overflow 是什么策略
+// 计数和入队不是原子的, 多个提交方同时进来时队列长度可能略微超过 max_queued
+bool YHL::thread_pool::admit(unique_task *batch, const size_t count, const bool nonblocking) {
+    const size_t capacity = this->options.max_queued;
+    if(capacity == 0 or local_pool == this)
+        return true;
+    // 一批比容量还大的任务, 等队列空了再整批放进去
+    const auto has_room = [this, capacity, count]{
+        const size_t now = this->queued();
+        return now + count <= capacity or now == 0;
+    };
+    if(has_room())
+        return true;
+    if(nonblocking) {
+        ++this->rejected_count;
+        return false;
+    }
+
+    switch(this->options.overflow) {
+    case overflow_policy::block: {
+        ++this->blocked_count;
+        std::unique_lock<std::mutex> lck(this->space_mtx);
+        ++this->waiting_producers;
+        const auto ready = [this, &has_room]{ return stop or has_room(); };
+        bool ok = true;
+        if(this->options.block_timeout.count() > 0)
+            ok = this->space_cv.wait_for(lck, this->options.block_timeout, ready);
+        else
+            this->space_cv.wait(lck, ready);
+        --this->waiting_producers;
+        if(not ok) {
+            ++this->rejected_count;
+            throw queue_full();
+        }
+        return true;     // 线程池停止了的话, 入队时会抛出异常
+    }
+    case overflow_policy::reject:
+        ++this->rejected_count;
+        throw queue_full();
+    case overflow_policy::caller_runs:
+        this->caller_ran_count += count;
+        for(size_t i = 0;i < count; ++i)
+            this->run_task(batch[i]);
+        return false;
+    case overflow_policy::drop_oldest: {
+        const size_t now = this->queued();
+        size_t excess = now + count > capacity ? now + count - capacity : 0;
+        while(excess > 0 and this->drop_oldest())
+            --excess;
+        return true;
+    }
+    }
+    return true;
+}
+
+// 先丢普通队列里最老的任务, 再丢租户队列, 然后是 low, 最后才是 high; 被丢掉的任务在锁外析构, 它可能要设置 future
+// 租户队列丢虚拟时间最大的那个租户（用得最多的）排在最前面的任务
+bool YHL::thread_pool::drop_oldest() {
+    unique_task victim;
+    bool found = false;
+    if(this->options.mode == schedule_mode::shared_queue) {
+        // 批量缓冲里的任务比全局队列里的都早出队
+        const size_t n = this->slot_count.load();
+        for(size_t i = 0;i < n and not found; ++i) {
+            worker_queue *queue = this->slots[i].load();
+            if(queue->batch_count.load() == 0)
+                continue;
+            std::lock_guard<std::mutex> lck(queue->mtx);
+            if(not queue->batch.empty()) {
+                victim = std::move(queue->batch.front());
+                queue->batch.pop_front();
+                --queue->batch_count;
+                found = true;
+            }
+        }
+        std::lock_guard<std::mutex> lck(this->mtx);
+        if(not found and not this->tasks.empty()) {
+            victim = std::move(this->tasks.front());
+            this->tasks.pop_front();
+            found = true;
+        }
+    }
+    else if(this->options.mode == schedule_mode::lock_free_queue)
+        found = this->ring->try_pop(victim);
+    else {
+        // 各个队列的头部都是自己队列里最老的, 取第一个不空的
+        const size_t n = this->slot_count.load();
+        for(size_t i = 0;i < n and not found; ++i) {
+            worker_queue *queue = this->slots[i].load();
+            std::lock_guard<std::mutex> lck(queue->mtx);
+            if(not queue->tasks.empty()) {
+                victim = std::move(queue->tasks.front());
+                queue->tasks.pop_front();
+                found = true;
+            }
+        }
+    }
+    if(found)
+        --this->pending;
+    if(not found and this->tenant_pending.load() > 0) {
+        std::lock_guard<std::mutex> lck(this->tenant_mtx);
+        tenant_queue *owner = nullptr;
+        for(auto& one : this->tenants) {
+            if(not one->tasks.empty() and (owner == nullptr or one->vtime > owner->vtime))
+                owner = one.get();
+        }
+        if(owner not_eq nullptr) {
+            victim = std::move(owner->tasks.front());
+            owner->tasks.pop_front();
+            --this->tenant_pending;
+            found = true;
         }
+    }
+    if(not found) {
+        std::lock_guard<std::mutex> lck(this->lane_mtx);
+        for(auto lane : { &this->lanes[1], &this->lanes[0] }) {
+            if(not lane->empty()) {
+                victim = std::move(lane->front().task);
+                lane->pop_front();
+                --this->lane_pending;
+                found = true;
+                break;
+            }
+        }
+    }
+    if(found)
+        ++this->dropped_count;
+    return found;
+}
+
+// 把所有队列里的任务取出来, 在锁外析构; 返回取出的个数
+size_t YHL::thread_pool::discard_queued() {
+    std::vector< unique_task > dropped;
+    {
+        std::lock_guard<std::mutex> lck(this->mtx);
+        while(not this->tasks.empty()) {
+            dropped.emplace_back(std::move(this->tasks.front()));
+            this->tasks.pop_front();
+            --this->pending;
+        }
+    }
+    if(this->ring) {
+        unique_task one;
+        while(this->ring->try_pop(one)) {
+            dropped.emplace_back(std::move(one));
+            --this->pending;
+        }
+    }
+    const size_t n = this->slot_count.load();
+    for(size_t i = 0;i < n; ++i) {
+        worker_queue *queue = this->slots[i].load();
+        std::lock_guard<std::mutex> lck(queue->mtx);
+        for(auto& one : queue->tasks)
+            dropped.emplace_back(std::move(one));
+        this->pending -= queue->tasks.size();
+        queue->tasks.clear();
+        for(auto& one : queue->pinned)
+            dropped.emplace_back(std::move(one));
+        queue->pinned_count -= queue->pinned.size();
+        this->pinned_pending -= queue->pinned.size();
+        queue->pinned.clear();
+        queue->batch_count -= queue->batch.size();
+        this->pending -= queue->batch.size();
+        while(not queue->batch.empty()) {
+            dropped.emplace_back(std::move(queue->batch.front()));
+            queue->batch.pop_front();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lck(this->lane_mtx);
+        for(auto& lane : this->lanes) {
+            for(auto& one : lane)
+                dropped.emplace_back(std::move(one.task));
+            this->lane_pending -= lane.size();
+            lane.clear();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lck(this->tenant_mtx);
+        for(auto& one : this->tenants) {
+            for(auto& task : one->tasks)
+                dropped.emplace_back(std::move(task));
+            this->tenant_pending -= one->tasks.size();
+            one->tasks.clear();
+        }
+    }
+    return dropped.size();
+}
+
+YHL::overflow_stats YHL::thread_pool::overflow_counters() const noexcept {
+    overflow_stats res;
+    res.blocked = this->blocked_count.load();
+    res.rejected = this->rejected_count.load();
+    res.caller_ran = this->caller_ran_count.load();
+    res.dropped = this->dropped_count.load();
+    return res;
+}
+
+// 自旋等任务, 等到了返回 true; 单核机器上 pause 只会挡住提交任务的线程, 直接 yield
+bool YHL::thread_pool::spin() {
+    static const bool multicore = std::thread::hardware_concurrency() > 1;
+    const size_t limit = std::max<size_t>(this->workers.load() / 2, 1);
+    if(this->spinners.fetch_add(1) >= limit) {
+        --this->spinners;
+        return false;
+    }
+    bool found = false;
+    const auto start = std::chrono::steady_clock::now();
+    for(;;) {
+        if(this->has_work(local_queue)) {
+            found = true;
+            break;
+        }
+        const auto spent = std::chrono::steady_clock::now() - start;
+        if(spent >= spin_for + yield_for or stop)
+            break;
+        if(multicore and spent < spin_for) {
+            for(int i = 0;i < 16; ++i)
+                cpu_relax();
+        }
+        else
+            std::this_thread::yield();
+    }
+    --this->spinners;
+    return found;
+}
+
+// 所有队列都空了才睡眠; sleepers 和 pending 配合, 保证不会丢失唤醒
+// 返回 false 表示这个线程该退出了 : 线程池已经停止, 或者空闲太久被回收
+bool YHL::thread_pool::park() {
+    this->last_idle.store(steady_ns());
+    if(this->options.idle == idle_policy::low_latency and this->spin())
+        return true;
+    worker_queue *self = local_queue;
+    std::unique_lock<std::mutex> lck(this->mtx);
+    const auto ready = [this, self]{
+        return this->stop || this->has_work(self);
     };
-    return task;
+    ++this->sleepers;
+    if(self not_eq nullptr)
+        self->sleeping = true;
+    bool idle = false;
+    if(this->options.idle_timeout.count() > 0)
+        idle = not this->cv.wait_for(lck, this->options.idle_timeout, ready) and this->retire();
+    if(not idle)
+        this->cv.wait(lck, ready);   // 不能退出的线程（已经是 min_threads 个）接着睡
+    if(self not_eq nullptr)
+        self->sleeping = false;
+    --this->sleepers;
+    if(idle) {
+        lck.unlock();
+        std::lock_guard<std::mutex> guard(this->pool_mtx);
+        this->retired.emplace_back(std::this_thread::get_id());
+        return false;
+    }
+    if(not this->stop or (this->draining and this->has_work(self)))
+        return true;
+    lck.unlock();
+    return this->exiting();
+}
+
+// stop 之后不再接受提交; drain 期间工作线程自己提交的子任务除外, 不然执行中的任务可能半途失败
+bool YHL::thread_pool::closed() const noexcept {
+    return this->stop and not (this->draining and local_pool == this);
+}
+
+// 不 drain 的 shutdown : 执行完手上的任务就退出, 不再取新的
+bool YHL::thread_pool::halted() const noexcept {
+    return this->stop and not this->draining;
+}
+
+// 线程因为 stop 退出, 告诉 shutdown; 返回 false 方便 park 直接返回
+bool YHL::thread_pool::exiting() {
+    --this->workers;
+    {
+        std::lock_guard<std::mutex> lck(this->exit_mtx);
+    }
+    this->exit_cv.notify_all();
+    return false;
+}
+
+// 持有 mtx 时调用; 线程数减一, 工作窃取模式下把自己的队列标记为无主
+bool YHL::thread_pool::retire() {
+    size_t count = this->workers.load();
+    const size_t low = std::max<size_t>(this->options.min_threads, 1);
+    do {
+        if(count <= low)
+            return false;
+    } while(not this->workers.compare_exchange_weak(count, count - 1));
+    if(local_pool == this and local_queue not_eq nullptr) {
+        std::lock_guard<std::mutex> guard(local_queue->mtx);
+        if(not local_queue->tasks.empty() or not local_queue->pinned.empty() or not local_queue->batch.empty()) {    // 刚刚有人放了任务进来, 不走了
+            ++this->workers;
+            return false;
+        }
+        local_queue->alive = false;
+    }
+    return true;
+}
+
+// 持有 pool_mtx 时调用, join 已经退出的线程
+void YHL::thread_pool::reap() {
+    if(this->retired.empty())
+        return;
+    for(auto it = this->pool.begin(); it not_eq this->pool.end(); ) {
+        if(std::find(this->retired.begin(), this->retired.end(), it->get_id()) not_eq this->retired.end()) {
+            it->join();
+            it = this->pool.erase(it);
+        }
+        else
+            ++it;
+    }
+    this->retired.clear();
+}
+
+// 所有线程都忙了 spawn_delay 这么久, 新的任务只能排队, 加一个线程
+void YHL::thread_pool::grow() {
+    if(this->options.max_threads == 0 or this->sleepers.load() > 0 or this->spinners.load() > 0)
+        return;
+    if(this->workers.load() >= this->options.max_threads)
+        return;
+    const int64_t now = steady_ns();
+    const int64_t delay = std::chrono::duration_cast<std::chrono::nanoseconds>(this->options.spawn_delay).count();
+    if(now - this->last_idle.load() < delay or this->spawning.exchange(true))
+        return;
+    try {
+        std::lock_guard<std::mutex> lck(this->pool_mtx);
+        if(not stop and this->workers.load() < this->options.max_threads) {
+            this->reap();
+            this->pool.emplace_back(get_task());
+            ++this->workers;
+        }
+    }
+    catch(...) {
+        // 加不了线程也不影响这次提交, 现有的线程迟早会执行它
+    }
+    this->last_idle.store(now);   // 新线程跑起来之后, 再观察一个 spawn_delay
+    this->spawning = false;
+}
+
+// 优先级队列 : include_low 为 false 时只取 high、等太久的 low, 以及 weighted 轮到的 low
+// 普通队列空了之后再以 include_low 为 true 调用, 把剩下的 low 也取出来
+bool YHL::thread_pool::pop_priority(unique_task& cur, const bool include_low) {
+    if(this->lane_pending.load() == 0)
+        return false;
+    std::lock_guard<std::mutex> lck(this->lane_mtx);
+    auto& high = this->lanes[0];
+    auto& low = this->lanes[1];
+    std::deque<lane_task> *from = nullptr;
+    if(not high.empty())
+        from = &high;
+    if(not low.empty()) {
+        const bool aged = std::chrono::steady_clock::now() - low.front().since >= this->options.aging;
+        const bool turn = this->options.priority == priority_policy::weighted
+                and ++this->lane_turn % std::max<size_t>(this->options.low_share, 1) == 0;
+        if(aged or turn or (from == nullptr and include_low))
+            from = &low;
+    }
+    if(from == nullptr)
+        return false;
+    cur = std::move(from->front().task);
+    from->pop_front();
+    --this->lane_pending;
+    return true;
+}
+
+YHL::tenant_id YHL::thread_pool::add_tenant(const size_t weight) {
+    std::lock_guard<std::mutex> lck(this->tenant_mtx);
+    this->tenants.emplace_back(new tenant_queue);
+    this->tenants.back()->weight = std::max<size_t>(weight, 1);
+    this->tenants.back()->vtime = this->virtual_now;
+    return this->tenants.size() - 1;
+}
+
+void YHL::thread_pool::set_weight(const tenant_id tenant, const size_t weight) {
+    std::lock_guard<std::mutex> lck(this->tenant_mtx);
+    if(tenant >= this->tenants.size())
+        throw std::out_of_range("unknown tenant in thread_pool\n");
+    this->tenants[tenant]->weight = std::max<size_t>(weight, 1);
+}
+
+YHL::tenant_stats YHL::thread_pool::tenant_usage(const tenant_id tenant) {
+    std::lock_guard<std::mutex> lck(this->tenant_mtx);
+    if(tenant >= this->tenants.size())
+        throw std::out_of_range("unknown tenant in thread_pool\n");
+    const tenant_queue& one = *this->tenants[tenant];
+    tenant_stats res;
+    res.weight = one.weight;
+    res.queued = one.tasks.size();
+    res.completed = one.completed;
+    res.cpu_time = std::chrono::nanoseconds(one.cpu_ns);
+    return res;
+}
+
+// 空闲了一阵的租户从当前的虚拟时间起步, 闲着的时候不攒额度, 回来之后也不会一下子占满所有线程
+void YHL::thread_pool::push_tenant(const tenant_id tenant, unique_task&& task) {
+    {
+        std::lock_guard<std::mutex> lck(this->tenant_mtx);
+        if(this->closed())
+            throw std::runtime_error("enqueue task on stopped pool\n");
+        if(tenant >= this->tenants.size())
+            throw std::out_of_range("unknown tenant in thread_pool\n");
+        tenant_queue& one = *this->tenants[tenant];
+        if(one.tasks.empty())
+            one.vtime = std::max(one.vtime, this->virtual_now);
+        one.tasks.emplace_back(std::move(task));
+        ++this->tenant_pending;
+    }
+    this->wake_one();
+    this->grow();
+}
+
+// 取虚拟时间最小的租户; 先按估计值记账, 否则几个线程同时出队会挑中同一个租户
+bool YHL::thread_pool::pop_tenant(unique_task& cur) {
+    if(this->tenant_pending.load() == 0)
+        return false;
+    std::lock_guard<std::mutex> lck(this->tenant_mtx);
+    tenant_queue *next = nullptr;
+    for(auto& one : this->tenants) {
+        if(not one->tasks.empty() and (next == nullptr or one->vtime < next->vtime))
+            next = one.get();
+    }
+    if(next == nullptr)
+        return false;
+    cur = std::move(next->tasks.front());
+    next->tasks.pop_front();
+    --this->tenant_pending;
+    this->virtual_now = next->vtime;
+    next->vtime += next->estimate / next->weight;
+    popped = tenant_ticket{ next, next->estimate };
+    return true;
+}
+
+// 执行完按实际用掉的 CPU 时间修正虚拟时间
+void YHL::thread_pool::charge(const tenant_ticket& ticket, const int64_t spent) {
+    std::lock_guard<std::mutex> lck(this->tenant_mtx);
+    tenant_queue *one = ticket.owner;
+    one->vtime += (spent - ticket.charged) / one->weight;
+    one->estimate += (spent - one->estimate) / 8;
+    one->cpu_ns += spent;
+    ++one->completed;
+}
+
+// 自己的队列 : 从尾部取, 刚放进去的任务缓存还热
+bool YHL::thread_pool::pop_local(worker_queue *queue, unique_task& cur) {
+    std::lock_guard<std::mutex> lck(queue->mtx);
+    if(queue->tasks.empty())
+        return false;
+    cur = std::move(queue->tasks.back());
+    queue->tasks.pop_back();
+    --this->pending;
+    return true;
+}
+
+// 别人的队列 : 从头部偷, 和主人错开两端
+bool YHL::thread_pool::steal(worker_queue *self, unique_task& cur) {
+    if(this->pending.load() == 0)
+        return false;
+    const size_t n = this->slot_count.load();
+    const size_t start = this->next_queue++;
+    for(size_t i = 0; i < n; ++i) {
+        worker_queue *victim = this->slots[(start + i) % n].load();
+        if(victim == self)
+            continue;
+        std::unique_lock<std::mutex> lck(victim->mtx, std::try_to_lock);
+        if(not lck.owns_lock())
+            continue;
+        if(not victim->tasks.empty()) {
+            cur = std::move(victim->tasks.front());
+            victim->tasks.pop_front();
+        }
+        else if(not victim->batch.empty()) {     // shared_queue 模式下别人一次多取的任务
+            cur = std::move(victim->batch.front());
+            victim->batch.pop_front();
+            --victim->batch_count;
+        }
+        else
+            continue;
+        --this->pending;
+        return true;
+    }
+    return false;
+}
+
+void YHL::thread_pool::wake_one() {
+    if(this->sleepers.load() == 0)
+        return;
+    { std::lock_guard<std::mutex> lck(this->mtx); }
+    this->cv.notify_one();
+}
+
+void YHL::thread_pool::push_task(unique_task&& task, const bool lifo) {
+    // 工作线程提交的任务放进自己的 LIFO 槽; 槽里原来的任务挪到全局队列, 走下面的普通路径
+    if(lifo and this->options.lifo_slot and this->options.mode not_eq schedule_mode::work_stealing
+            and local_pool == this and local_queue not_eq nullptr) {
+        if(this->closed())
+            throw std::runtime_error("enqueue task on stopped pool\n");
+        unique_task evicted;
+        {
+            std::lock_guard<std::mutex> lck(local_queue->mtx);
+            if(not local_queue->tasks.empty()) {
+                evicted = std::move(local_queue->tasks.back());
+                local_queue->tasks.pop_back();
+            }
+            local_queue->tasks.emplace_back(std::move(task));
+            if(evicted)
+                task = std::move(evicted);
+            else
+                ++this->pending;
+        }
+        if(not task) {
+            this->wake_one();     // 让空闲的线程来偷
+            this->grow();
+            return;
+        }
+    }
+
+    if(this->options.mode == schedule_mode::shared_queue) {
+        {
+            std::unique_lock<std::mutex> lck(this->mtx);
+
+            if(this->closed())
+                throw std::runtime_error("enqueue task on stopped pool\n");
+
+            this->tasks.emplace_back(std::move(task));
+            ++this->pending;
+        }
+        // 入队和 sleepers 都在 mtx 下, 没有线程在睡眠就不用 notify
+        if(this->sleepers.load() > 0)
+            this->cv.notify_one();
+        this->grow();
+        return;
+    }
+
+    if(this->closed())
+        throw std::runtime_error("enqueue task on stopped pool\n");
+
+    if(this->options.mode == schedule_mode::lock_free_queue) {
+        // 队列满了就让出 CPU, 等消费者腾出槽位
+        // 工作线程自己不能干等, 否则所有线程都在提交时队列就永远满着, 所以先帮忙执行一个
+        while(not this->ring->try_push(std::move(task))) {
+            if(this->closed())
+                throw std::runtime_error("enqueue task on stopped pool\n");
+            unique_task other;
+            if(local_pool == this and this->ring->try_pop(other)) {
+                --this->pending;
+                this->run_task(other);
+            }
+            else
+                std::this_thread::yield();
+        }
+        ++this->pending;
+        this->wake_one();
+        this->grow();
+        return;
+    }
+
+    // 工作线程提交到自己的队列, 外部线程轮流分配到各个队列
+    {
+        std::unique_lock<std::mutex> lck;
+        worker_queue *target = local_pool == this ? local_queue : nullptr;
+        if(target == nullptr)
+            target = this->lock_target(lck);
+        else
+            lck = std::unique_lock<std::mutex>(target->mtx);
+        target->tasks.emplace_back(std::move(task));
+        ++this->pending;
+    }
+    this->wake_one();
+    this->grow();
+}
+
+// 执行了一批之后重新排队的任务（strand、流水线的 drain）: 不进 LIFO 槽, 否则马上又轮到它, 别的任务一直排在后面
+// 工作窃取模式下放在自己队列的头部, 自己最后才取, 别的线程先偷它
+void YHL::thread_pool::requeue(unique_task&& task) {
+    if(this->options.mode not_eq schedule_mode::work_stealing or local_pool not_eq this or local_queue == nullptr) {
+        this->push_task(std::move(task), false);
+        return;
+    }
+    if(this->closed())
+        throw std::runtime_error("enqueue task on stopped pool\n");
+    {
+        std::lock_guard<std::mutex> lck(local_queue->mtx);
+        local_queue->tasks.emplace_front(std::move(task));
+        ++this->pending;
+    }
+    this->wake_one();
+    this->grow();
+}
+
+// 主人在睡眠才需要唤醒; sleeping 和 pinned_count 配合, 和 sleepers / pending 一样不会丢失唤醒
+// 别的线程也会被 notify_all 叫醒, 它们检查自己的条件之后接着睡
+void YHL::thread_pool::push_pinned(const size_t worker, unique_task&& task) {
+    if(this->closed())
+        throw std::runtime_error("enqueue task on stopped pool\n");
+    const size_t n = this->slot_count.load();
+    if(n == 0)
+        throw std::runtime_error("enqueue task on empty pool\n");
+    worker_queue *target = this->slots[worker % n].load();
+    bool alive = false;
+    {
+        std::lock_guard<std::mutex> lck(target->mtx);
+        target->pinned.emplace_back(std::move(task));
+        ++target->pinned_count;
+        ++this->pinned_pending;
+        alive = target->alive;
+    }
+    if(alive) {
+        if(target->sleeping.load()) {
+            { std::lock_guard<std::mutex> lck(this->mtx); }
+            this->cv.notify_all();
+        }
+        return;
+    }
+    // 主人已经被回收了, 起一个新线程接管这个队列
+    std::lock_guard<std::mutex> lck(this->pool_mtx);
+    if(stop)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(this->mtx);
+        std::lock_guard<std::mutex> queue_guard(target->mtx);
+        if(target->alive)
+            return;
+        target->alive = true;
+    }
+    this->reap();
+    this->pool.emplace_back(this->make_worker(target));
+    ++this->workers;
+}
+
+size_t YHL::thread_pool::pinned_depth(const size_t worker) const {
+    const size_t n = this->slot_count.load();
+    return n == 0 ? 0 : this->slots[worker % n].load()->pinned_count.load();
+}
+
+// 外部线程轮流选一个有主人的队列, 返回时已经加上了它的锁
+YHL::thread_pool::worker_queue* YHL::thread_pool::lock_target(std::unique_lock<std::mutex>& lck) {
+    const size_t n = this->slot_count.load();
+    const size_t start = this->next_queue++;
+    for(size_t i = 0; i < n; ++i) {
+        worker_queue *target = this->slots[(start + i) % n].load();
+        lck = std::unique_lock<std::mutex>(target->mtx);
+        if(target->alive)
+            return target;
+        lck.unlock();
+    }
+    throw std::runtime_error("enqueue task on empty pool\n");
+}
+
+void YHL::thread_pool::push_task(const task_priority priority, unique_task&& task) {
+    if(priority == task_priority::normal) {
+        this->push_task(std::move(task));
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lck(this->lane_mtx);
+        if(this->closed())
+            throw std::runtime_error("enqueue task on stopped pool\n");
+        this->lanes[priority == task_priority::high ? 0 : 1].push_back(
+            lane_task{ std::move(task), std::chrono::steady_clock::now() });
+        ++this->lane_pending;
+    }
+    this->wake_one();
+    this->grow();
+}
+
+// 批量提交 : 每个队列只加一次锁, 唤醒的线程数不超过任务数
+void YHL::thread_pool::push_bulk(unique_task *batch, const size_t count) {
+    if(count == 0)
+        return;
+    if(this->closed())
+        throw std::runtime_error("enqueue task on stopped pool\n");
+
+    if(this->options.mode == schedule_mode::shared_queue) {
+        {
+            std::unique_lock<std::mutex> lck(this->mtx);
+            if(this->closed())
+                throw std::runtime_error("enqueue task on stopped pool\n");
+            for(size_t i = 0;i < count; ++i)
+                this->tasks.emplace_back(std::move(batch[i]));
+            this->pending += count;
+        }
+        this->wake_many(count);
+        this->grow();
+        return;
+    }
+
+    if(this->options.mode == schedule_mode::lock_free_queue) {
+        // 无锁队列本来就不加锁, 逐个放入, 最后统一唤醒
+        size_t pushed = 0;
+        while(pushed < count and this->ring->try_push(std::move(batch[pushed])))
+            ++pushed;
+        this->pending += pushed;
+        this->wake_many(pushed);
+        this->grow();
+        for(size_t i = pushed;i < count; ++i)   // 满了就退回逐个提交, 等待腾出槽位
+            this->push_task(std::move(batch[i]));
+        return;
+    }
+
+    // 工作线程全部放进自己的队列, 让别人来偷; 外部线程把任务平均分到各个队列
+    if(local_pool == this) {
+        {
+            std::lock_guard<std::mutex> lck(local_queue->mtx);
+            for(size_t i = 0;i < count; ++i)
+                local_queue->tasks.emplace_back(std::move(batch[i]));
+            this->pending += count;
+        }
+        this->wake_many(count);
+        this->grow();
+        return;
+    }
+    const size_t n = std::max<size_t>(this->workers.load(), 1);
+    const size_t chunk = (count + n - 1) / n;
+    for(size_t begin = 0; begin < count; begin += chunk) {
+        std::unique_lock<std::mutex> lck;
+        worker_queue *target = this->lock_target(lck);
+        const size_t end = std::min(count, begin + chunk);
+        for(size_t i = begin;i < end; ++i)
+            target->tasks.emplace_back(std::move(batch[i]));
+        this->pending += end - begin;
+    }
+    this->wake_many(count);
+    this->grow();
+}
+
+void YHL::thread_pool::wake_many(const size_t count) {
+    const size_t idle = this->sleepers.load();
+    if(idle == 0 or count == 0)
+        return;
+    { std::lock_guard<std::mutex> lck(this->mtx); }
+    if(count >= idle)
+        this->cv.notify_all();
+    else {
+        for(size_t i = 0;i < count; ++i)
+            this->cv.notify_one();
+    }
 }
 
 // 拓展线程池的容量
 void YHL::thread_pool::add_thread(const size_t extend) {
-    for(size_t i = 0;i < extend; ++i)
+    std::lock_guard<std::mutex> lck(this->pool_mtx);
+    this->reap();
+    for(size_t i = 0;i < extend; ++i) {
         this->pool.emplace_back(get_task());
+        ++this->workers;
+    }
 }
 
-YHL::thread_pool::~thread_pool() {
+size_t YHL::thread_pool::size() const noexcept {
+    return this->workers.load();
+}
+
+YHL::timer_handle YHL::thread_pool::schedule(std::chrono::steady_clock::time_point when,
+                                             std::chrono::nanoseconds period,
+                                             unique_task&& fun) {
+    // shutdown 先置 stop 再拿走定时器, 在锁里看到 stop 还是 false 的话, 定时器一定还在
+    std::lock_guard<std::mutex> lck(this->timer_mtx);
+    if(stop == true)
+        throw std::runtime_error("schedule task on stopped pool\n");
+    if(this->timers == nullptr) {
+        this->timers.reset(new timer_wheel([this](unique_task&& task){
+            this->push_task(std::move(task));
+        }));
+    }
+    return this->timers->add(when, period, std::move(fun));
+}
+
+size_t YHL::thread_pool::shutdown(const drain_policy policy, const std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
     {
         std::unique_lock<std::mutex> lck(this->mtx);
+        if(stop)
+            return 0;
+        this->draining = policy == drain_policy::drain;
         stop = true;
     }
+    // 再停掉定时线程 : 之后的 schedule 都会抛出异常; 还没触发的定时任务在锁外随定时器销毁
+    std::unique_ptr<timer_wheel> wheel;
+    {
+        std::lock_guard<std::mutex> lck(this->timer_mtx);
+        wheel = std::move(this->timers);
+    }
+    wheel.reset();
+    size_t discarded = 0;
+    if(policy not_eq drain_policy::drain)
+        discarded += this->discard_queued();
+    if(policy == drain_policy::abort)
+        this->cancel_all();
     this->cv.notify_all();
-    for(auto &it : pool)
+    {
+        std::lock_guard<std::mutex> lck(this->space_mtx);   // 还在等空位的提交方
+    }
+    this->space_cv.notify_all();
+
+    // 超时 : 不再 drain, 剩下的任务丢掉, 执行中的任务收到取消
+    if(timeout.count() > 0) {
+        std::unique_lock<std::mutex> lck(this->exit_mtx);
+        if(not this->exit_cv.wait_until(lck, deadline, [this]{ return this->workers.load() == 0; })) {
+            lck.unlock();
+            this->draining = false;
+            discarded += this->discard_queued();
+            this->cancel_all();
+            { std::lock_guard<std::mutex> guard(this->mtx); }
+            this->cv.notify_all();
+        }
+    }
+
+    // 不能拿着 pool_mtx join, 任务里的提交可能还要用它加线程
+    std::vector< std::thread > all;
+    {
+        std::lock_guard<std::mutex> lck(this->pool_mtx);
+        all.swap(this->pool);
+    }
+    for(auto &it : all)
         it.join();
-    pool.clear();
-    pool.shrink_to_fit();
+    // 超时那一刻执行中的任务可能又提交了几个
+    return discarded + this->discard_queued();
+}
+
+// 关上 gate 之后, 还没就绪的 future 的后续任务不会再来找这个线程池
+YHL::thread_pool::~thread_pool() {
+    this->shutdown(drain_policy::drain);
+    this->gate->close();
 }
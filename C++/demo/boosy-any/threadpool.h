@@ -1,16 +1,26 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 #include <vector>
-#include <queue>
+#include <iterator>
+#include <deque>
+#include <memory>
 #include <string>
 #include <functional>
 #include <chrono>
+#include <cstdint>
 #include <thread>
 #include <future>
 #include <atomic>
 #include <mutex>
+#include <stdexcept>
 #include <condition_variable>
 #include <boost/noncopyable.hpp>
+#include "mpmc_queue.h"
+#include "unique_task.h"
+#include "task_future.h"
+#include "timer_wheel.h"
+#include "topology.h"
+#include "cancel.h"
 
 /* 使用说明
     YHL::thread_pool pool(4);
@@ -24,59 +34,904 @@
         auto result = pool.enqueue(test::fun);
         std::cout << "answer  :  " << result.get() << std::endl;
     }
+
+    // 工作窃取 : 每个线程一个双端队列, 接口不变
+    YHL::pool_options options;
+    options.mode = YHL::schedule_mode::work_stealing;
+    YHL::thread_pool stealing(4, options);
+
+    // 无锁有界队列 : 容量由构造参数决定, 满了提交方会让出 CPU 等待
+    options.mode = YHL::schedule_mode::lock_free_queue;
+    options.queue_capacity = 4096;
+    YHL::thread_pool lock_free(4, options);
+
+    // submit 和 enqueue 用法一样, 返回 YHL::task_future, 小任务提交时不分配内存
+    auto answer = lock_free.submit([](int x){ return x * 2; }, 21);
+    std::cout << answer.get() << std::endl;
+
+    // then 的后续任务也在这个线程池上执行, 不会有线程阻塞在 get() 上
+    auto twice = lock_free.submit([]{ return 21; }).then([](YHL::task_future<int> x){ return x.get() * 2; });
+
+    // post 不要返回值, 没有 future 也没有共享状态; 抛出的异常交给 exception_handler
+    lock_free.set_exception_handler([](std::exception_ptr error){ ... });
+    lock_free.post([]{ std::cout << "fire and forget\n"; });
+    lock_free.post(test::fun);
+
+    // 批量提交 : 一次加锁放进所有任务, 最多唤醒 min(N, 空闲线程数) 个线程
+    std::vector< std::function<int()> > batch(100, test::fun);
+    auto answers = lock_free.enqueue_bulk(batch.begin(), batch.end());   // 每个任务一个 future
+    auto all_done = lock_free.post_bulk(batch.begin(), batch.end());     // 所有任务共用一个 future
+    all_done.wait();
+
+    // 优先级 : high 总是先于普通任务, low 在没有别的任务时才执行, 等太久会被提升
+    auto urgent = pool.enqueue_with_priority(YHL::task_priority::high, test::fun);
+    pool.post_with_priority(YHL::task_priority::low, []{ std::cout << "batch work\n"; });
+
+    // 定时任务 : 第一次调用时才启动定时线程, 到期后交给工作线程执行
+    auto timeout = pool.schedule_after(std::chrono::milliseconds(500), []{ std::cout << "timeout\n"; });
+    auto flush = pool.schedule_every(std::chrono::seconds(1), []{ std::cout << "flush\n"; });
+    timeout.cancel();
+
+    // 弹性线程数 : 空闲 idle_timeout 的线程退出, 持续忙碌时自动加线程, size() 是当前的线程数
+    YHL::pool_options elastic;
+    elastic.min_threads = 2;
+    elastic.max_threads = 16;
+    elastic.idle_timeout = std::chrono::seconds(5);
+    YHL::thread_pool server(2, elastic);
+
+    // 指定线程 : 放进 2 号线程自己的队列, 只有它会执行, 按提交顺序; keyed_executor 就是用它把同一个 key 固定在一个线程上
+    pool.post_to(2, []{ std::cout << "always on worker 2\n"; });
+
+    // 低延迟 : 空闲线程先自旋一小会再睡眠, 任务提交时多半不用走 futex 唤醒
+    options.idle = YHL::idle_policy::low_latency;
+
+    // 绑核 : 线程先铺满各个物理核, 0、1 号核留给网络线程
+    options.placement = YHL::cpu_placement::spread;
+    options.reserved_cpus = { 0, 1 };
+
+    // 取消 : 带 token 提交, 还没开始的直接丢掉, future 里得到 YHL::task_cancelled
+    YHL::cancel_source source;
+    auto reply = pool.enqueue(source.token(), handle_request, request);
+    source.cancel();                    // 客户端已经断开了
+    pool.cancel_all();                  // 过载时丢掉所有带 token 的任务, 包括正在执行的（它们要检查 this_task::is_cancelled）
+
+    // 有界队列 : 最多排队 10000 个任务, 满了提交方最多等 50ms, 还没有空位就抛出 YHL::queue_full
+    options.max_queued = 10000;
+    options.overflow = YHL::overflow_policy::block;
+    options.block_timeout = std::chrono::milliseconds(50);
+    std::future<int> maybe;
+    if(not pool.try_enqueue(maybe, test::fun))   // 不管什么策略, 满了直接返回 false
+        reply_busy();
+    auto counters = pool.overflow_counters();
+
+    // 微任务 : 工作线程一次从全局队列取一批（options.max_batch）; 提交方也可以先攒一批再一起入队
+    YHL::task_coalescer coalesce(pool, 64, std::chrono::milliseconds(1));   // 攒够 64 个或者最早的等了 1ms 就入队
+    for(int i = 0;i < 1000000; ++i)
+        coalesce.post([i]{ tiny(i); });
+    coalesce.flush();                     // 当前线程攒着的马上入队
+
+    // 多租户 : 每个租户一条队列, 按权重分 CPU 时间; 一个租户灌进大量任务, 别的租户的任务不用排在它后面
+    auto search = pool.add_tenant(3);     // 都有任务时, search 拿到的 CPU 时间是 batch 的 3 倍
+    auto batch = pool.add_tenant(1);
+    auto hits = pool.enqueue_for(search, handle_query, query);
+    pool.post_for(batch, []{ rebuild_index(); });
+    auto usage = pool.tenant_usage(batch);   // usage.cpu_time 是 batch 的任务一共用掉的线程 CPU 时间
+
+    // 关闭 : 最多花 2 秒把排队的任务跑完, 到时还没跑完的丢掉, 返回丢掉了多少个; 析构时相当于 shutdown(drain)
+    size_t discarded = pool.shutdown(YHL::drain_policy::drain, std::chrono::seconds(2));
  */
 
 namespace YHL {
 
+    // 调度模式
+    // shared_queue  : 所有线程共享一个任务队列 + 一把锁
+    // work_stealing : 每个线程一个双端队列, 自己从尾部存取, 空闲时从别人的头部窃取
+    // lock_free_queue : 所有线程共享一个无锁有界环形队列, cv 只用来让空闲线程睡眠
+    enum class schedule_mode { shared_queue, work_stealing, lock_free_queue };
+
+    // 任务优先级, normal 就是 enqueue / post 的默认队列
+    enum class task_priority { high, normal, low };
+
+    // 优先级队列的出队策略
+    // strict   : high > normal > low, low 只在没有别的任务时执行
+    // weighted : 在 strict 的基础上, 每 low_share 次出队至少有一次先看 low
+    enum class priority_policy { strict, weighted };
+
+    // 线程没有任务时怎么等
+    // power_saving : 直接在 cv 上睡眠, 不占 CPU, 但是唤醒要走一次 futex
+    // low_latency  : 先 pause 自旋, 再 yield 一会, 还没有任务才睡眠; 同时自旋的线程不超过一半
+    enum class idle_policy { power_saving, low_latency };
+
+    // 有界队列满了之后怎么处理新提交的任务
+    // block       : 提交方等到有空位（block_timeout 不为 0 时最多等这么久, 超时抛出 queue_full）
+    // reject      : 直接抛出 queue_full
+    // caller_runs : 在提交方的线程上直接执行, 提交方自然就慢下来了
+    // drop_oldest : 丢掉排队最久的任务, 新任务入队; 被丢掉的任务的 future 得到 broken_promise
+    //               丢掉的也可能是 task_group、task_graph、strand、流水线、纤程、协程内部的任务, 它们按失败收尾, 见 drain_policy
+    enum class overflow_policy { block, reject, caller_runs, drop_oldest };
+
+    // shutdown 怎么处理还没执行的任务
+    // drain          : 所有线程一起把排队的任务执行完, 执行中的任务提交的子任务也会执行
+    // finish_running : 丢掉排队的任务, 只等正在执行的任务结束
+    // abort          : 丢掉排队的任务, 并且 cancel_all, 执行中检查 this_task::is_cancelled 的任务会提前结束
+    // 被丢掉的任务的 future 得到 broken_promise, 带 token 的得到 task_cancelled
+    // 内部的任务析构时自己收尾, 等它们的一方不会一直等 : task_group / task_graph / 流水线 得到 broken_promise,
+    // strand 丢掉排队的任务, 协程在 co_await 处抛出 task_cancelled, 纤程交给 fiber_scheduler 析构时执行完
+    enum class drain_policy { drain, finish_running, abort };
+
+    // add_tenant 返回的租户编号
+    using tenant_id = size_t;
+
+    // 租户的计数, 都是从 add_tenant 开始累计
+    struct tenant_stats {
+        size_t weight = 1;
+        size_t queued = 0;                      // 还在排队的任务
+        size_t completed = 0;                   // 执行完的任务
+        std::chrono::nanoseconds cpu_time{0};   // 执行任务用掉的线程 CPU 时间, 不包括在任务里嵌套执行的别的租户的任务
+    };
+
+    // 有界队列满了, 任务没有提交成功
+    class queue_full : public std::runtime_error {
+    public:
+        queue_full() : std::runtime_error("thread_pool queue is full\n") {}
+    };
+
+    // 有界队列的计数, 都是从线程池创建开始累计
+    struct overflow_stats {
+        size_t blocked = 0;        // 等过空位的提交
+        size_t rejected = 0;       // 抛出 queue_full 的提交（包括 block 超时）和 try_enqueue 返回 false 的次数
+        size_t caller_ran = 0;     // caller_runs 在提交方线程上执行的任务
+        size_t dropped = 0;        // drop_oldest 丢掉的任务
+    };
+
+    struct pool_options {
+        schedule_mode mode = schedule_mode::shared_queue;
+        size_t queue_capacity = 1024;   // 只对 lock_free_queue 有效, 向上取整到 2 的幂
+
+        // 工作线程在任务里提交的任务先放进自己的 LIFO 槽, 接下来就由它执行, 缓存还是热的
+        // 槽里只放一个, 新的进来旧的挪到全局队列; 空闲的线程可以从别人的槽里偷
+        // 只对 shared_queue / lock_free_queue 有效, work_stealing 自己的队列本来就是后进先出
+        bool lifo_slot = true;
+
+        // 微任务批量出队 : 只对 shared_queue 有效, 一次加锁最多从全局队列取 max_batch 个, 多出来的放进自己的批量缓冲
+        // 实际取多少随负载变化 : 不超过排队任务数 / 线程数, 按最近的任务耗时估计的总时间不超过 batch_budget
+        // 任务很长或者队列很短时退化为一次一个; 缓冲里的任务空闲的线程可以偷; max_batch 为 1 表示不批量
+        size_t max_batch = 32;
+        std::chrono::microseconds batch_budget = std::chrono::microseconds(20);
+
+        idle_policy idle = idle_policy::power_saving;
+
+        priority_policy priority = priority_policy::strict;
+        size_t low_share = 8;
+        // low 任务等待超过这个时间就按 high 处理, 防止饿死
+        std::chrono::milliseconds aging = std::chrono::milliseconds(200);
+
+        // 弹性线程数 : idle_timeout 为 0 表示线程不退出, max_threads 为 0 表示不自动增加
+        // 线程空闲超过 idle_timeout 就退出, 但至少保留 min_threads 个
+        // 所有线程连续忙了 spawn_delay 还有任务提交进来, 说明任务在排队, 加一个线程
+        size_t min_threads = 1;
+        size_t max_threads = 0;
+        std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(0);
+        std::chrono::milliseconds spawn_delay = std::chrono::milliseconds(10);
+
+        // 绑核 : 按 placement 把 cpu 排好顺序, 第 k 个创建的线程绑定第 k % n 个; reserved_cpus 不会被使用
+        cpu_placement placement = cpu_placement::none;
+        std::vector<int> reserved_cpus;
+
+        // 有界队列 : 排队的任务（包括优先级队列）达到 max_queued 时按 overflow 处理, 0 表示不限
+        // 只限制线程池外部的提交; 工作线程在任务里提交的子任务、后续任务、定时任务不受限制, 否则容易互相等死
+        size_t max_queued = 0;
+        overflow_policy overflow = overflow_policy::block;
+        std::chrono::milliseconds block_timeout = std::chrono::milliseconds(0);
+    };
+
+    namespace detail {
+        template<typename R>
+        struct promise_setter {
+            template<typename Fun>
+            static void run(std::promise<R>& promise, Fun& fun) { promise.set_value(fun()); }
+        };
+
+        template<>
+        struct promise_setter<void> {
+            template<typename Fun>
+            static void run(std::promise<void>& promise, Fun& fun) { fun(); promise.set_value(); }
+        };
+
+        // 带 token 的任务 : 出队时已经取消就不执行; 执行期间 this_task 能看到 token 和线程池的 cancel_all
+        template<typename R, typename Fun>
+        class cancellable_task {
+        private:
+            std::promise<R> promise;
+            Fun fun;
+            cancel_token token;
+            std::shared_ptr<const cancel_state> generation;
+            bool armed;     // 还没执行过, 被销毁时要报告取消
+
+        public:
+            cancellable_task(Fun&& _fun, const cancel_token& _token, std::shared_ptr<const cancel_state> _generation)
+                : fun(std::move(_fun)), token(_token), generation(std::move(_generation)), armed(true) {}
+            cancellable_task(cancellable_task&& other)
+                : promise(std::move(other.promise)), fun(std::move(other.fun)), token(std::move(other.token)),
+                  generation(std::move(other.generation)), armed(other.armed) {
+                other.armed = false;
+            }
+            ~cancellable_task() {
+                if(armed)
+                    promise.set_exception(std::make_exception_ptr(task_cancelled()));
+            }
+
+            std::future<R> get_future() { return promise.get_future(); }
+
+            void operator()() {
+                armed = false;
+                if(token.is_cancelled() or generation->cancelled.load(std::memory_order_acquire)) {
+                    promise.set_exception(std::make_exception_ptr(task_cancelled()));
+                    return;
+                }
+                cancel_scope scope(cancel_access::state(token), generation.get());
+                try {
+                    promise_setter<R>::run(promise, fun);
+                }
+                catch(...) {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+        };
+
+        // 内部任务 : 线程池没执行就销毁了它（shutdown、drop_oldest、提交时抛异常）, 析构时调用 drop 收尾
+        // 否则 task_group 这类等计数归零的对象会一直等; drop 在析构函数里执行, 不能抛异常
+        template<typename Fun, typename Drop>
+        class abandonable {
+        private:
+            Fun fun;
+            Drop drop;
+            bool armed;     // 还没执行过
+
+        public:
+            abandonable(Fun&& _fun, Drop&& _drop)
+                : fun(std::move(_fun)), drop(std::move(_drop)), armed(true) {}
+            abandonable(abandonable&& other) noexcept
+                : fun(std::move(other.fun)), drop(std::move(other.drop)), armed(other.armed) {
+                other.armed = false;
+            }
+            ~abandonable() {
+                if(armed)
+                    drop();
+            }
+
+            void operator()() {
+                armed = false;
+                fun();
+            }
+        };
+
+        template<typename Fun, typename Drop>
+        abandonable<typename std::decay<Fun>::type, typename std::decay<Drop>::type>
+        make_abandonable(Fun&& fun, Drop&& drop) {
+            return abandonable<typename std::decay<Fun>::type, typename std::decay<Drop>::type>(
+                std::forward<Fun>(fun), std::forward<Drop>(drop));
+        }
+
+        // shared_queue 模式的全局队列和工作线程的批量缓冲 : 环形缓冲, 满了翻倍, 只增不减
+        // std::deque 每攒满一块就要 new 一块, 这里稳定之后入队出队都不再分配
+        class task_fifo final : boost::noncopyable {
+        private:
+            std::unique_ptr<unique_task[]> slots;
+            size_t capacity = 0;       // 总是 2 的幂
+            size_t head = 0;
+            size_t count = 0;
+
+            void grow() {
+                const size_t bigger = capacity == 0 ? 64 : capacity * 2;
+                std::unique_ptr<unique_task[]> fresh(new unique_task[bigger]);
+                for(size_t i = 0;i < count; ++i)
+                    fresh[i] = std::move(slots[(head + i) & (capacity - 1)]);
+                slots.swap(fresh);
+                capacity = bigger;
+                head = 0;
+            }
+
+        public:
+            bool empty() const noexcept { return count == 0; }
+            size_t size() const noexcept { return count; }
+            unique_task& front() noexcept { return slots[head]; }
+
+            // 容量至少是 n, 之后 n 个以内的任务不用扩容
+            void reserve(const size_t n) {
+                while(capacity < n)
+                    grow();
+            }
+
+            // 扩容失败时 task 原样留着
+            void emplace_back(unique_task&& task) {
+                if(count == capacity)
+                    grow();
+                slots[(head + count) & (capacity - 1)] = std::move(task);
+                ++count;
+            }
+
+            void pop_front() noexcept {
+                slots[head] = unique_task();
+                head = (head + 1) & (capacity - 1);
+                --count;
+            }
+        };
+
+        // 能预先知道长度的迭代器, 先把 vector 的空间留好
+        template<typename T, typename Iterator>
+        void reserve_for(std::vector<T>& res, Iterator first, Iterator last, std::forward_iterator_tag) {
+            res.reserve(static_cast<size_t>(std::distance(first, last)));
+        }
+
+        template<typename T, typename Iterator>
+        void reserve_for(std::vector<T>&, Iterator, Iterator, std::input_iterator_tag) {}
+
+        template<typename T, typename Iterator>
+        void reserve_for(std::vector<T>& res, Iterator first, Iterator last) {
+            reserve_for(res, first, last, typename std::iterator_traits<Iterator>::iterator_category());
+        }
+    }
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+    struct schedule_awaitable;     // 定义在 coroutine.h
+#endif
+
+    class strand;                  // 定义在 strand.h
+    class keyed_executor;          // 定义在 keyed_executor.h
+    class fiber_scheduler;         // 定义在 fiber.h
+    class task_coalescer;          // 定义在 task_coalescer.h
+    namespace detail {
+        class pipeline_core;       // 定义在 pipeline.h
+    }
+
+    // post 提交的任务抛出异常时的回调
+    using exception_handler = std::function<void(std::exception_ptr)>;
+
     class thread_pool final : boost::noncopyable {
     private:
+        // 工作窃取模式下每个线程私有的任务队列, 其他模式下是 LIFO 槽（最多一个任务）
+        // pinned 是 post_to 指定给这个线程的任务, 先进先出, 不会被偷
+        // batch 是 shared_queue 模式下一次多取的任务, 先进先出, 和 tasks 一样计入 pending, 可以被偷
+        struct worker_queue {
+            std::mutex mtx;
+            std::deque< unique_task > tasks;
+            std::deque< unique_task > pinned;
+            detail::task_fifo batch;
+            std::atomic<size_t> pinned_count{0};   // pinned 的长度, 主人睡眠前不加锁检查
+            std::atomic<size_t> batch_count{0};    // batch 的长度, 缓冲空了就不用加锁
+            // 只有主人访问 : 上一批从什么时候开始、取了几个, 据此估计每个任务的耗时（纳秒, 指数平均）
+            int64_t batch_since = 0;
+            size_t batch_taken = 0;
+            double task_ns = 0;
+            std::atomic<bool> sleeping{false};     // 主人在 cv 上睡眠, post_to 才需要唤醒
+            bool alive = true;    // 由 mtx 保护; 主人退出后队列留着, 给下一个新线程用
+            size_t streak = 0;    // 只有主人访问 : 连续从 LIFO 槽取了几个任务
+        };
+
         // 一个线程池 + 一个任务队列, 线程不断检查是否可以执行任务
         std::vector< std::thread > pool;
-        std::queue< std::function<void()> > tasks;
+        detail::task_fifo tasks;
         // sunchronization
         std::mutex mtx;
         std::condition_variable cv;
-        bool stop;
+        std::atomic<bool> stop;
+        std::atomic<bool> draining;        // stop 之后还在执行排队的任务（drain_policy::drain）
+        std::atomic<size_t> workers;       // 当前的线程数, 线程退出时减一
+
+        const pool_options options;
+
+        // 线程依次绑定的 cpu, 为空表示不绑核
+        const std::vector<int> cpu_plan;
+        std::atomic<size_t> placed;
+
+        // 工作窃取相关 : 队列表只增不减, 窃取时无锁遍历
+        static constexpr size_t max_workers = 512;
+        std::unique_ptr< std::atomic<worker_queue*>[] > slots;
+        std::atomic<size_t> slot_count;
+        std::vector< std::unique_ptr<worker_queue> > owned;  // 由 mtx 保护
+        std::atomic<size_t> pending;       // 各队列中尚未取走的任务数, 所有模式都维护
+        std::atomic<size_t> pinned_pending;  // 所有 pinned 队列的任务数, 不计入 pending（别的线程拿不走）
+        std::atomic<size_t> sleepers;      // 正在 cv 上等待的线程数, 为 0 时提交方不用 notify
+        std::atomic<size_t> spinners;      // 正在自旋等任务的线程数
+        std::atomic<size_t> next_queue;    // 外部线程提交时轮流选择队列
+
+        // lock_free_queue 模式下的任务队列, pending 和 sleepers 同上
+        std::unique_ptr< mpmc_queue< unique_task > > ring;
+
+        // submit 返回的 future 的共享状态从这里分配
+        std::shared_ptr<task_block_pool> blocks;
+        // future 的后续任务经它交给线程池, 析构时关上
+        std::shared_ptr<executor_gate> gate;
+
+        std::mutex handler_mtx;
+        exception_handler on_exception;
+
+        // high / low 两条优先级队列, normal 走上面各模式自己的队列
+        struct lane_task {
+            unique_task task;
+            std::chrono::steady_clock::time_point since;
+        };
+        std::mutex lane_mtx;
+        std::deque< lane_task > lanes[2];
+        std::atomic<size_t> lane_pending;
+        std::atomic<size_t> lane_turn;
+
+        // 租户队列 : 虚拟时间是租户用掉的 CPU 纳秒除以权重, 出队时取虚拟时间最小的租户
+        // 出队时先按估计值记账, 执行完再按实际用掉的 CPU 时间修正; 下面的字段都由 tenant_mtx 保护
+        struct tenant_queue {
+            std::deque< unique_task > tasks;
+            size_t weight = 1;
+            double vtime = 0;           // 虚拟时间
+            double estimate = 1000;     // 每个任务用掉的 CPU 纳秒, 指数平均
+            size_t completed = 0;
+            int64_t cpu_ns = 0;
+        };
+        // 刚从租户队列取出的任务属于谁、出队时按多少纳秒记的账, run_task 执行前取走
+        struct tenant_ticket {
+            tenant_queue *owner;
+            double charged;
+        };
+        std::mutex tenant_mtx;
+        std::vector< std::unique_ptr<tenant_queue> > tenants;
+        std::atomic<size_t> tenant_pending;
+        double virtual_now = 0;         // 最近一次出队的租户的虚拟时间, 租户从空闲变为有任务时从这里起步
+
+        // 有界队列 : 等空位的提交方睡在 space_cv 上, 取走任务的线程看到有人在等才通知
+        std::mutex space_mtx;
+        std::condition_variable space_cv;
+        std::atomic<size_t> waiting_producers;
+        std::atomic<size_t> blocked_count, rejected_count, caller_ran_count, dropped_count;
+
+        // cancel_all 的取消标志, 每次 cancel_all 换一个新的
+        std::mutex cancel_mtx;
+        std::shared_ptr<detail::cancel_state> generation;
+
+        // 定时任务, 第一次 schedule 时才创建, 由 timer_mtx 保护
+        std::mutex timer_mtx;
+        std::unique_ptr<timer_wheel> timers;
+
+        // 弹性线程数 : 退出的线程先记下来, 下次加线程时再 join
+        std::mutex pool_mtx;                      // 保护 pool 和 retired
+        std::vector< std::thread::id > retired;
+        std::atomic<int64_t> last_idle;           // 最近一次有线程闲下来的时刻, steady_clock 纳秒
+        std::atomic<bool> spawning;
+
+        // shutdown 等所有线程退出, 有超时所以不能直接 join
+        std::mutex exit_mtx;
+        std::condition_variable exit_cv;
+
+        // 当前线程所属的线程池和队列, 非工作线程为 nullptr
+        static thread_local thread_pool* local_pool;
+        static thread_local worker_queue* local_queue;
+        static thread_local tenant_ticket popped;
+
+        // strand 直接把自己的 drain 放进队列, 不经过有界队列的限制
+        friend class strand;
+        // keyed_executor 要看各线程 pinned 队列的长度
+        friend class keyed_executor;
+        // 纤程的恢复直接放进队列, 和 strand 一样不受 max_queued 限制
+        friend class fiber_scheduler;
+        // 流水线的 stage 任务也是; 另外要知道当前线程是不是这个线程池的
+        friend class detail::pipeline_core;
+        // 攒够一批再整批入队, 有界队列也是整批检查
+        friend class task_coalescer;
+
     public:
-        thread_pool(const size_t);
+        thread_pool(const size_t, const pool_options& = pool_options());
+
+        // 相当于 shutdown(drain_policy::drain), 排队的任务都会执行完
         ~thread_pool();
 
+        // 停止接受新任务, 按 policy 处理排队的任务, 等所有线程退出, 返回丢掉的任务数
+        // timeout 为 0 表示一直等; 超时后丢掉剩下的排队任务并 cancel_all, 然后等执行中的任务返回（不能强行终止）
+        // 只能在线程池外面调用; 调用多次时后面的直接返回 0
+        size_t shutdown(const drain_policy = drain_policy::drain,
+                        const std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
         // 获取一个线程
         std::function<void()> get_task();
 
         // 拓展线程池的容量
         void add_thread(const size_t);
 
-        template<typename F, class... Args>
+        // submit 返回的 future 的共享状态先备好 n 块, 同时在用的不超过 n 个时 submit 不再分配内存
+        void reserve_futures(const size_t n);
+
+        // 当前的线程数, 弹性线程池里会随负载变化
+        size_t size() const noexcept;
+
+        // 在调用线程上执行一个排队的任务, 没有就返回 false; task_group::wait 用它边等边干活
+        bool try_run_one();
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+        // co_await pool.schedule() 之后协程在工作线程上继续, 要包含 coroutine.h
+        schedule_awaitable schedule() noexcept;
+#endif
+
+        // 第一个参数是 cancel_token 的交给下面那个重载
+        template<typename F, class... Args, typename = typename std::enable_if<
+                    not std::is_same<typename std::decay<F>::type, cancel_token>::value>::type>
         auto enqueue(F&& fun, Args&& ...args)
             -> std::future<typename std::result_of<F(Args...)>::type>;
+
+        // 可以取消的 enqueue : 出队时 token 已经取消就不执行, future 里是 task_cancelled
+        template<typename F, class... Args>
+        auto enqueue(const cancel_token& token, F&& fun, Args&& ...args)
+            -> std::future<typename std::result_of<F(Args...)>::type>;
+
+        // 取消所有带 token 提交的任务 : 排队的出队时丢掉, 执行中的 this_task::is_cancelled 变为 true
+        // 之后提交的任务不受影响
+        void cancel_all();
+
+        // 和 enqueue 一样, 但是任务和共享状态都不用 new
+        template<typename F, class... Args>
+        auto submit(F&& fun, Args&& ...args)
+            -> task_future<typename std::result_of<F(Args...)>::type>;
+
+        // 只管提交, 不关心结果
+        template<typename F>
+        void post(F&& fun);
+
+        template<typename F, class... Args>
+        void post(F&& fun, Args&& ...args);
+
+        // 交给第 worker % 线程数 个线程执行, 同一个线程上按提交顺序执行, 不会被别的线程偷走
+        // 这个线程已经被回收的话, 重新启动一个线程接管它的队列
+        // 不经过有界队列的策略（caller_runs 会破坏顺序）, 但是排队的个数计入 max_queued
+        template<typename F>
+        void post_to(const size_t worker, F&& fun);
+
+        // 新建一个租户, 权重为 0 时按 1 处理; 租户不能删除
+        tenant_id add_tenant(const size_t weight = 1);
+        void set_weight(const tenant_id, const size_t weight);
+
+        // 放进租户自己的队列 : 各个租户按权重分 CPU 时间, 没有租户的任务（enqueue / post 等）总是先于租户的任务
+        // 经过有界队列的策略; 工作线程提交的也放进租户队列, 不走 LIFO 槽
+        template<typename F, class... Args>
+        auto enqueue_for(const tenant_id, F&& fun, Args&& ...args)
+            -> std::future<typename std::result_of<F(Args...)>::type>;
+
+        template<typename F, class... Args>
+        void post_for(const tenant_id, F&& fun, Args&& ...args);
+
+        tenant_stats tenant_usage(const tenant_id);
+
+        // 默认打印到 std::cerr
+        void set_exception_handler(exception_handler);
+
+        // 带优先级的 enqueue / post
+        template<typename F, class... Args>
+        auto enqueue_with_priority(const task_priority, F&& fun, Args&& ...args)
+            -> std::future<typename std::result_of<F(Args...)>::type>;
+
+        template<typename F, class... Args>
+        void post_with_priority(const task_priority, F&& fun, Args&& ...args);
+
+        // 有界队列满了就返回 false, 不等待也不执行; 成功时 result 里是任务的 future
+        template<typename R, typename F, class... Args>
+        bool try_enqueue(std::future<R>& result, F&& fun, Args&& ...args);
+
+        overflow_stats overflow_counters() const noexcept;
+
+        // 定时任务, 返回的句柄可以 cancel
+        template<typename Rep, typename Period, typename F>
+        timer_handle schedule_after(const std::chrono::duration<Rep, Period>& delay, F&& fun);
+
+        template<typename Clock, typename Duration, typename F>
+        timer_handle schedule_at(const std::chrono::time_point<Clock, Duration>& when, F&& fun);
+
+        // 第一次在 period 之后执行, 之后每隔 period 执行一次
+        template<typename Rep, typename Period, typename F>
+        timer_handle schedule_every(const std::chrono::duration<Rep, Period>& period, F&& fun);
+
+        // [first, last) 中的每个元素都是无参的可调用对象
+        template<typename Iterator>
+        auto enqueue_bulk(Iterator first, Iterator last)
+            -> std::vector< task_future<typename std::result_of<
+                    typename std::iterator_traits<Iterator>::reference()>::type> >;
+
+        // 全部完成后返回的 future 才就绪; 第一个异常放在这个 future 里
+        template<typename Iterator>
+        task_future<void> post_bulk(Iterator first, Iterator last);
+
+    private:
+        // submit 返回的 future 上的 then 交给这个线程池执行
+        task_executor executor() noexcept;
+        static void post_continuation(void*, unique_task&&);
+
+        std::shared_ptr<const detail::cancel_state> current_generation();
+
+        bool admit(unique_task*, const size_t, const bool nonblocking = false);
+        bool drop_oldest();
+        size_t queued() const noexcept;
+        size_t discard_queued();
+
+        bool closed() const noexcept;
+        bool halted() const noexcept;
+        bool exiting();
+
+        void push_task(unique_task&&, const bool lifo = true);
+        void requeue(unique_task&&);
+        void push_task(const task_priority, unique_task&&);
+        void push_pinned(const size_t, unique_task&&);
+        size_t pinned_depth(const size_t) const;
+        bool has_work(const worker_queue*) const noexcept;
+        bool pop_priority(unique_task&, const bool);
+        void push_tenant(const tenant_id, unique_task&&);
+        bool pop_tenant(unique_task&);
+        void charge(const tenant_ticket&, const int64_t spent);
+        timer_handle schedule(std::chrono::steady_clock::time_point,
+                              std::chrono::nanoseconds, unique_task&&);
+        void push_bulk(unique_task*, const size_t);
+        void wake_many(const size_t);
+        void run_task(unique_task&);
+
+        void grow();
+        bool retire();
+        void reap();
+        worker_queue* lock_target(std::unique_lock<std::mutex>&);
+
+        worker_queue* claim_queue();
+        std::function<void()> make_worker(worker_queue*);
+        void run_shared(worker_queue*);
+        void run_stealing(worker_queue*);
+        void run_lock_free(worker_queue*);
+
+        bool pop_shared(worker_queue*, unique_task&);
+        bool pop_batch(worker_queue*, unique_task&);
+        size_t batch_limit(worker_queue*);
+        bool pop_slot(worker_queue*, unique_task&);
+        bool pop_pinned(worker_queue*, unique_task&);
+        bool pop_local(worker_queue*, unique_task&);
+        bool steal(worker_queue*, unique_task&);
+        void wake_one();
+        bool spin();
+        bool park();
     };
 
     // 放入新的任务到队列中去（万能的函数包装器）
-    template<typename F, class... Args>
+    template<typename F, class... Args, typename>
     auto YHL::thread_pool::enqueue(F&& fun, Args&& ...args)
             -> std::future< typename std::result_of<F(Args...)>::type > {
         using return_type = typename std::result_of<F(Args...)>::type;
 
-        auto packed_task = std::make_shared< std::packaged_task<return_type()> >(
+        // packaged_task 只能转移, unique_task 可以直接装下, 不用再包一层 shared_ptr
+        std::packaged_task<return_type()> packed_task(
                 std::bind(std::forward<F>(fun), std::forward<Args>(args)...)
             );
 
-        {
-            std::unique_lock<std::mutex> lck(this->mtx);
+        std::future<return_type> res = packed_task.get_future();
 
-            if(stop == true)
-                throw std::runtime_error("enqueue task on stopped pool\n");
+        unique_task task(std::move(packed_task));
+        if(this->admit(&task, 1))
+            this->push_task(std::move(task));
 
-            this->tasks.emplace([packed_task](){ (*packed_task)(); });
-        }
+        return res;
+    }
 
-        this->cv.notify_one();
+    template<typename F, class... Args>
+    auto YHL::thread_pool::enqueue(const cancel_token& token, F&& fun, Args&& ...args)
+            -> std::future< typename std::result_of<F(Args...)>::type > {
+        using return_type = typename std::result_of<F(Args...)>::type;
+        auto bound = std::bind(std::forward<F>(fun), std::forward<Args>(args)...);
+
+        detail::cancellable_task<return_type, decltype(bound)> task(
+            std::move(bound), token, this->current_generation());
+
+        std::future<return_type> res = task.get_future();
+
+        unique_task wrapped(std::move(task));
+        if(this->admit(&wrapped, 1))
+            this->push_task(std::move(wrapped));
 
-        std::future<return_type> res = packed_task->get_future();
         return res;
     }
 
+    template<typename F, class... Args>
+    auto YHL::thread_pool::submit(F&& fun, Args&& ...args)
+            -> task_future< typename std::result_of<F(Args...)>::type > {
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        auto pair = make_task_pair<return_type>(this->blocks, this->executor());
+
+        unique_task task(
+            [promise = std::move(pair.first),
+             fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                promise.run(std::move(fun), std::move(args));
+            });
+        if(this->admit(&task, 1))
+            this->push_task(std::move(task));
+
+        return std::move(pair.second);
+    }
+
+    template<typename F, class... Args>
+    auto YHL::thread_pool::enqueue_with_priority(const task_priority priority, F&& fun, Args&& ...args)
+            -> std::future< typename std::result_of<F(Args...)>::type > {
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        std::packaged_task<return_type()> packed_task(
+                std::bind(std::forward<F>(fun), std::forward<Args>(args)...)
+            );
+
+        std::future<return_type> res = packed_task.get_future();
+
+        unique_task task(std::move(packed_task));
+        if(this->admit(&task, 1))
+            this->push_task(priority, std::move(task));
+
+        return res;
+    }
+
+    template<typename F, class... Args>
+    void YHL::thread_pool::post_with_priority(const task_priority priority, F&& fun, Args&& ...args) {
+        unique_task task(
+            [fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                detail::apply_tuple(std::move(fun), std::move(args));
+            });
+        if(this->admit(&task, 1))
+            this->push_task(priority, std::move(task));
+    }
+
+    template<typename F, class... Args>
+    auto YHL::thread_pool::enqueue_for(const tenant_id tenant, F&& fun, Args&& ...args)
+            -> std::future< typename std::result_of<F(Args...)>::type > {
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        std::packaged_task<return_type()> packed_task(
+                std::bind(std::forward<F>(fun), std::forward<Args>(args)...)
+            );
+
+        std::future<return_type> res = packed_task.get_future();
+
+        unique_task task(std::move(packed_task));
+        if(this->admit(&task, 1))
+            this->push_tenant(tenant, std::move(task));
+
+        return res;
+    }
+
+    template<typename F, class... Args>
+    void YHL::thread_pool::post_for(const tenant_id tenant, F&& fun, Args&& ...args) {
+        unique_task task(
+            [fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                detail::apply_tuple(std::move(fun), std::move(args));
+            });
+        if(this->admit(&task, 1))
+            this->push_tenant(tenant, std::move(task));
+    }
+
+    template<typename F>
+    void YHL::thread_pool::post_to(const size_t worker, F&& fun) {
+        this->push_pinned(worker, unique_task(std::forward<F>(fun)));
+    }
+
+    template<typename R, typename F, class... Args>
+    bool YHL::thread_pool::try_enqueue(std::future<R>& result, F&& fun, Args&& ...args) {
+        static_assert(std::is_same<R, typename std::result_of<F(Args...)>::type>::value,
+                      "try_enqueue : future type does not match the task");
+        std::packaged_task<R()> packed_task(
+                std::bind(std::forward<F>(fun), std::forward<Args>(args)...)
+            );
+        std::future<R> res = packed_task.get_future();
+        unique_task task(std::move(packed_task));
+        if(not this->admit(&task, 1, true))
+            return false;
+        this->push_task(std::move(task));
+        result = std::move(res);
+        return true;
+    }
+
+    template<typename Rep, typename Period, typename F>
+    YHL::timer_handle YHL::thread_pool::schedule_after(const std::chrono::duration<Rep, Period>& delay, F&& fun) {
+        return this->schedule(
+            std::chrono::steady_clock::now()
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay),
+            std::chrono::nanoseconds(0), unique_task(std::forward<F>(fun)));
+    }
+
+    // 其他时钟（比如 system_clock）先换算成 steady_clock 上的等待时间
+    template<typename Clock, typename Duration, typename F>
+    YHL::timer_handle YHL::thread_pool::schedule_at(const std::chrono::time_point<Clock, Duration>& when, F&& fun) {
+        return this->schedule_after(when - Clock::now(), std::forward<F>(fun));
+    }
+
+    template<typename Rep, typename Period, typename F>
+    YHL::timer_handle YHL::thread_pool::schedule_every(const std::chrono::duration<Rep, Period>& period, F&& fun) {
+        const auto step = std::chrono::duration_cast<std::chrono::nanoseconds>(period);
+        return this->schedule(
+            std::chrono::steady_clock::now()
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(step),
+            step, unique_task(std::forward<F>(fun)));
+    }
+
+    template<typename F>
+    void YHL::thread_pool::post(F&& fun) {
+        unique_task task(std::forward<F>(fun));
+        if(this->admit(&task, 1))
+            this->push_task(std::move(task));
+    }
+
+    template<typename F, class... Args>
+    void YHL::thread_pool::post(F&& fun, Args&& ...args) {
+        unique_task task(
+            [fun = std::forward<F>(fun),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                detail::apply_tuple(std::move(fun), std::move(args));
+            });
+        if(this->admit(&task, 1))
+            this->push_task(std::move(task));
+    }
+
+    template<typename Iterator>
+    auto YHL::thread_pool::enqueue_bulk(Iterator first, Iterator last)
+            -> std::vector< task_future<typename std::result_of<
+                    typename std::iterator_traits<Iterator>::reference()>::type> > {
+        using return_type = typename std::result_of<
+                    typename std::iterator_traits<Iterator>::reference()>::type;
+
+        std::vector< task_future<return_type> > res;
+        std::vector< unique_task > batch;
+        detail::reserve_for(res, first, last);
+        detail::reserve_for(batch, first, last);
+        for(; first != last; ++first) {
+            auto pair = make_task_pair<return_type>(this->blocks, this->executor());
+            batch.emplace_back(
+                [promise = std::move(pair.first), fun = *first]() mutable {
+                    promise.run(std::move(fun), std::make_tuple());
+                });
+            res.emplace_back(std::move(pair.second));
+        }
+        if(this->admit(batch.data(), batch.size()))
+            this->push_bulk(batch.data(), batch.size());
+        return res;
+    }
+
+    template<typename Iterator>
+    YHL::task_future<void> YHL::thread_pool::post_bulk(Iterator first, Iterator last) {
+        // 所有任务共享一个计数器, 最后一个完成的任务负责设置结果
+        struct countdown {
+            std::atomic<size_t> remaining;
+            std::mutex mtx;
+            std::exception_ptr error;
+            task_promise<void> promise;
+        };
+        auto pair = make_task_pair<void>(this->blocks, this->executor());
+        auto counter = std::make_shared<countdown>();
+        counter->promise = std::move(pair.first);
+
+        std::vector< unique_task > batch;
+        detail::reserve_for(batch, first, last);
+        for(; first != last; ++first) {
+            batch.emplace_back([counter, fun = *first]() mutable {
+                try {
+                    fun();
+                }
+                catch(...) {
+                    std::lock_guard<std::mutex> lck(counter->mtx);
+                    if(not counter->error)
+                        counter->error = std::current_exception();
+                }
+                if(--counter->remaining == 0) {
+                    if(counter->error)
+                        counter->promise.set_exception(counter->error);
+                    else
+                        counter->promise.set_value();
+                }
+            });
+        }
+        counter->remaining = batch.size();
+        if(batch.empty())
+            counter->promise.set_value();
+        else if(this->admit(batch.data(), batch.size()))
+            this->push_bulk(batch.data(), batch.size());
+        return std::move(pair.second);
+    }
+
     /* 以上使用了一个万能函数包装器
     template <typename F, typename... Args>
     auto functionName(F&& fun, Args&&... args)->decltype (fun(std::forward<Args>(args)...)){
@@ -0,0 +1,275 @@
+#include "timer_wheel.h"
+#include <vector>
+#include <limits>
+
+namespace YHL {
+    namespace detail {
+
+        // 槽里的双向循环链表, 表头是哨兵
+        struct timer_link {
+            timer_link *prev = this;
+            timer_link *next = this;
+        };
+
+        struct timer_node : timer_link {
+            std::shared_ptr<timer_node> self;     // 挂在轮子上时持有自己, 摘下来时释放
+            uint64_t expiry = 0;                  // 到期的 tick
+            uint64_t period = 0;                  // 周期, 单位 tick; 0 表示只执行一次
+            unique_task fun;
+            std::atomic<bool> cancelled{false};
+            std::atomic<bool> running{false};    // 周期任务交出去的那一次还没结束
+
+            bool linked() const noexcept { return prev not_eq this; }
+        };
+
+        // 交给 dispatch 的一次触发 : 执行完, 或者没执行就被销毁, 都放开 running
+        class timer_fire {
+        private:
+            std::shared_ptr<timer_node> node;
+
+            static void finish(timer_node *one) noexcept {
+                if(one->period > 0)
+                    one->running = false;
+            }
+
+        public:
+            explicit timer_fire(std::shared_ptr<timer_node> _node) noexcept : node(std::move(_node)) {}
+            timer_fire(timer_fire&&) noexcept = default;
+
+            ~timer_fire() {
+                if(node not_eq nullptr)
+                    finish(node.get());
+            }
+
+            void operator()() {
+                std::shared_ptr<timer_node> one = std::move(node);
+                struct done {
+                    timer_node *one;
+                    ~done() { finish(one); }
+                } guard{ one.get() };
+                if(not one->cancelled)
+                    one->fun();
+            }
+        };
+
+        struct wheel_core {
+            static constexpr int levels = 4;
+            static constexpr int bits = 8;
+            static constexpr uint64_t slots = 1 << bits;
+            static constexpr uint64_t mask = slots - 1;
+            static constexpr uint64_t forever = std::numeric_limits<uint64_t>::max();
+
+            std::mutex mtx;
+            std::condition_variable cv;
+            timer_link wheel[levels][slots];
+            uint64_t current = 0;                 // 已经处理完的 tick
+            uint64_t sleeping_until = forever;    // 定时线程睡到哪个 tick, 插入更早的才需要叫醒它
+            size_t count = 0;
+            bool stop = false;
+
+            const std::chrono::steady_clock::time_point start;
+            const std::chrono::nanoseconds tick;
+
+            explicit wheel_core(std::chrono::nanoseconds _tick)
+                : start(std::chrono::steady_clock::now()),
+                  tick(_tick.count() > 0 ? _tick : std::chrono::nanoseconds(1)) {}
+
+            uint64_t now_tick() const {
+                return static_cast<uint64_t>((std::chrono::steady_clock::now() - start) / tick);
+            }
+
+            // 向上取整, 宁可晚一点也不能提前触发
+            uint64_t tick_of(std::chrono::steady_clock::time_point when) const {
+                if(when <= start)
+                    return 0;
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when - start).count();
+                return static_cast<uint64_t>((ns + tick.count() - 1) / tick.count());
+            }
+
+            std::chrono::steady_clock::time_point time_of(uint64_t ticks) const {
+                return start + tick * static_cast<std::chrono::nanoseconds::rep>(ticks);
+            }
+
+            void link(timer_link& head, timer_node *node) {
+                node->prev = head.prev;
+                node->next = &head;
+                head.prev->next = node;
+                head.prev = node;
+                ++count;
+            }
+
+            void unlink(timer_node *node) {
+                node->prev->next = node->next;
+                node->next->prev = node->prev;
+                node->prev = node->next = node;
+                --count;
+            }
+
+            // 按剩余时间选层, 按到期时刻选槽; 只有 cascade 时才允许放进当前 tick 的槽
+            void insert(timer_node *node) {
+                if(node->expiry < current)
+                    node->expiry = current;
+                const uint64_t delta = node->expiry - current;
+                int level = 0;
+                while(level + 1 < levels and delta >= (uint64_t(1) << (bits * (level + 1))))
+                    ++level;
+                uint64_t at = node->expiry;
+                if(level == levels - 1 and delta >= (uint64_t(1) << (bits * levels)))
+                    at = current + (uint64_t(1) << (bits * levels)) - 1;   // 太远了先放在最远的槽, 转到了再重新插入
+                link(wheel[level][(at >> (bits * level)) & mask], node);
+            }
+
+            void cascade(const int level, const uint64_t index) {
+                timer_link& head = wheel[level][index];
+                while(head.next not_eq &head) {
+                    timer_node *node = static_cast<timer_node*>(head.next);
+                    unlink(node);
+                    insert(node);
+                }
+            }
+
+            // 前进一个 tick, 到期的定时器放进 due
+            void advance(std::vector< std::shared_ptr<timer_node> >& due) {
+                ++current;
+                for(int level = 1;level < levels; ++level) {
+                    if((current & ((uint64_t(1) << (bits * level)) - 1)) not_eq 0)
+                        break;
+                    cascade(level, (current >> (bits * level)) & mask);
+                }
+                timer_link& head = wheel[0][current & mask];
+                while(head.next not_eq &head) {
+                    timer_node *node = static_cast<timer_node*>(head.next);
+                    unlink(node);
+                    due.emplace_back(std::move(node->self));
+                }
+            }
+
+            // 下一个需要醒来的 tick : 第 0 层下一个非空槽, 或者下一次 cascade
+            uint64_t next_event() const {
+                if(count == 0)
+                    return forever;
+                const uint64_t boundary = (current | mask) + 1;
+                for(uint64_t t = current + 1;t < boundary; ++t) {
+                    const timer_link& head = wheel[0][t & mask];
+                    if(head.next not_eq &head)
+                        return t;
+                }
+                return boundary;
+            }
+        };
+    }
+}
+
+YHL::timer_handle::timer_handle(std::shared_ptr<detail::timer_node> _node,
+                                std::weak_ptr<detail::wheel_core> _core)
+    : node(std::move(_node)), core(std::move(_core)) {}
+
+bool YHL::timer_handle::cancel() {
+    if(node == nullptr)
+        return false;
+    node->cancelled = true;    // 周期任务不再重新插入, 已经交出去还没执行的也会跳过
+    auto owner = core.lock();
+    if(owner == nullptr)
+        return false;
+    std::lock_guard<std::mutex> lck(owner->mtx);
+    if(not node->linked())
+        return false;
+    owner->unlink(node.get());
+    node->self.reset();
+    return true;
+}
+
+YHL::timer_wheel::timer_wheel(dispatcher _dispatch, std::chrono::nanoseconds tick)
+    : core(std::make_shared<detail::wheel_core>(tick)),
+      dispatch(std::move(_dispatch)),
+      worker([this]{ this->run(); }) {}
+
+YHL::timer_wheel::~timer_wheel() {
+    {
+        std::lock_guard<std::mutex> lck(core->mtx);
+        core->stop = true;
+    }
+    core->cv.notify_all();
+    worker.join();
+
+    // 还挂在轮子上的定时器持有自己, 要手动放掉; 任务的析构可能会再提交任务, 放到锁外
+    std::vector< std::shared_ptr<detail::timer_node> > left;
+    std::lock_guard<std::mutex> lck(core->mtx);
+    for(auto& level : core->wheel) {
+        for(auto& head : level) {
+            while(head.next not_eq &head) {
+                auto *node = static_cast<detail::timer_node*>(head.next);
+                core->unlink(node);
+                left.emplace_back(std::move(node->self));
+            }
+        }
+    }
+}
+
+YHL::timer_handle YHL::timer_wheel::add(std::chrono::steady_clock::time_point when,
+                                        std::chrono::nanoseconds period,
+                                        unique_task fun) {
+    auto node = std::make_shared<detail::timer_node>();
+    node->fun = std::move(fun);
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lck(core->mtx);
+        node->expiry = std::max(core->tick_of(when), core->current + 1);
+        if(period.count() > 0)
+            node->period = std::max<uint64_t>(1, static_cast<uint64_t>(
+                    (period.count() + core->tick.count() - 1) / core->tick.count()));
+        node->self = node;
+        core->insert(node.get());
+        wake = node->expiry < core->sleeping_until;
+    }
+    if(wake)
+        core->cv.notify_one();
+    return timer_handle(node, core);
+}
+
+size_t YHL::timer_wheel::size() const {
+    std::lock_guard<std::mutex> lck(core->mtx);
+    return core->count;
+}
+
+void YHL::timer_wheel::run() {
+    std::vector< std::shared_ptr<detail::timer_node> > due;
+    std::unique_lock<std::mutex> lck(core->mtx);
+    while(not core->stop) {
+        const uint64_t now = core->now_tick();
+        while(core->current < now)
+            core->advance(due);
+
+        if(due.empty()) {
+            core->sleeping_until = core->next_event();
+            if(core->sleeping_until == detail::wheel_core::forever)
+                core->cv.wait(lck);
+            else
+                core->cv.wait_until(lck, core->time_of(core->sleeping_until));
+            core->sleeping_until = detail::wheel_core::forever;
+            continue;
+        }
+
+        // 周期任务先重新插入, 再在锁外交给 dispatch
+        for(auto& node : due) {
+            if(node->period > 0 and not node->cancelled) {
+                node->expiry = std::max(node->expiry + node->period, core->current + 1);
+                node->self = node;
+                core->insert(node.get());
+            }
+        }
+        lck.unlock();
+        for(auto& node : due) {
+            if(node->period > 0 and node->running.exchange(true))
+                continue;       // 上一次还在执行, 这一次跳过
+            try {
+                dispatch(unique_task(detail::timer_fire(node)));
+            }
+            catch(...) {
+                // 线程池已经停止, 定时任务直接丢弃
+            }
+        }
+        due.clear();
+        lck.lock();
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+#include "unique_task.h"
+
+/* 使用说明
+    YHL::timer_wheel wheel([](YHL::unique_task&& task){ task(); });   // 到期的任务交给谁执行
+    auto once = wheel.add(std::chrono::steady_clock::now() + std::chrono::milliseconds(50),
+                          std::chrono::nanoseconds(0), []{ std::cout << "50ms\n"; });
+    auto every = wheel.add(std::chrono::steady_clock::now(), std::chrono::seconds(1),
+                           []{ std::cout << "tick\n"; });
+    every.cancel();
+ */
+
+/*
+ * 注意事项
+ * 1. 分层时间轮 : 4 层, 每层 256 个槽, 最小刻度 tick（默认 1ms）
+ *         第 0 层一个槽 = 1 tick, 第 1 层一个槽 = 256 tick, ... 一共覆盖 2^32 tick
+ * 2. 插入 : 按剩余时间选层, 按到期时刻选槽, 挂到槽的双向链表上, O(1)
+ *    取消 : 从链表上摘下来, O(1)
+ * 3. 低层转完一圈时, 把高层对应槽里的定时器重新插入, 它们会落到更低的层（cascade）
+ * 4. 只有一个定时线程, 它不执行任务, 只把到期的任务交给 dispatch（通常是线程池的 post）
+ * 5. 没有定时器时线程一直睡眠; 有定时器时算出下一个非空槽再睡, 不会每个 tick 都醒
+ * 6. 周期任务如果执行得比周期还慢, 上一次还没执行完时到期的那几次直接跳过, 同一个周期任务不会同时在两个线程上执行;
+ *    交出去的这一次没执行就被丢掉（线程池停止、drop_oldest）也算结束, 之后照常触发
+ * 7. 定时任务存成 unique_task, 只能转移的 lambda 也可以; 周期任务每次触发调用的是同一个对象
+ *    没触发就被取消、或者随 wheel 一起销毁的任务在锁外析构
+ */
+
+namespace YHL {
+
+    namespace detail {
+        struct timer_node;
+        struct wheel_core;
+    }
+
+    // 定时器句柄, 可以拷贝; 定时器已经触发或者 wheel 已经销毁时 cancel 返回 false
+    class timer_handle final {
+    private:
+        std::shared_ptr<detail::timer_node> node;
+        std::weak_ptr<detail::wheel_core> core;
+    public:
+        timer_handle() = default;
+        timer_handle(std::shared_ptr<detail::timer_node>, std::weak_ptr<detail::wheel_core>);
+
+        bool cancel();
+        bool valid() const noexcept { return node not_eq nullptr; }
+    };
+
+    class timer_wheel final : boost::noncopyable {
+    public:
+        using dispatcher = std::function<void(unique_task&&)>;
+
+    private:
+        std::shared_ptr<detail::wheel_core> core;
+        dispatcher dispatch;
+        std::thread worker;
+
+        void run();
+
+    public:
+        explicit timer_wheel(dispatcher dispatch,
+                             std::chrono::nanoseconds tick = std::chrono::milliseconds(1));
+        ~timer_wheel();
+
+        // period 为 0 表示只执行一次
+        timer_handle add(std::chrono::steady_clock::time_point when,
+                         std::chrono::nanoseconds period,
+                         unique_task fun);
+
+        // 还没触发的定时器个数
+        size_t size() const;
+    };
+
+}
+
+#endif // TIMER_WHEEL_H
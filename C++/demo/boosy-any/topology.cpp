@@ -0,0 +1,159 @@
+#include "topology.h"
+#include <map>
+#include <tuple>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+namespace {
+    std::string read_line(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+
+    int read_int(const std::string& path, const int otherwise) {
+        std::istringstream in(read_line(path));
+        int res = 0;
+        return (in >> res) ? res : otherwise;
+    }
+
+    // 当前进程允许运行的 cpu, 拿不到就认为都可以
+    bool allowed(const int cpu) {
+#ifdef __linux__
+        static const struct mask_holder {
+            cpu_set_t set;
+            bool valid;
+            mask_holder() {
+                CPU_ZERO(&set);
+                valid = sched_getaffinity(0, sizeof(set), &set) == 0;
+            }
+        } mask;
+        if(mask.valid and cpu >= 0 and cpu < CPU_SETSIZE)
+            return CPU_ISSET(cpu, &mask.set);
+#endif
+        (void)cpu;
+        return true;
+    }
+}
+
+std::vector<int> YHL::parse_cpu_list(const std::string& text) {
+    std::vector<int> res;
+    std::istringstream in(text);
+    std::string part;
+    while(std::getline(in, part, ',')) {
+        int first = 0, last = 0;
+        char dash = 0;
+        std::istringstream range(part);
+        if(not (range >> first))
+            continue;
+        last = first;
+        if(range >> dash and dash == '-')
+            range >> last;
+        for(int i = first;i <= last; ++i)
+            res.emplace_back(i);
+    }
+    return res;
+}
+
+std::vector<YHL::cpu_info> YHL::read_cpu_topology(const std::string& root) {
+    std::vector<int> ids = parse_cpu_list(read_line(root + "/online"));
+    if(ids.empty()) {
+        const int n = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        for(int i = 0;i < n; ++i)
+            ids.emplace_back(i);
+    }
+
+    std::vector<cpu_info> res;
+    std::map< std::pair<int, int>, int > cores;   // (package, core_id) -> 全局的物理核编号
+    std::map<int, int> threads;                    // 物理核 -> 已经见过的超线程个数
+    for(const int id : ids) {
+        const std::string dir = root + "/cpu" + std::to_string(id);
+        cpu_info one;
+        one.id = id;
+        one.allowed = allowed(id);
+        one.package = read_int(dir + "/topology/physical_package_id", 0);
+        const int core_id = read_int(dir + "/topology/core_id", id);
+        one.core = cores.emplace(std::make_pair(one.package, core_id), static_cast<int>(cores.size())).first->second;
+        one.smt = threads[one.core]++;
+
+        // 找 level 为 3 的 cache, 没有 L3 就按 package 分组
+        std::vector<int> shared;
+        for(int index = 0; ; ++index) {
+            const std::string cache = dir + "/cache/index" + std::to_string(index);
+            const int level = read_int(cache + "/level", -1);
+            if(level < 0)
+                break;
+            if(level == 3) {
+                shared = parse_cpu_list(read_line(cache + "/shared_cpu_list"));
+                break;
+            }
+        }
+        if(shared.empty())
+            shared = parse_cpu_list(read_line(dir + "/topology/package_cpus_list"));
+        one.l3 = shared.empty() ? id : *std::min_element(shared.begin(), shared.end());
+        res.emplace_back(one);
+    }
+    return res;
+}
+
+std::vector<int> YHL::plan_placement(const std::vector<cpu_info>& cpus, const cpu_placement placement,
+                                     const std::vector<int>& reserved) {
+    std::vector<int> res;
+    if(placement == cpu_placement::none)
+        return res;
+
+    std::vector<cpu_info> usable;
+    for(const auto& it : cpus) {
+        if(it.allowed and std::find(reserved.begin(), reserved.end(), it.id) == reserved.end())
+            usable.emplace_back(it);
+    }
+
+    // 每个物理核在它所在的 L3 里排第几
+    std::map<int, std::vector<int> > domains;
+    for(const auto& it : usable) {
+        auto& one = domains[it.l3];
+        if(std::find(one.begin(), one.end(), it.core) == one.end())
+            one.emplace_back(it.core);
+    }
+    const auto rank = [&domains](const cpu_info& one) {
+        const auto& list = domains[one.l3];
+        return static_cast<int>(std::find(list.begin(), list.end(), one.core) - list.begin());
+    };
+
+    if(placement == cpu_placement::spread) {
+        // 先按超线程分层, 同一层里各个 L3 轮流出一个物理核
+        std::sort(usable.begin(), usable.end(), [&rank](const cpu_info& a, const cpu_info& b) {
+            return std::make_tuple(a.smt, rank(a), a.l3, a.id) < std::make_tuple(b.smt, rank(b), b.l3, b.id);
+        });
+    }
+    else {
+        // 一个 L3 用完再用下一个, L3 里面也是先物理核后超线程
+        std::sort(usable.begin(), usable.end(), [&rank](const cpu_info& a, const cpu_info& b) {
+            return std::make_tuple(a.l3, a.smt, rank(a), a.id) < std::make_tuple(b.l3, b.smt, rank(b), b.id);
+        });
+    }
+    for(const auto& it : usable)
+        res.emplace_back(it.id);
+    return res;
+}
+
+bool YHL::pin_current_thread(const int cpu) {
+#ifdef __linux__
+    if(cpu < 0 or cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
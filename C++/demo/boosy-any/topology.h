@@ -0,0 +1,52 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+#include <string>
+#include <vector>
+
+/* 使用说明
+    auto cpus = YHL::read_cpu_topology();
+    for(const auto& it : cpus)
+        std::cout << it.id << "  core " << it.core << "  l3 " << it.l3 << "\n";
+
+    // 8 个线程尽量分到不同的物理核上, 0 号核留给别的模块
+    auto order = YHL::plan_placement(cpus, YHL::cpu_placement::spread, { 0 });
+    YHL::pin_current_thread(order[0]);
+ */
+
+/*
+ * 注意事项
+ * 1. 拓扑从 /sys/devices/system/cpu 读 : online 列表, 每个 cpu 的 core_id、physical_package_id,
+ *    以及 cache 里 level 为 3 的那一项的 shared_cpu_list; 没有 L3 的按 package_cpus_list 分组
+ * 2. 当前进程不允许运行的 cpu（sched_getaffinity）标记为 allowed = false, 不会排进计划
+ * 3. spread  : 先每个物理核一个线程, 并且在各个 L3 之间轮流, 用完了物理核才用超线程
+ *    compact : 先填满一个 L3（也是先物理核后超线程）, 再用下一个 L3, 适合互相共享数据的任务
+ * 4. 只有 Linux 能绑核, 其他平台 pin_current_thread 直接返回 false
+ */
+
+namespace YHL {
+
+    enum class cpu_placement { none, spread, compact };
+
+    struct cpu_info {
+        int id;         // 逻辑 cpu 编号
+        int core;       // 物理核, 在整台机器上唯一
+        int package;
+        int l3;         // 共享同一个 L3 的 cpu 里编号最小的那个
+        int smt;        // 在同一个物理核里排第几个超线程
+        bool allowed;
+    };
+
+    // 解析 "0-3,8,10-11" 这样的 cpu 列表
+    std::vector<int> parse_cpu_list(const std::string&);
+
+    std::vector<cpu_info> read_cpu_topology(const std::string& root = "/sys/devices/system/cpu");
+
+    // 返回线程依次应该绑定的 cpu, reserved 里的 cpu 不会出现
+    std::vector<int> plan_placement(const std::vector<cpu_info>&, const cpu_placement,
+                                    const std::vector<int>& reserved = std::vector<int>());
+
+    bool pin_current_thread(const int cpu);
+
+}
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,151 @@
+#ifndef UNIQUE_TASK_H
+#define UNIQUE_TASK_H
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+/* 使用说明
+    std::unique_ptr<int> ptr(new int(7));
+    YHL::unique_task task([p = std::move(ptr)]{ std::cout << *p << "\n"; });
+    YHL::unique_task other = std::move(task);   // 只能转移, 不能拷贝
+    other();
+ */
+
+/*
+ * 注意事项
+ * 1. 代替 std::function<void()> 作为线程池的任务类型
+ *         （1）std::function 要求可拷贝, 装不下 std::packaged_task 这类只能转移的对象
+ *         （2）std::function 的内部缓冲只有 16 字节, 稍大的 lambda 就要分配内存
+ * 2. 不超过 inline_size 字节、转移不抛异常的可调用对象直接放在内部缓冲里, 否则才放到堆上
+ * 3. 类型擦除用一张静态函数表（invoke / move / destroy）, 不用虚函数, 也就不用分配派生类对象
+ */
+
+namespace YHL {
+
+    class unique_task final {
+    public:
+        static constexpr size_t inline_size = 64;
+
+    private:
+        struct operations {
+            void (*invoke)(void*);
+            void (*move)(void* dst, void* src) noexcept;
+            void (*destroy)(void*) noexcept;
+        };
+
+        // 放在内部缓冲
+        template<typename F>
+        struct inline_ops {
+            static void invoke(void *self) { (*static_cast<F*>(self))(); }
+            static void move(void *dst, void *src) noexcept {
+                ::new(dst) F(std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F();
+            }
+            static void destroy(void *self) noexcept { static_cast<F*>(self)->~F(); }
+            static const operations table;
+        };
+
+        // 放在堆上, 内部缓冲只存一个指针
+        template<typename F>
+        struct heap_ops {
+            static F*& target(void *self) { return *static_cast<F**>(self); }
+            static void invoke(void *self) { (*target(self))(); }
+            static void move(void *dst, void *src) noexcept {
+                ::new(dst) F*(target(src));
+                target(src) = nullptr;
+            }
+            static void destroy(void *self) noexcept { delete target(self); }
+            static const operations table;
+        };
+
+        template<typename F>
+        using fits_inline = std::integral_constant<bool,
+            sizeof(F) <= inline_size
+            and alignof(F) <= alignof(std::max_align_t)
+            and std::is_nothrow_move_constructible<F>::value>;
+
+        alignas(std::max_align_t) unsigned char storage[inline_size];
+        const operations *ops;
+
+        template<typename F>
+        void construct(F&& fun, std::true_type) {
+            using type = typename std::decay<F>::type;
+            ::new(static_cast<void*>(storage)) type(std::forward<F>(fun));
+            ops = &inline_ops<type>::table;
+        }
+
+        template<typename F>
+        void construct(F&& fun, std::false_type) {
+            using type = typename std::decay<F>::type;
+            ::new(static_cast<void*>(storage)) type*(new type(std::forward<F>(fun)));
+            ops = &heap_ops<type>::table;
+        }
+
+        void reset() noexcept {
+            if(ops not_eq nullptr) {
+                ops->destroy(storage);
+                ops = nullptr;
+            }
+        }
+
+    public:
+        unique_task() noexcept : ops(nullptr) {}
+
+        template<typename F, typename = typename std::enable_if<
+            not std::is_same<typename std::decay<F>::type, unique_task>::value>::type>
+        unique_task(F&& fun) : ops(nullptr) {
+            construct(std::forward<F>(fun), fits_inline<typename std::decay<F>::type>());
+        }
+
+        unique_task(unique_task&& other) noexcept : ops(other.ops) {
+            if(ops not_eq nullptr) {
+                ops->move(storage, other.storage);
+                other.ops = nullptr;
+            }
+        }
+
+        unique_task& operator=(unique_task&& other) noexcept {
+            if(this not_eq &other) {
+                reset();
+                if(other.ops not_eq nullptr) {
+                    other.ops->move(storage, other.storage);
+                    ops = other.ops;
+                    other.ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        ~unique_task() noexcept { reset(); }
+
+        explicit operator bool() const noexcept {
+            return ops not_eq nullptr;
+        }
+
+        void operator()() {
+            ops->invoke(storage);
+        }
+
+    private:
+        unique_task(const unique_task&) = delete;
+        unique_task& operator=(const unique_task&) = delete;
+    };
+
+    template<typename F>
+    const unique_task::operations unique_task::inline_ops<F>::table = {
+        &unique_task::inline_ops<F>::invoke,
+        &unique_task::inline_ops<F>::move,
+        &unique_task::inline_ops<F>::destroy
+    };
+
+    template<typename F>
+    const unique_task::operations unique_task::heap_ops<F>::table = {
+        &unique_task::heap_ops<F>::invoke,
+        &unique_task::heap_ops<F>::move,
+        &unique_task::heap_ops<F>::destroy
+    };
+
+}
+
+#endif // UNIQUE_TASK_H